@@ -493,6 +493,20 @@ QJsonObject Configuration::object() const
 	return d->dataobject;
 }
 
+/// Cached configuration passes signature check and was confirmed by the
+/// server within LAST_CHECK_DAYS, so it can be used without waiting for update()
+bool Configuration::isCacheFresh() const
+{
+#ifdef LAST_CHECK_DAYS
+	if(!d->validate(d->data, d->signature))
+		return false;
+	QDate lastCheck = QDate::fromString(d->s.value("LastCheck").toString(), "yyyyMMdd");
+	return lastCheck.isValid() && lastCheck >= QDate::currentDate().addDays(-LAST_CHECK_DAYS);
+#else
+	return false;
+#endif
+}
+
 void Configuration::sendRequest(const QUrl &url)
 {
 	d->req.setUrl(url);
@@ -29,6 +29,7 @@ public:
 	void checkVersion(const QString &name);
 	static Configuration& instance();
 	QJsonObject object() const;
+	bool isCacheFresh() const;
 	void update();
 
 Q_SIGNALS:
@@ -0,0 +1,128 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "batch_io.h"
+
+#include <cstring>
+
+#include <QFile>
+#include <QThreadStorage>
+
+#include "logging.h"
+#include "page_cache.h"
+#include "uring_file_io.h"
+
+namespace {
+
+#ifdef TERA_USE_IO_URING
+/// rings are per thread, hashing and container jobs run on pool threads
+QThreadStorage<ria_tera::UringFileIo*> rings;
+
+ria_tera::UringFileIo* ring() {
+    if (!rings.hasLocalData()) {
+        rings.setLocalData(new ria_tera::UringFileIo());
+    }
+    ria_tera::UringFileIo* r = rings.localData();
+    return (r->ok() ? r : nullptr);
+}
+#endif
+
+}
+
+namespace ria_tera {
+
+bool BatchFileIo::uringAvailable() {
+#ifdef TERA_USE_IO_URING
+    static bool const available = [] {
+        if ("0" == qgetenv("TERA_IO_URING")) return false;
+        UringFileIo probe(4);
+        if (!probe.ok()) TERA_LOG(info) << "io_uring not available, using regular file I/O";
+        return probe.ok();
+    }();
+    return available;
+#else
+    return false;
+#endif
+}
+
+void BatchFileIo::readFiles(QStringList const& paths, QVector<qint64> const& sizes,
+                            QVector<QByteArray>& contents, QStringList& errors) {
+    int n = paths.size();
+    contents = QVector<QByteArray>(n);
+    errors = QStringList();
+    for (int i = 0; i < n; ++i) errors.append(QString());
+
+#ifdef TERA_USE_IO_URING
+    UringFileIo* io = (uringAvailable() ? ring() : nullptr);
+    if (nullptr != io) {
+        QVector<QByteArray> names(n);
+        QVector<char const*> cpaths(n);
+        QVector<char*> bufs(n);
+        QVector<uint32_t> caps(n);
+        QVector<int64_t> res(n);
+        for (int i = 0; i < n; ++i) {
+            names[i] = QFile::encodeName(paths[i]);
+            cpaths[i] = names[i].constData();
+            // one byte more tells if the file has grown
+            contents[i].resize(static_cast<int>(sizes[i]) + 1);
+            bufs[i] = contents[i].data();
+            caps[i] = static_cast<uint32_t>(sizes[i] + 1);
+        }
+        io->readFiles(cpaths.data(), bufs.data(), caps.data(), res.data(), static_cast<size_t>(n), PageCache::dropping());
+        if (io->ok()) {
+            for (int i = 0; i < n; ++i) {
+                if (res[i] < 0) {
+                    errors[i] = QString("Couldn't read file '%1': %2").arg(paths[i], QString::fromLocal8Bit(strerror(static_cast<int>(-res[i]))));
+                    contents[i] = QByteArray();
+                } else if (res[i] > sizes[i]) {
+                    errors[i] = QString("File '%1' changed while reading").arg(paths[i]);
+                    contents[i] = QByteArray();
+                } else {
+                    contents[i].resize(static_cast<int>(res[i]));
+                    PageCache::countRead(res[i]);
+                }
+            }
+            return;
+        }
+        // ring broke down, this thread reads without it from now on
+        TERA_LOG(warn) << "io_uring failed, using regular file I/O";
+    }
+#endif
+
+    for (int i = 0; i < n; ++i) {
+        QFile f(paths[i]);
+        if (!f.open(QIODevice::ReadOnly)) {
+            errors[i] = QString("Couldn't open file '%1'").arg(paths[i]);
+            continue;
+        }
+        contents[i] = f.read(sizes[i] + 1);
+        PageCache::drop(f.handle());
+        PageCache::countRead(contents[i].size());
+        if (QFileDevice::NoError != f.error()) {
+            errors[i] = QString("Couldn't read file '%1'").arg(paths[i]);
+            contents[i] = QByteArray();
+        } else if (contents[i].size() > sizes[i]) {
+            errors[i] = QString("File '%1' changed while reading").arg(paths[i]);
+            contents[i] = QByteArray();
+        }
+    }
+}
+
+}
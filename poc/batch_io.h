@@ -0,0 +1,50 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef BATCH_IO_H_
+#define BATCH_IO_H_
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+namespace ria_tera {
+
+///
+/// \brief Whole-file reads of many small files.
+///
+/// Uses io_uring when built with TERA_USE_IO_URING and the kernel allows it
+/// (set TERA_IO_URING=0 to turn it off), QFile otherwise. Reads follow the
+/// PageCache mode; DIRECT is treated as DONTNEED as buffers aren't aligned.
+///
+class BatchFileIo {
+public:
+    static bool uringAvailable();
+
+    /// Reads files expected to be sizes[i] bytes. errors[i] is empty on success;
+    /// a file that grew since it was stat'ed counts as failure.
+    static void readFiles(QStringList const& paths, QVector<qint64> const& sizes,
+                          QVector<QByteArray>& contents, QStringList& errors);
+};
+
+}
+
+#endif /* BATCH_IO_H_ */
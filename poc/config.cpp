@@ -35,6 +35,7 @@
     #include <QStorageInfo>
 #endif
 
+#include "logging.h"
 #include "utils.h"
 
 namespace ria_tera {
@@ -49,6 +50,15 @@ QString const Config::INI_PARAM_OUTPUT_FORMAT = Config::INI_GROUP_ + "output_for
 QString const Config::INI_PARAM_EXCL_DIRS = Config::INI_GROUP_ + "excl_dir";
 QString const Config::INI_PARAM_EXCL_DIRS_EXCEPTIONS = Config::INI_GROUP_ + "central_excl_dirs_removed_by_user.no_need_to_changed_manully";
 QString const Config::INI_PARAM_TRUSTED_CERT = Config::INI_GROUP_ + "time_server.trusted_cert";
+QString const Config::INI_PARAM_TS_MAX_REQUESTS = Config::INI_GROUP_ + "time_server.max_parallel_requests";
+QString const Config::INI_PARAM_TS_TIMEOUT = Config::INI_GROUP_ + "time_server.timeout";
+QString const Config::INI_PARAM_TS_QUOTA = Config::INI_GROUP_ + "time_server.quota";
+QString const Config::INI_PARAM_TS_MAX_OUTAGE = Config::INI_GROUP_ + "time_server.max_outage";
+QString const Config::INI_PARAM_HASH_ALGORITHM = Config::INI_GROUP_ + "hash_algorithm";
+QString const Config::HASH_ALGORITHM_AUTO = "auto";
+QString const Config::INI_PARAM_PAGE_CACHE = Config::INI_GROUP_ + "page_cache";
+QString const Config::INI_PARAM_IO_PARALLEL = Config::INI_GROUP_ + "io.parallel";
+QString const Config::INI_PARAM_IO_ORDER = Config::INI_GROUP_ + "io.order";
 
 QString const Config::EXTENSION_DDOC = "ddoc";
 QString const Config::EXTENSION_BDOC = "bdoc";
@@ -56,7 +66,9 @@ QString const Config::EXTENSION_ASICS = "asics";
 QString const Config::DEFAULT_OUT_EXTENSION = Config::EXTENSION_ASICS; // TODO move away from here? or private?
 QStringList const Config::IN_EXTENSIONS = {EXTENSION_BDOC, EXTENSION_DDOC};
 
-Config::Config()
+Config::Config() : timeServerMaxRequests(8), timeServerTimeoutSec(30), timeServerMaxOutageMin(60),
+    hashAlgorithm(Imprint::name(Imprint::DEFAULT)), imprintResolved(false), imprintConfirmed(true), imprint(Imprint::DEFAULT),
+    pageCacheMode(PageCache::name(PageCache::CACHED)), ioOrder(PhysicalOrder::name(PhysicalOrder::NONE))
 {
     outExtension = DEFAULT_OUT_EXTENSION;
     appendIniFile(INI_FILE_DEFAULTS);
@@ -68,7 +80,22 @@ Config::~Config() = default;
 void Config::appendIniFile(QString const& ini_path) {
     QSettings settings(ini_path, QSettings::IniFormat);
     timeServerURL = settings.value(INI_PARAM_TIME_SERVER_URL, timeServerURL).toString().trimmed();
+    QStringList extraUrls = readValues(INI_PARAM_TIME_SERVER_URL, settings);
+    if (settings.contains(INI_PARAM_TIME_SERVER_URL)) extraUrls.removeFirst();
+    if (!extraUrls.isEmpty()) timeServerURLsExtra = extraUrls;
     outExtension  = settings.value(INI_PARAM_OUTPUT_FORMAT,   outExtension).toString().trimmed();
+    timeServerMaxRequests = settings.value(INI_PARAM_TS_MAX_REQUESTS, timeServerMaxRequests).toInt();
+    timeServerTimeoutSec  = settings.value(INI_PARAM_TS_TIMEOUT,      timeServerTimeoutSec).toInt();
+    timeServerMaxOutageMin = settings.value(INI_PARAM_TS_MAX_OUTAGE,  timeServerMaxOutageMin).toInt();
+    setHashAlgorithm(settings.value(INI_PARAM_HASH_ALGORITHM, hashAlgorithm).toString());
+    setPageCacheMode(settings.value(INI_PARAM_PAGE_CACHE, pageCacheMode).toString());
+    ioLimits.ssd        = settings.value(INI_PARAM_IO_PARALLEL + ".ssd",        ioLimits.ssd).toInt();
+    ioLimits.rotational = settings.value(INI_PARAM_IO_PARALLEL + ".rotational", ioLimits.rotational).toInt();
+    ioLimits.network    = settings.value(INI_PARAM_IO_PARALLEL + ".network",    ioLimits.network).toInt();
+    ioLimits.other      = settings.value(INI_PARAM_IO_PARALLEL + ".other",      ioLimits.other).toInt();
+    setPhysicalOrder(settings.value(INI_PARAM_IO_ORDER, ioOrder).toString());
+    // later files take precedence
+    tsQuotas = readValues(INI_PARAM_TS_QUOTA, settings) + tsQuotas;
     exclDirs.unite(readExclDirs(INI_PARAM_EXCL_DIRS, settings));
     exclDirExclusions.unite(readExclDirs(INI_PARAM_EXCL_DIRS_EXCEPTIONS, settings));
 }
@@ -94,6 +121,20 @@ QSet<QString> Config::readExclDirs(QString const& key, QSettings const& settings
     return excl_dirs_set;
 }
 
+QStringList Config::readValues(QString const& key, QSettings const& settings) {
+    QStringList res;
+    if (settings.contains(key)) {
+        res.append(settings.value(key).toString());
+    }
+    QString const key_ = key + ".";
+    for (QString const& k : settings.allKeys()) {
+        if (k.startsWith(key_)) {
+            res.append(settings.value(k).toString());
+        }
+    }
+    return res;
+}
+
 QString Config::getDefaultTimeServerURL() {
     return timeServerURLDefault;
 }
@@ -102,10 +143,122 @@ QString Config::getTimeServerURL() {
     return timeServerURL.isEmpty() ? timeServerURLDefault : timeServerURL;
 }
 
+QStringList Config::getTimeServerURLs() {
+    QStringList res;
+    if (!getTimeServerURL().isEmpty()) res.append(getTimeServerURL());
+    for (QString const& url : timeServerURLsExtra) {
+        QString u = url.trimmed();
+        if (!u.isEmpty() && !res.contains(u)) res.append(u);
+    }
+    return res;
+}
+
 QString Config::getOutExtension() {
     return outExtension;
 }
 
+TsaConcurrencyController::Parameters Config::getTsaConcurrencyParameters() const {
+    TsaConcurrencyController::Parameters p;
+    p.maxWindow = qMax(1, timeServerMaxRequests);
+    return p;
+}
+
+void Config::setTimeServerMaxRequests(int max) {
+    timeServerMaxRequests = max;
+}
+
+int Config::getTimeServerTimeout() const {
+    return qMax(1, timeServerTimeoutSec) * 1000;
+}
+
+TsaQuota::Limits Config::getTsaQuotaLimits(QString const& url) const {
+    QString u = url.trimmed();
+    while (u.endsWith('/')) u.chop(1);
+    for (QString const& spec : tsQuotas) {
+        QString s = spec.trimmed();
+        int sp = s.indexOf(' ');
+        QString specUrl = (sp < 0 ? s : s.left(sp));
+        while (specUrl.endsWith('/')) specUrl.chop(1);
+        if (0 != specUrl.compare(u, Qt::CaseInsensitive)) continue;
+
+        bool ok = true;
+        TsaQuota::Limits l = TsaQuota::Limits::parse(sp < 0 ? QString() : s.mid(sp + 1), &ok);
+        if (!ok) {
+            TERA_LOG(warn) << "Can't parse time server quota '" << spec << "'";
+        }
+        return l;
+    }
+    return TsaQuota::Limits();
+}
+
+TsaCircuitBreaker::Parameters Config::getTsaBreakerParameters() const {
+    TsaCircuitBreaker::Parameters p;
+    p.maxOutageMs = qMax(0, timeServerMaxOutageMin) * 60LL * 1000;
+    return p;
+}
+
+void Config::setHashAlgorithm(QString const& name) {
+    hashAlgorithm = name.trimmed().toLower();
+    imprintResolved = false;
+    imprintConfirmed = true;
+}
+
+Imprint::Algorithm Config::getImprintAlgorithm() {
+    if (imprintResolved) return imprint;
+    imprintResolved = true;
+    if (HASH_ALGORITHM_AUTO == hashAlgorithm) {
+        imprint = Imprint::fastest({Imprint::SHA256, Imprint::SHA384, Imprint::SHA512});
+        // SHA-256 is what every time server takes, others need a test request
+        imprintConfirmed = (Imprint::DEFAULT == imprint);
+        TERA_LOG(info) << "Fastest hash algorithm on this machine: " << Imprint::name(imprint);
+    } else if (!Imprint::fromName(hashAlgorithm, imprint)) {
+        TERA_LOG(warn) << "Unknown hash algorithm '" << hashAlgorithm << "', using " << Imprint::name(Imprint::DEFAULT);
+        imprint = Imprint::DEFAULT;
+    }
+    return imprint;
+}
+
+bool Config::needsImprintCheck() {
+    getImprintAlgorithm();
+    return !imprintConfirmed;
+}
+
+void Config::confirmImprint(bool accepted) {
+    imprintConfirmed = true;
+    if (!accepted && Imprint::DEFAULT != imprint) {
+        TERA_LOG(warn) << "Time server didn't accept " << Imprint::name(imprint) << ", using " << Imprint::name(Imprint::DEFAULT);
+        imprint = Imprint::DEFAULT;
+    }
+}
+
+void Config::setPageCacheMode(QString const& name) {
+    pageCacheMode = name.trimmed().toLower();
+}
+
+PageCache::Mode Config::getPageCacheMode() const {
+    PageCache::Mode m = PageCache::CACHED;
+    if (!PageCache::fromName(pageCacheMode, m)) {
+        TERA_LOG(warn) << "Unknown page cache mode '" << pageCacheMode << "', using " << PageCache::name(PageCache::CACHED);
+    }
+    return m;
+}
+
+IoScheduler::Limits Config::getIoLimits() const {
+    return ioLimits;
+}
+
+void Config::setPhysicalOrder(QString const& name) {
+    ioOrder = name.trimmed().toLower();
+}
+
+PhysicalOrder::Mode Config::getPhysicalOrder() const {
+    PhysicalOrder::Mode m = PhysicalOrder::NONE;
+    if (!PhysicalOrder::fromName(ioOrder, m)) {
+        TERA_LOG(warn) << "Unknown file order '" << ioOrder << "', using " << PhysicalOrder::name(PhysicalOrder::NONE);
+    }
+    return m;
+}
+
 QSet<QString> Config::getExclDirsXXXXXXXX() {
     return exclDirs;
 }
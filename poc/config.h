@@ -24,6 +24,14 @@
 #include <QSet>
 #include <QSslCertificate>
 
+#include "imprint.h"
+#include "io_scheduler.h"
+#include "page_cache.h"
+#include "physical_order.h"
+#include "tsa_breaker.h"
+#include "tsa_concurrency.h"
+#include "tsa_quota.h"
+
 namespace ria_tera {
 
 class Config {
@@ -39,6 +47,15 @@ public:
     static QString const INI_PARAM_EXCL_DIRS;
     static QString const INI_PARAM_EXCL_DIRS_EXCEPTIONS;
     static QString const INI_PARAM_TRUSTED_CERT;
+    static QString const INI_PARAM_TS_MAX_REQUESTS;
+    static QString const INI_PARAM_TS_TIMEOUT;
+    static QString const INI_PARAM_TS_QUOTA;
+    static QString const INI_PARAM_TS_MAX_OUTAGE;
+    static QString const INI_PARAM_HASH_ALGORITHM;
+    static QString const HASH_ALGORITHM_AUTO;
+    static QString const INI_PARAM_PAGE_CACHE;
+    static QString const INI_PARAM_IO_PARALLEL;
+    static QString const INI_PARAM_IO_ORDER;
 
     static QString const EXTENSION_BDOC;
     static QString const EXTENSION_DDOC;
@@ -54,7 +71,32 @@ public:
     QString getDefaultTimeServerURL();
 
     QString getTimeServerURL();
+    /// getTimeServerURL followed by additional endpoints ("time_server.url.N" in ini)
+    QStringList getTimeServerURLs();
     QString getOutExtension(); // TODO no read
+    TsaConcurrencyController::Parameters getTsaConcurrencyParameters() const;
+    void setTimeServerMaxRequests(int max);
+    /// request timeout in milliseconds
+    int getTimeServerTimeout() const;
+    TsaCircuitBreaker::Parameters getTsaBreakerParameters() const;
+    /// limits from "time_server.quota.N=<url> per_day=.. per_month=.. rate=.. burst=.."
+    TsaQuota::Limits getTsaQuotaLimits(QString const& url) const;
+    /// "sha256", "sha384", "sha512" or "auto" - fastest one on this machine
+    void setHashAlgorithm(QString const& name);
+    /// "auto" is resolved by a short benchmark on first call
+    Imprint::Algorithm getImprintAlgorithm();
+    /// "auto" picked an algorithm other than SHA-256 that no time server has accepted yet
+    bool needsImprintCheck();
+    /// Outcome of a test request hashed with getImprintAlgorithm(), SHA-256 is used if it was rejected
+    void confirmImprint(bool accepted);
+    /// "cached", "dontneed" or "direct", see PageCache
+    void setPageCacheMode(QString const& name);
+    PageCache::Mode getPageCacheMode() const;
+    /// jobs at once per storage device, "io.parallel.<ssd|rotational|network|other>" in ini
+    IoScheduler::Limits getIoLimits() const;
+    /// "none", "inode" or "extent", order of files on rotational devices
+    void setPhysicalOrder(QString const& name);
+    PhysicalOrder::Mode getPhysicalOrder() const;
     QSet<QString> getExclDirsXXXXXXXX();
     QSet<QString> getExclDirExclusions();
 
@@ -65,11 +107,24 @@ public:
     static void append_excl_dirs(QString const& val, QSet<QString>& excl_dirs_set); // TODO no need to be public
 private:
     static QSet<QString> readExclDirs(QString const& key, QSettings const& settings);
+    static QStringList readValues(QString const& key, QSettings const& settings);
 
     QString timeServerURLDefault;
 
     QString outExtension;
     QString timeServerURL;
+    QStringList timeServerURLsExtra;
+    int timeServerMaxRequests;
+    int timeServerTimeoutSec;
+    int timeServerMaxOutageMin;
+    QStringList tsQuotas;
+    QString hashAlgorithm;
+    bool imprintResolved;
+    bool imprintConfirmed;
+    Imprint::Algorithm imprint;
+    QString pageCacheMode;
+    IoScheduler::Limits ioLimits;
+    QString ioOrder;
     QSet<QString> exclDirs;
     QSet<QString> exclDirExclusions;
 };
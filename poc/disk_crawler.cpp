@@ -30,6 +30,8 @@
 #include <QStack>
 
 #include "config.h"
+#include "stage_metrics.h"
+#include "trace.h"
 #include "../src/common/Bdoc10Handler.h"
 
 #if QT_VERSION < 0x050700
@@ -66,10 +68,19 @@ bool DiskCrawler::addInputDir(QString const& dir, bool rec) {
     return true; // TODO check if dir is actually excluded
 }
 
-QStringList DiskCrawler::crawl() {
+QVector<PathStore::FileId> DiskCrawler::crawl(PathStore& store) {
+    QVector<PathStore::FileId> found;
+    crawl(&store, &found);
+    return found;
+}
+
+void DiskCrawler::crawl() {
+    crawl(nullptr, nullptr);
+}
+
+void DiskCrawler::crawl(PathStore* store, QVector<PathStore::FileId>* found) {
     const QString EXTENSION_BDOC_WITH_DOT("." + ria_tera::Config::EXTENSION_BDOC);
 
-    QStringList res;
     QStringList excldir;
     const QString separator("/");
     for (int i = 0; i < excl_dirs.size(); ++i) {
@@ -96,8 +107,9 @@ QStringList DiskCrawler::crawl() {
             flags |= QDirIterator::Subdirectories;
         }
 
-        if (!monitor.processingPath(in_dir.path, (double)i / in_dirs.length())) return res; // TODO cancel
+        if (!monitor.processingPath(in_dir.path, (double)i / in_dirs.length())) return; // TODO cancel
 
+        Trace::Span span("crawl", "io");
         QDirIterator it(in_dir.path, nameFilter, QDir::Files, flags);
         while (it.hasNext()) {
             it.next();
@@ -109,17 +121,30 @@ QStringList DiskCrawler::crawl() {
             }
 
             //in case of BDOC only BDOC1.0 need be processed
+            qint64 bdocStart = -1, bdocEnd = -1;
             if (filePath.endsWith(EXTENSION_BDOC_WITH_DOT)) {
-                if (!Bdoc10Handler::isBdoc10Container(filePath)) {
+                if (Trace::enabled()) bdocStart = Trace::now();
+                bool bdoc10 = Bdoc10Handler::isBdoc10Container(filePath);
+                if (bdocStart >= 0) bdocEnd = Trace::now();
+                if (!bdoc10) {
+                    if (bdocStart >= 0) Trace::complete("bdoc_check", "io", bdocStart, bdocEnd);
                     continue;
                 }
             }
             monitor.foundFile(filePath);  // TODO cancel returns false
-            res << filePath;
+            stageMetrics.filesFound.fetchAndAddRelaxed(1);
+            qint64 fileId = -1;
+            if (nullptr != store) {
+                // overlapping input dirs find files twice
+                int cnt = store->size();
+                PathStore::FileId id = store->add(filePath);
+                if (store->size() > cnt) found->append(id);
+                fileId = id;
+            }
+            // recorded once the file has an id in the path store
+            if (bdocStart >= 0) Trace::complete("bdoc_check", "io", bdocStart, bdocEnd, fileId);
         }
     }
-
-    return res;
 }
 
 }
@@ -23,6 +23,7 @@
 
 #include <QStringList>
 
+#include "path_store.h"
 #include "utils.h"
 
 namespace ria_tera {
@@ -33,8 +34,13 @@ public:
     DiskCrawler(DiscCrawlMonitorCallback& mon, QStringList const& ext);
     void addExcludeDirs(QStringList const& excl);
     bool addInputDir(QString const& dir, bool recursive);
-    QStringList crawl();
+    /// Adds found files to store, returns their ids in the order found
+    QVector<PathStore::FileId> crawl(PathStore& store);
+    /// Found files are only reported to monitor
+    void crawl();
 private:
+    void crawl(PathStore* store, QVector<PathStore::FileId>* found);
+
     /// file extension to search
     QStringList extensions;
     DiscCrawlMonitorCallback& monitor;
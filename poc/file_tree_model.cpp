@@ -0,0 +1,299 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "file_tree_model.h"
+
+#include <algorithm>
+
+#include <QFileInfo>
+#include <QPair>
+#include <QStringList>
+
+namespace ria_tera {
+
+/// directory being filled while building from sorted paths
+struct FileTree::Frame {
+    quint32 node;
+    QString name;
+    QVector<quint32> kids;
+};
+
+void FileTree::setFiles(PathStore const& s, QVector<PathStore::FileId> const& ids) {
+    clear();
+    if (ids.isEmpty()) return;
+    store = s;
+
+    QVector<QPair<QString, PathStore::FileId>> sorted;
+    sorted.reserve(ids.size());
+    for (PathStore::FileId id : ids) {
+        sorted.append(qMakePair(store.path(id), id));
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    fileNodes.reserve(sorted.size());
+    fileIds.reserve(sorted.size());
+    // files of a directory are consecutive in sorted order, so directories
+    // on the stack are complete once a path leaves them
+    QVector<Frame> stack;
+    auto closeDir = [&]() {
+        Frame& top = stack.last();
+        Node& d = nodes[top.node];
+        d.firstChild = children.size();
+        d.childCount = top.kids.size();
+        d.end = nodes.size();
+        d.fileEnd = fileNodes.size();
+        d.checked = d.fileEnd - d.fileBegin;
+        children += top.kids;
+        stack.removeLast();
+    };
+    stack.append(Frame{addNode(ROOT, 0, "/"), QString(), QVector<quint32>()});
+    for (auto const& f : sorted) {
+        QStringList parts = f.first.split('/', QString::SkipEmptyParts);
+        if (parts.isEmpty()) parts.append(f.first);
+
+        // stack[i] is directory parts[i - 1]
+        int common = 1;
+        while (common < stack.size() && common < parts.size() && stack.at(common).name == parts.at(common - 1)) {
+            ++common;
+        }
+        while (stack.size() > common) closeDir();
+        for (int i = common - 1; i < parts.size() - 1; ++i) {
+            Frame& top = stack.last();
+            quint32 dir = addNode(top.node, top.kids.size(), parts.at(i));
+            top.kids.append(dir);
+            stack.append(Frame{dir, parts.at(i), QVector<quint32>()});
+        }
+        Frame& top = stack.last();
+        quint32 file = addNode(top.node, top.kids.size(), parts.last());
+        top.kids.append(file);
+        nodes[file].fileEnd = nodes[file].fileBegin + 1;
+        fileNodes.append(file);
+        fileIds.append(f.second);
+    }
+    while (!stack.isEmpty()) closeDir();
+
+    // everything checked
+    bits.fill(~quint64(0), (fileNodes.size() + 63) / 64);
+}
+
+void FileTree::clear() {
+    store = PathStore();
+    nodes.clear();
+    children.clear();
+    arena.clear();
+    fileNodes.clear();
+    fileIds.clear();
+    bits.clear();
+}
+
+quint32 FileTree::addNode(quint32 parent, quint32 row, QString const& name) {
+    Node n;
+    n.parent = parent;
+    n.name = arena.size();
+    n.row = row;
+    n.firstChild = 0;
+    n.childCount = 0;
+    n.end = nodes.size() + 1;
+    n.fileBegin = fileNodes.size();
+    n.fileEnd = fileNodes.size();
+    n.checked = 0;
+    arena.append(name.toUtf8());
+    arena.append('\0');
+    nodes.append(n);
+    return nodes.size() - 1;
+}
+
+QString FileTree::name(quint32 node) const {
+    return QString::fromUtf8(arena.constData() + nodes.at(node).name);
+}
+
+Qt::CheckState FileTree::checkState(quint32 node) const {
+    Node const& n = nodes.at(node);
+    if (isFile(node)) return bit(n.fileBegin) ? Qt::Checked : Qt::Unchecked;
+    if (0 == n.checked) return Qt::Unchecked;
+    if (n.fileEnd - n.fileBegin == n.checked) return Qt::Checked;
+    return Qt::PartiallyChecked;
+}
+
+void FileTree::setChecked(quint32 node, bool on) {
+    Node const& n = nodes.at(node);
+    qint64 delta;
+    if (isFile(node)) {
+        if (bit(n.fileBegin) == on) return;
+        delta = (on ? 1 : -1);
+    } else {
+        quint32 target = (on ? n.fileEnd - n.fileBegin : 0);
+        if (n.checked == target) return;
+        delta = qint64(target) - n.checked;
+        for (quint32 d = node; d < n.end; ++d) {
+            Node& sub = nodes[d];
+            if (!isFile(d)) sub.checked = (on ? sub.fileEnd - sub.fileBegin : 0);
+        }
+    }
+    setBits(n.fileBegin, n.fileEnd, on);
+    for (quint32 p = node; ROOT != p;) {
+        p = nodes.at(p).parent;
+        nodes[p].checked = quint32(nodes.at(p).checked + delta);
+    }
+    emit checkStateChanged(node);
+}
+
+void FileTree::setBits(int begin, int end, bool on) {
+    for (int pos = begin; pos < end;) {
+        int b = pos & 63;
+        int cnt = qMin(64 - b, end - pos);
+        quint64 mask = (64 == cnt ? ~quint64(0) : ((quint64(1) << cnt) - 1) << b);
+        if (on) bits[pos >> 6] |= mask;
+        else bits[pos >> 6] &= ~mask;
+        pos += cnt;
+    }
+}
+
+QVector<PathStore::FileId> FileTree::checkedFiles() const {
+    QVector<PathStore::FileId> res;
+    for (int pos = 0; pos < fileIds.size(); ++pos) {
+        if (bit(pos)) res.append(fileIds.at(pos));
+    }
+    return res;
+}
+
+/////////////////////////////////////////////////////////////////////
+
+FileTreeModel::FileTreeModel(FileTree& t, View v, QObject* parent) :
+    QAbstractItemModel(parent), tree(t), view(v)
+{
+    iconComputer = ip.icon(QFileIconProvider::IconType::Computer);
+    iconFolder = ip.icon(QFileIconProvider::IconType::Folder);
+    connect(&tree, &FileTree::checkStateChanged, this, &FileTreeModel::treeCheckStateChanged);
+}
+
+void FileTreeModel::endReset() {
+    fetched = QVector<bool>(tree.nodeCount(), false);
+    iconFile = (tree.fileCount() > 0 ? ip.icon(QFileInfo(tree.path(0))) : QIcon());
+    endResetModel();
+}
+
+QModelIndex FileTreeModel::indexOf(quint32 node) const {
+    if (LIST == view) return createIndex(tree.fileBegin(node), 0, quintptr(node));
+    if (FileTree::ROOT == node) return createIndex(0, 0, quintptr(node));
+    return createIndex(tree.row(node), 0, quintptr(node));
+}
+
+QModelIndex FileTreeModel::index(int row, int column, QModelIndex const& parent) const {
+    if (0 != column || row < 0 || row >= rowCount(parent)) return QModelIndex();
+    if (LIST == view) return createIndex(row, 0, quintptr(tree.fileNode(row)));
+    if (!parent.isValid()) return indexOf(FileTree::ROOT);
+    return createIndex(row, 0, quintptr(tree.child(node(parent), row)));
+}
+
+QModelIndex FileTreeModel::parent(QModelIndex const& child) const {
+    if (LIST == view || !child.isValid()) return QModelIndex();
+    quint32 n = node(child);
+    if (FileTree::ROOT == n) return QModelIndex();
+    return indexOf(tree.parent(n));
+}
+
+int FileTreeModel::rowCount(QModelIndex const& parent) const {
+    if (LIST == view) return (parent.isValid() ? 0 : tree.fileCount());
+    if (!parent.isValid()) return (tree.nodeCount() > 0 ? 1 : 0);
+    quint32 n = node(parent);
+    return (fetched.at(n) ? tree.childCount(n) : 0);
+}
+
+int FileTreeModel::columnCount(QModelIndex const& parent) const {
+    Q_UNUSED(parent);
+    return 1;
+}
+
+bool FileTreeModel::hasChildren(QModelIndex const& parent) const {
+    if (!parent.isValid()) return rowCount(parent) > 0;
+    if (LIST == view) return false;
+    return tree.childCount(node(parent)) > 0;
+}
+
+bool FileTreeModel::canFetchMore(QModelIndex const& parent) const {
+    if (LIST == view || !parent.isValid()) return false;
+    quint32 n = node(parent);
+    return !fetched.at(n) && tree.childCount(n) > 0;
+}
+
+void FileTreeModel::fetchMore(QModelIndex const& parent) {
+    if (!canFetchMore(parent)) return;
+    quint32 n = node(parent);
+    beginInsertRows(parent, 0, tree.childCount(n) - 1);
+    fetched[n] = true;
+    endInsertRows();
+}
+
+QVariant FileTreeModel::data(QModelIndex const& index, int role) const {
+    if (!index.isValid()) return QVariant();
+    quint32 n = node(index);
+    switch (role) {
+    case Qt::DisplayRole:
+        return (LIST == view ? tree.path(tree.fileBegin(n)) : tree.name(n));
+    case Qt::DecorationRole:
+        if (LIST == view) return QVariant();
+        if (FileTree::ROOT == n) return iconComputer;
+        return (tree.isFile(n) ? iconFile : iconFolder);
+    case Qt::CheckStateRole:
+        return tree.checkState(n);
+    default:
+        return QVariant();
+    }
+}
+
+bool FileTreeModel::setData(QModelIndex const& index, QVariant const& value, int role) {
+    if (!index.isValid() || Qt::CheckStateRole != role) return false;
+    tree.setChecked(node(index), Qt::Checked == Qt::CheckState(value.toInt()));
+    return true;
+}
+
+Qt::ItemFlags FileTreeModel::flags(QModelIndex const& index) const {
+    if (!index.isValid()) return Qt::NoItemFlags;
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsUserCheckable;
+}
+
+void FileTreeModel::treeCheckStateChanged(quint32 n) {
+    QVector<int> const roles{Qt::CheckStateRole};
+    if (LIST == view) {
+        emit dataChanged(indexOf(tree.fileNode(tree.fileBegin(n))),
+                         indexOf(tree.fileNode(tree.fileEnd(n) - 1)), roles);
+        return;
+    }
+    // node and its ancestors, where they are rows
+    for (quint32 p = n;; p = tree.parent(p)) {
+        if (FileTree::ROOT == p || fetched.at(tree.parent(p))) {
+            QModelIndex i = indexOf(p);
+            emit dataChanged(i, i, roles);
+        }
+        if (FileTree::ROOT == p) break;
+    }
+    // children of expanded directories below it
+    for (quint32 d = n; d < tree.subtreeEnd(n); ++d) {
+        if (tree.isFile(d)) continue;
+        if (!fetched.at(d)) {
+            d = tree.subtreeEnd(d) - 1;
+            continue;
+        }
+        int cnt = tree.childCount(d);
+        emit dataChanged(indexOf(tree.child(d, 0)), indexOf(tree.child(d, cnt - 1)), roles);
+    }
+}
+
+}
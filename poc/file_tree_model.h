@@ -0,0 +1,154 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef FILE_TREE_MODEL_H_
+#define FILE_TREE_MODEL_H_
+
+#include <QAbstractItemModel>
+#include <QByteArray>
+#include <QFileIconProvider>
+#include <QIcon>
+#include <QObject>
+#include <QVector>
+
+#include "path_store.h"
+
+namespace ria_tera {
+
+///
+/// \brief Path trie of the files shown in the preview, with their check state.
+///
+/// Nodes are numbered in depth first order from sorted paths, so the files
+/// of a directory are a contiguous range of file positions and its
+/// subdirectories a contiguous range of nodes. Check state is one bit per
+/// file, directories keep a count of checked files below them.
+///
+class FileTree : public QObject {
+    Q_OBJECT
+public:
+    static quint32 const ROOT = 0;
+
+    void setFiles(PathStore const& store, QVector<PathStore::FileId> const& ids);
+    void clear();
+
+    int nodeCount() const { return nodes.size(); };
+    int fileCount() const { return fileNodes.size(); };
+    bool isFile(quint32 node) const { return nodes.at(node).childCount == 0 && node != ROOT; };
+    quint32 parent(quint32 node) const { return nodes.at(node).parent; };
+    /// row of node among its parent's children
+    int row(quint32 node) const { return nodes.at(node).row; };
+    int childCount(quint32 node) const { return nodes.at(node).childCount; };
+    quint32 child(quint32 node, int row) const { return children.at(nodes.at(node).firstChild + row); };
+    /// one past the last node of the subtree of node
+    quint32 subtreeEnd(quint32 node) const { return nodes.at(node).end; };
+    /// range of file positions under node
+    int fileBegin(quint32 node) const { return nodes.at(node).fileBegin; };
+    int fileEnd(quint32 node) const { return nodes.at(node).fileEnd; };
+    quint32 fileNode(int pos) const { return fileNodes.at(pos); };
+
+    QString name(quint32 node) const;
+    QString path(int pos) const { return store.path(fileIds.at(pos)); };
+
+    Qt::CheckState checkState(quint32 node) const;
+    void setChecked(quint32 node, bool checked);
+    QVector<PathStore::FileId> checkedFiles() const;
+signals:
+    /// check state of node, its subtree and its ancestors may have changed
+    void checkStateChanged(quint32 node);
+private:
+    struct Frame;
+    struct Node {
+        quint32 parent;
+        /// offset of '\0' terminated UTF-8 name in arena
+        quint32 name;
+        quint32 row;
+        /// children of directories are children[firstChild, firstChild + childCount)
+        quint32 firstChild;
+        quint32 childCount;
+        quint32 end;
+        quint32 fileBegin;
+        quint32 fileEnd;
+        /// checked files in subtree
+        quint32 checked;
+    };
+
+    quint32 addNode(quint32 parent, quint32 row, QString const& name);
+    bool bit(int pos) const { return (bits.at(pos >> 6) >> (pos & 63)) & 1; };
+    void setBits(int begin, int end, bool on);
+
+    PathStore store;
+    QVector<Node> nodes;
+    QVector<quint32> children;
+    QByteArray arena;
+    /// by file position: node and id in store
+    QVector<quint32> fileNodes;
+    QVector<PathStore::FileId> fileIds;
+    QVector<quint64> bits;
+};
+
+///
+/// \brief Serves FileTree to a QTreeView or, as a flat list of full paths,
+/// to a QListView.
+///
+/// Children of a directory become rows through canFetchMore/fetchMore when
+/// it is first expanded, so only what the user opens costs anything in the
+/// view. Several models
+/// may share one FileTree; check state changes show up in all of them.
+///
+class FileTreeModel : public QAbstractItemModel {
+    Q_OBJECT
+public:
+    enum View {TREE, LIST};
+
+    FileTreeModel(FileTree& tree, View view, QObject* parent = nullptr);
+
+    QModelIndex index(int row, int column, QModelIndex const& parent = QModelIndex()) const override;
+    QModelIndex parent(QModelIndex const& child) const override;
+    int rowCount(QModelIndex const& parent = QModelIndex()) const override;
+    int columnCount(QModelIndex const& parent = QModelIndex()) const override;
+    bool hasChildren(QModelIndex const& parent = QModelIndex()) const override;
+    bool canFetchMore(QModelIndex const& parent) const override;
+    void fetchMore(QModelIndex const& parent) override;
+    QVariant data(QModelIndex const& index, int role = Qt::DisplayRole) const override;
+    bool setData(QModelIndex const& index, QVariant const& value, int role = Qt::EditRole) override;
+    Qt::ItemFlags flags(QModelIndex const& index) const override;
+
+    /// Call around FileTree::setFiles and FileTree::clear
+    void beginReset() { beginResetModel(); };
+    void endReset();
+
+    quint32 node(QModelIndex const& index) const { return static_cast<quint32>(index.internalId()); };
+    QModelIndex indexOf(quint32 node) const;
+private slots:
+    void treeCheckStateChanged(quint32 node);
+private:
+    FileTree& tree;
+    View view;
+    /// directories whose children are rows, see fetchMore
+    QVector<bool> fetched;
+
+    QFileIconProvider ip;
+    QIcon iconComputer;
+    QIcon iconFolder;
+    QIcon iconFile;
+};
+
+}
+
+#endif /* FILE_TREE_MODEL_H_ */
@@ -32,7 +32,8 @@
 namespace ria_tera {
 
 FileListWindow::FileListWindow(QWidget *parent) :
-    QDialog(parent, Qt::WindowTitleHint | Qt::WindowSystemMenuHint | Qt::WindowCloseButtonHint)
+    QDialog(parent, Qt::WindowTitleHint | Qt::WindowSystemMenuHint | Qt::WindowCloseButtonHint),
+    treeModel(tree, FileTreeModel::TREE), listModel(tree, FileTreeModel::LIST)
 {
     setupUi(this);
     connect(rbList, SIGNAL(toggled(bool)), this, SLOT(viewTypeToggled(bool)));
@@ -60,8 +61,11 @@ FileListWindow::FileListWindow(QWidget *parent) :
 //item1->appendRow(item10);
 //item10->appendRow(item100);
 
-    listView->setModel(model.getModelListPtr());
-    treeView->setModel(model.getModelTreePtr());
+    listView->setModel(&listModel);
+    listView->setUniformItemSizes(true);
+    listView->setLayoutMode(QListView::Batched);
+    treeView->setModel(&treeModel);
+    treeView->setUniformRowHeights(true);
 
     connect(buttonBox, SIGNAL(accepted()), this, SLOT(accept()));
     connect(buttonBox, SIGNAL(rejected()), this, SLOT(reject()));
@@ -83,24 +87,31 @@ void FileListWindow::viewTypeToggled(bool listView) {
     btnDeselect->setVisible(listView);
 }
 
-void FileListWindow::setFileList(QStringList const& files) {
-    model.setFileList(files);
-    treeView->expandAll();
+void FileListWindow::setFileList(PathStore const& store, QVector<PathStore::FileId> const& files) {
+    treeModel.beginReset();
+    listModel.beginReset();
+    tree.setFiles(store, files);
+    treeModel.endReset();
+    listModel.endReset();
+
+    // open directories down to the first one with several entries
+    QModelIndex dir = treeModel.index(0, 0);
+    while (dir.isValid() && treeModel.hasChildren(dir)) {
+        treeModel.fetchMore(dir);
+        treeView->expand(dir);
+        if (1 != treeModel.rowCount(dir)) break;
+        dir = treeModel.index(0, 0, dir);
+    }
 }
 
-QStringList FileListWindow::extractSelectedFileList() {
-    QStringList selectedFiles;
-
-    for (int i = 0; i < model.getModelListPtr()->rowCount(); ++i) {
-        QStandardItem* item = model.getModelListPtr()->item(i);
-        if (NULL == item) continue;
-        if (Qt::Checked == item->checkState()) {
-            QString filePath = item->text();
-            selectedFiles.append(filePath);
-        }
-    }
+QVector<PathStore::FileId> FileListWindow::extractSelectedFileList() {
+    QVector<PathStore::FileId> selectedFiles = tree.checkedFiles();
 
-    model.clear();
+    treeModel.beginReset();
+    listModel.beginReset();
+    tree.clear();
+    treeModel.endReset();
+    listModel.endReset();
     return selectedFiles;
 }
 
@@ -123,170 +134,13 @@ void FileListWindow::handleSelectNone() {
 void FileListWindow::setCheckStateForSelection(Qt::CheckState state) {
     QModelIndexList selection = listView->selectionModel()->selectedIndexes();
     for (auto it = selection.begin(); it != selection.end(); ++it) {
-        QStandardItem* item = model.getModelListPtr()->itemFromIndex(*it);
-        item->setCheckState(state);
+        listModel.setData(*it, state, Qt::CheckStateRole);
     }
 }
 
 void FileListWindow::setCheckStateForAll(Qt::CheckState state) {
-    for (int i = 0; i < model.getModelListPtr()->rowCount(); ++i) {
-        QStandardItem* item = model.getModelListPtr()->item(i);
-        item->setCheckState(state);
-    }
-}
-
-/////////////////////////////////////////////////////////////////////
-
-JointModelItem::JointModelItem(const QString & text) : QStandardItem(text) {
-    init();
-}
-
-JointModelItem::JointModelItem(const QIcon & icon, const QString & text) : QStandardItem(icon, text) {
-    init();
-}
-
-void JointModelItem::init() {
-    cntUnchecked = 0;
-    cntPartChecked = 0;
-    cntChecked = 0;
-    parallelItem = NULL;
-    parentItem = NULL;
-}
-
-void JointModelItem::setParallelItem(JointModelItem* pi) {
-    if (pi == parallelItem) return;
-    parallelItem = pi;
-    parallelItem->setParallelItem(this);
-}
-
-Qt::CheckState JointModelItem::aggregatedCheckState() {
-    if (cntChecked == 0 && cntPartChecked == 0) return Qt::CheckState::Unchecked;
-    if (cntChecked > 0 && cntPartChecked == 0 && cntUnchecked == 0) return Qt::CheckState::Checked;
-    return Qt::CheckState::PartiallyChecked;
-}
-
-void JointModelItem::changeCnt(int dx, Qt::CheckState state) {
-    if (Qt::CheckState::Checked == state) cntChecked += dx;
-    else if (Qt::CheckState::Unchecked == state) cntUnchecked += dx;
-    else if (Qt::CheckState::PartiallyChecked == state) cntPartChecked += dx;
-}
-
-void JointModelItem::childChanged(Qt::CheckState stateOld, Qt::CheckState stateNew) {
-    Qt::CheckState const state = checkState();
-
-    changeCnt(-1, stateOld);
-    changeCnt(1, stateNew);
-
-    Qt::CheckState const newState = aggregatedCheckState();
-    if (state != newState) {
-        setCheckState(newState);
-    }
-}
-
-
-void JointModelItem::setParentItem(JointModelItem* pi) {
-    parentItem = pi;
-    pi->childItems.append(this);
-
-    pi->changeCnt(1, Qt::CheckState::Unchecked);
-    pi->childChanged(Qt::CheckState::Unchecked, checkState());
-}
-
-void JointModelItem::setData(const QVariant &value, int role) {
-    if (Qt::CheckStateRole == role) {
-        Qt::CheckState const oldState = checkState();
-        Qt::CheckState const newState = Qt::CheckState(qvariant_cast<int>(value));
-        QStandardItem::setData(value, role);
-
-        if (newState != oldState) {
-            if (parallelItem) parallelItem->setCheckState(newState);
-            if (parentItem) parentItem->childChanged(oldState, newState);
-            if (Qt::CheckState::Checked == newState || Qt::CheckState::Unchecked == newState) {
-                for (auto it = childItems.begin(); it != childItems.end(); ++it)
-                    (*it)->setCheckState(newState);
-            }
-        }
-    } else {
-        QStandardItem::setData(value, role);
-    }
-}
-
-JointModel::JointModel() {
-    iconComputer = ip.icon(QFileIconProvider::IconType::Computer);
-    iconFolder = ip.icon(QFileIconProvider::IconType::Folder);
-    iconDrive = ip.icon(QFileIconProvider::IconType::Drive);
-}
-
-void JointModel::setFileList(QStringList const& f) {
-    clear();
-    files = f;
-    files.sort();
-    treeItems.clear();
-
-    for (auto it = files.begin(); it != files.end(); ++it) {
-        addFile(*it);
-    }
-
-    // treeItems contains references to strings in "files"
-    treeItems.clear();
-    files.clear();
-}
-
-void JointModel::addFile(QString const& path) {
-    JointModelItem* itemL = addListItem(path);
-    JointModelItem* itemT = addTreeItem(&path, true);
-    itemL->setParallelItem(itemT);
-}
-
-JointModelItem* JointModel::addListItem(QString const& path) {
-    JointModelItem* itemL = new JointModelItem(path);
-    itemL->setCheckable(true);
-    itemL->setCheckState(Qt::Checked);
-    modelList.appendRow(itemL);
-    return itemL;
-}
-
-JointModelItem* JointModel::addTreeItem(QStringRef const& path, bool file) {
-    auto it = treeItems.find(path);
-    if (it != treeItems.end()) return it.value();
-
-    // create new item...
-    // root node/whole compoter node
-    if (path.isEmpty()) {
-        // TODO name
-        JointModelItem* item = new JointModelItem(iconComputer, "/");
-        item->setCheckable(true);
-        item->setCheckState(Qt::Checked);
-        modelTree.appendRow(item);
-        treeItems.insert(path, item);
-        return item;
-    }
-
-    // normal directories/files
-    int separatorPos = path.lastIndexOf('/');
-    QStringRef name = path.mid(separatorPos+1);
-    QStringRef parentName = path.left((separatorPos >= 0 ? separatorPos : 0));
-    JointModelItem* parentNode = addTreeItem(parentName, false);
-
-    JointModelItem* item;
-    if (file) {
-        if (iconFile.isNull()) {
-            iconFile = ip.icon(QFileInfo(path.toString()));
-        }
-        item = new JointModelItem(iconFile, name.toString());
-    } else if (parentName.isEmpty()) {
-        item = new JointModelItem(iconFolder, name.toString());
-    }
-    else {
-        item = new JointModelItem(iconFolder, name.toString());
-    }
-    item->setCheckable(true);
-    item->setCheckState(Qt::Checked);
-    parentNode->appendRow(item);
-    treeItems.insert(path, item);
-    item->setParentItem(parentNode);
-
-    return item;
+    if (0 == tree.nodeCount()) return;
+    tree.setChecked(FileTree::ROOT, Qt::Checked == state);
 }
 
 }
@@ -159,8 +159,35 @@ void GuiTimestamperProcessor::readSettings(TeraSettingsWin& sw) {
     stampBDoc = sw.cbStampBDoc->isChecked();
 }
 
+bool GuiTimestamperProcessor::addFoundFile(FoundFile const& found) {
+    int before = paths.size();
+    PathStore::FileId id = paths.add(found.path);
+    if (paths.size() == before) return false;
+
+    InFileData data;
+    data.outputSize = found.outputSize;
+    auto it = partitionIndex.find(found.partitionPath);
+    if (partitionIndex.end() == it) {
+        it = partitionIndex.insert(found.partitionPath, partitions.size());
+        partitions.append(found.partitionPath);
+    }
+    data.partition = it.value();
+    Q_ASSERT(int(id) == foundFiles.size()); // ids are handed out in order
+    foundFiles.append(data);
+    inFiles.append(id);
+    return true;
+}
+
+void GuiTimestamperProcessor::clearFiles() {
+    paths.clear();
+    foundFiles.clear();
+    partitions.clear();
+    partitionIndex.clear();
+    inFiles.clear();
+}
+
 void GuiTimestamperProcessor::initializeFilePreviewWindow(FileListWindow& fw) {
-    fw.setFileList(inFiles);
+    fw.setFileList(paths, inFiles);
 }
 
 void GuiTimestamperProcessor::copySelectedFiles(FileListWindow& fw) {
@@ -21,8 +21,10 @@
 #define GUI_TIMESTAMPER_PROCESSOR_H_
 
 #include <QObject>
+#include <QDateTime>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
 #include <QMap>
 #include <QFileInfo>
 #include <QScopedPointer>
@@ -36,6 +38,7 @@
 
 #include "config.h"
 #include "logging.h"
+#include "path_store.h"
 #include "utils.h"
 
 #include "files_window.h"
@@ -46,22 +49,32 @@ namespace ria_tera {
 class GuiTimestamperProcessor : public QObject {
     Q_OBJECT
 public:
-    class InFileData {
+    /// File found by the crawl with what the size estimate needs, filled in the crawl thread
+    class FoundFile {
     public:
-        InFileData(QString const& path) {
-            QFileInfo fi(path);
-            filesize = fi.size();
-#if QT_VERSION < QT_VERSION_CHECK(5, 4, 0)
-            partitionPath = "/";
-#else
-            QStorageInfo si(path);
-            partitionPath = si.rootPath();
-#endif
-        }
-        qint64 filesize;
+        QString path;
+        /// expected size of its container, see TeraCreateAsicsJob::estimateSize
+        qint64 outputSize = 0;
         QString partitionPath;
     };
 
+    /// Per found file, indexed by file id
+    class InFileData {
+    public:
+        qint64 outputSize = 0;
+        /// index in partitions
+        int partition = -1;
+    };
+
+    /// Space the selected files need on a partition
+    class PartitionSpace {
+    public:
+        QString rootPath;
+        qint64 needed = 0;
+        /// -1 if unknown
+        qint64 available = -1;
+    };
+
     class Result {
     public:
         enum e_ProgressStage {
@@ -72,6 +85,9 @@ public:
         int progressSuccess = 0;
         int progressFailed = 0;
         int progressUnprocessed = 0;
+        /// files left over because time server quota was used up
+        int quotaDeferred = 0;
+        QDateTime quotaDeferredUntil;
         bool success = false;
         QString error;
         /// show "Error:" before error string?
@@ -98,6 +114,10 @@ public:
     void resetGrants(QScopedPointer<QSet<QString>> &removed, QScopedPointer<QSet<QString>> &added);
 #endif
 
+    /// Adds a file found by the crawl; false if it was found before
+    bool addFoundFile(FoundFile const& found);
+    void clearFiles();
+
     void initializeFilePreviewWindow(FileListWindow& fw);
     void copySelectedFiles(FileListWindow& fw);
 
@@ -141,8 +161,12 @@ private:
 public:
     bool previewFiles;
 
-    QMap<QString, InFileData> foundFiles;
-    QStringList inFiles;
+    PathStore paths;
+    QVector<InFileData> foundFiles;
+    /// partition root paths, shared by all files on a partition
+    QStringList partitions;
+    QHash<QString, int> partitionIndex;
+    QVector<PathStore::FileId> inFiles;
 
     QScopedPointer<Result> result;
     /// raport/logfile
@@ -151,4 +175,7 @@ public:
 
 }
 
+Q_DECLARE_METATYPE(ria_tera::GuiTimestamperProcessor::FoundFile)
+Q_DECLARE_METATYPE(ria_tera::GuiTimestamperProcessor::PartitionSpace)
+
 #endif /* GUI_TIMESTAMPER_PROCESSOR_H_ */
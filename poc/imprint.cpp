@@ -0,0 +1,152 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "imprint.h"
+
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include "batch_io.h"
+#include "logging.h"
+#include "page_cache.h"
+#include "sha256_mb.h"
+
+namespace ria_tera {
+
+qint64 const Imprint::SMALL_FILE_BYTES;
+
+char const* Imprint::name(Algorithm a) {
+    switch (a) {
+    case SHA384: return "sha384";
+    case SHA512: return "sha512";
+    default: return "sha256";
+    }
+}
+
+bool Imprint::fromName(QString const& n, Algorithm& a) {
+    QString norm = n.trimmed().toLower().remove('-');
+    for (Algorithm c : {SHA256, SHA384, SHA512}) {
+        if (norm == name(c)) {
+            a = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+QStringList Imprint::names() {
+    return QStringList() << name(SHA256) << name(SHA384) << name(SHA512);
+}
+
+QCryptographicHash::Algorithm Imprint::qtAlgorithm(Algorithm a) {
+    switch (a) {
+    case SHA384: return QCryptographicHash::Sha384;
+    case SHA512: return QCryptographicHash::Sha512;
+    default: return QCryptographicHash::Sha256;
+    }
+}
+
+int Imprint::digestSize(Algorithm a) {
+    switch (a) {
+    case SHA384: return 384/8;
+    case SHA512: return 512/8;
+    default: return 256/8;
+    }
+}
+
+bool Imprint::fromDigestSize(int size, Algorithm& a) {
+    for (Algorithm c : {SHA256, SHA384, SHA512}) {
+        if (size == digestSize(c)) {
+            a = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Imprint::hashFile(QString const& path, Algorithm a, QByteArray& digest, QString& error, qint64* bytes) {
+    QCryptographicHash hashCalculator(qtAlgorithm(a));
+    qint64 total = 0;
+    bool ok = PageCache::readFile(path, [&](char const* data, qint64 len) {
+        hashCalculator.addData(data, static_cast<int>(len));
+        total += len;
+    }, error);
+    if (!ok) return false;
+    digest = hashCalculator.result();
+    if (nullptr != bytes) *bytes = total;
+    return true;
+}
+
+bool Imprint::batchesSmallFiles(Algorithm a) {
+    return SHA256 == a && Sha256MultiBuffer::lanes(Sha256MultiBuffer::best()) > 1;
+}
+
+int Imprint::smallFileBatch() {
+    return 4 * Sha256MultiBuffer::lanes(Sha256MultiBuffer::best());
+}
+
+void Imprint::hashSmallFiles(QStringList const& paths, QVector<qint64> const& sizes,
+                             QVector<QByteArray>& digests, QStringList& errors) {
+    QVector<QByteArray> contents;
+    BatchFileIo::readFiles(paths, sizes, contents, errors);
+    digests = QVector<QByteArray>(paths.size());
+    QVector<Sha256MultiBuffer::Message> msgs;
+    for (int i = 0; i < paths.size(); ++i) {
+        if (errors[i].isEmpty() && contents[i].size() != sizes[i]) {
+            // shrunk since stat, grown is caught by readFiles
+            errors[i] = QString("File '%1' changed while reading").arg(paths[i]);
+        }
+        if (!errors[i].isEmpty()) continue;
+        digests[i].resize(Sha256MultiBuffer::DIGEST_SIZE);
+        Sha256MultiBuffer::Message m;
+        m.data = reinterpret_cast<unsigned char const*>(contents[i].constData());
+        m.len = static_cast<quint64>(contents[i].size());
+        m.digest = reinterpret_cast<unsigned char*>(digests[i].data());
+        msgs.append(m);
+    }
+    Sha256MultiBuffer::hash(msgs.data(), msgs.size());
+}
+
+Imprint::Algorithm Imprint::fastest(QList<Algorithm> const& candidates, int bufferBytes) {
+    if (candidates.isEmpty()) return DEFAULT;
+    QByteArray buf(bufferBytes, 'x');
+    Algorithm best = candidates.first();
+    qint64 bestNs = -1;
+    for (Algorithm a : candidates) {
+        // best of two rounds, first one also warms up caches
+        qint64 ns = -1;
+        for (int round = 0; round < 2; ++round) {
+            QElapsedTimer t;
+            t.start();
+            QCryptographicHash::hash(buf, qtAlgorithm(a));
+            qint64 e = t.nsecsElapsed();
+            if (ns < 0 || e < ns) ns = e;
+        }
+        TERA_LOG(debug) << "Hashing " << name(a) << ": "
+                        << QString::number(bufferBytes / 1024.0 / 1024.0 * 1e9 / qMax<qint64>(ns, 1), 'f', 0) << " MB/s";
+        if (bestNs < 0 || ns < bestNs) {
+            bestNs = ns;
+            best = a;
+        }
+    }
+    return best;
+}
+
+}
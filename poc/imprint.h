@@ -0,0 +1,74 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef IMPRINT_H_
+#define IMPRINT_H_
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+namespace ria_tera {
+
+///
+/// \brief Hash algorithm of the message imprint in time-stamp requests.
+///
+/// The algorithm of a digest is known from its length, so digests can be passed
+/// around (spool, bundles, dedup cache) without carrying the algorithm separately.
+///
+class Imprint {
+public:
+    enum Algorithm {SHA256, SHA384, SHA512};
+    static Algorithm const DEFAULT = SHA256;
+
+    /// OpenSSL digest name, "sha256", "sha384" or "sha512"
+    static char const* name(Algorithm a);
+    /// Accepts OpenSSL names and "sha-256" style
+    static bool fromName(QString const& name, Algorithm& a);
+    static QStringList names();
+    static QCryptographicHash::Algorithm qtAlgorithm(Algorithm a);
+    static int digestSize(Algorithm a);
+    static bool fromDigestSize(int size, Algorithm& a);
+
+    /// bytes - if given, set to the number of bytes hashed
+    static bool hashFile(QString const& path, Algorithm a, QByteArray& digest, QString& error, qint64* bytes = nullptr);
+
+    /// Files up to that size are read whole and hashed together by hashSmallFiles
+    static qint64 const SMALL_FILE_BYTES = 256 * 1024;
+    /// hashSmallFiles beats hashFile: SHA-256 and a SIMD multi-buffer kernel
+    static bool batchesSmallFiles(Algorithm a);
+    /// Files per hashSmallFiles call, a few per lane so lanes of finished files are refilled
+    static int smallFileBatch();
+    /// SHA-256 of files expected to be sizes[i] bytes, read in one go (BatchFileIo) and hashed
+    /// in SIMD lanes. digests[i] is empty and errors[i] set for a file that couldn't be read
+    /// or has changed.
+    static void hashSmallFiles(QStringList const& paths, QVector<qint64> const& sizes,
+                               QVector<QByteArray>& digests, QStringList& errors);
+    /// Hashes a buffer in memory with each candidate and returns the fastest one.
+    /// SHA-512 wins on 64-bit CPUs without SHA extensions, SHA-256 with them.
+    static Algorithm fastest(QList<Algorithm> const& candidates, int bufferBytes = 4 * 1024 * 1024);
+};
+
+}
+
+#endif /* IMPRINT_H_ */
@@ -0,0 +1,185 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "io_scheduler.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#ifdef Q_OS_LINUX
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/sysmacros.h>
+#elif QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+#include <QStorageInfo>
+#endif
+
+#include "logging.h"
+
+namespace {
+
+QMutex limitsMutex;
+ria_tera::IoScheduler::Limits currentLimits;
+
+/// st_dev -> device type, detected once per device
+QMutex typesMutex;
+QHash<quint64, ria_tera::IoScheduler::DeviceType> types;
+
+#ifdef Q_OS_LINUX
+bool isNetworkFs(quint32 fsType) {
+    switch (fsType) {
+    case 0x6969:     // NFS
+    case 0x517B:     // SMB
+    case 0xFF534D42: // CIFS
+    case 0xFE534D42: // SMB2
+    case 0x00C36400: // Ceph
+        return true;
+    default:
+        return false;
+    }
+}
+
+ria_tera::IoScheduler::DeviceType blockDeviceType(dev_t dev) {
+    QString base = QString("/sys/dev/block/%1:%2").arg(major(dev)).arg(minor(dev));
+    // partitions have no queue of their own, the disk is one level up
+    for (QString const& q : {base + "/queue/rotational", base + "/../queue/rotational"}) {
+        QFile f(q);
+        if (f.open(QIODevice::ReadOnly)) {
+            return ("1" == f.readAll().trimmed() ? ria_tera::IoScheduler::ROTATIONAL : ria_tera::IoScheduler::SSD);
+        }
+    }
+    // tmpfs, overlay, btrfs subvolumes (anonymous st_dev)
+    return ria_tera::IoScheduler::OTHER;
+}
+#endif
+
+}
+
+namespace ria_tera {
+
+IoScheduler::Limits::Limits() : ssd(QThread::idealThreadCount()), other(qMax(2, QThread::idealThreadCount() / 2)) {}
+
+int IoScheduler::Limits::forType(DeviceType t) const {
+    switch (t) {
+    case SSD: return qMax(1, ssd);
+    case ROTATIONAL: return qMax(1, rotational);
+    case NETWORK: return qMax(1, network);
+    default: return qMax(1, other);
+    }
+}
+
+void IoScheduler::setLimits(Limits const& l) {
+    QMutexLocker lock(&limitsMutex);
+    currentLimits = l;
+}
+
+IoScheduler::Limits IoScheduler::limits() {
+    QMutexLocker lock(&limitsMutex);
+    return currentLimits;
+}
+
+char const* IoScheduler::typeName(DeviceType t) {
+    switch (t) {
+    case SSD: return "ssd";
+    case ROTATIONAL: return "rotational";
+    case NETWORK: return "network";
+    default: return "other";
+    }
+}
+
+IoScheduler::Device IoScheduler::device(QString const& path) {
+    Device d;
+#ifdef Q_OS_LINUX
+    QByteArray p = QFile::encodeName(path);
+    struct stat st;
+    if (0 != ::stat(p.constData(), &st)) {
+        p = QFile::encodeName(QFileInfo(path).absolutePath());
+        if (0 != ::stat(p.constData(), &st)) return d;
+    }
+    d.id = static_cast<quint64>(st.st_dev);
+    {
+        QMutexLocker lock(&typesMutex);
+        auto it = types.find(d.id);
+        if (types.end() != it) {
+            d.type = it.value();
+            return d;
+        }
+    }
+    struct statfs sfs;
+    if (0 == ::statfs(p.constData(), &sfs) && isNetworkFs(static_cast<quint32>(sfs.f_type))) {
+        d.type = NETWORK;
+    } else {
+        d.type = blockDeviceType(st.st_dev);
+    }
+    TERA_LOG(debug) << "Storage device " << QString("%1:%2").arg(major(st.st_dev)).arg(minor(st.st_dev))
+                    << " (" << QFileInfo(path).absolutePath() << ") is " << typeName(d.type);
+    QMutexLocker lock(&typesMutex);
+    types.insert(d.id, d.type);
+#elif QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    QFileInfo fi(path);
+    QStorageInfo si(fi.exists() ? path : fi.absolutePath());
+    if (si.isValid()) d.id = qHash(si.rootPath()) + 1;
+#else
+    Q_UNUSED(path);
+#endif
+    return d;
+}
+
+int IoScheduler::concurrency(Device const& d) {
+    return limits().forType(d.type);
+}
+
+IoScheduler::IoScheduler() = default;
+
+IoScheduler::~IoScheduler() {
+    waitForDone();
+    qDeleteAll(pools);
+}
+
+void IoScheduler::start(QRunnable* job, QString const& path) {
+    start(job, device(path));
+}
+
+void IoScheduler::start(QRunnable* job, Device const& d) {
+    QMutexLocker lock(&mutex);
+    QThreadPool*& pool = pools[d.id];
+    if (nullptr == pool) {
+        pool = new QThreadPool();
+        pool->setMaxThreadCount(concurrency(d));
+        TERA_LOG(debug) << "I/O queue for " << typeName(d.type) << " device: "
+                        << pool->maxThreadCount() << " jobs at once";
+    }
+    pool->start(job);
+}
+
+void IoScheduler::waitForDone() {
+    QList<QThreadPool*> all;
+    {
+        QMutexLocker lock(&mutex);
+        all = pools.values();
+    }
+    for (QThreadPool* pool : all) pool->waitForDone();
+}
+
+}
@@ -0,0 +1,85 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef IO_SCHEDULER_H_
+#define IO_SCHEDULER_H_
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+class QRunnable;
+class QThreadPool;
+
+namespace ria_tera {
+
+///
+/// \brief File jobs queued per storage device.
+///
+/// Every device (st_dev) gets its own queue and runs as many jobs at once as
+/// suits its kind: one at a time on a spinning disk, so it isn't seeking
+/// between files, many on SSDs, a few on network shares to hide latency.
+/// Devices work in parallel, so more disks give more throughput.
+///
+class IoScheduler {
+public:
+    enum DeviceType {SSD, ROTATIONAL, NETWORK, OTHER};
+    /// Jobs at once per device of given type
+    struct Limits {
+        Limits();
+        int forType(DeviceType t) const;
+        int ssd;
+        int rotational = 1;
+        int network = 4;
+        /// tmpfs, overlay, devices without block queue info and non-Linux systems
+        int other;
+    };
+    struct Device {
+        quint64 id = 0;
+        DeviceType type = OTHER;
+    };
+
+    /// process wide, applies to queues created afterwards
+    static void setLimits(Limits const& l);
+    static Limits limits();
+    static char const* typeName(DeviceType t);
+    /// Device path is on, a path not existing yet (output file) by its directory.
+    /// Type comes from statfs (network file systems) and /sys/dev/block/../queue/rotational.
+    static Device device(QString const& path);
+    static int concurrency(Device const& d);
+
+    IoScheduler();
+    /// waits for queued jobs
+    ~IoScheduler();
+    /// Runs job after the jobs queued before it for path's device
+    void start(QRunnable* job, QString const& path);
+    void start(QRunnable* job, Device const& d);
+    void waitForDone();
+private:
+    IoScheduler(IoScheduler const&) = delete;
+    IoScheduler& operator=(IoScheduler const&) = delete;
+
+    QMutex mutex;
+    QHash<quint64, QThreadPool*> pools;
+};
+
+}
+
+#endif /* IO_SCHEDULER_H_ */
@@ -20,11 +20,112 @@
 // TODO code-review
 #include "logging.h"
 
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <QDateTime>
 #include <QDebug>
 
+namespace {
+
+/// Line waiting to be written, routed when queued
+struct LogEntry {
+    bool toConsole = false;
+    bool toFile = false;
+    QByteArray text;
+};
+
+///
+/// Bounded multi-producer single-consumer queue (D. Vyukov): producers
+/// claim a slot with one CAS, slot sequence numbers tell the consumer when
+/// a slot is filled and producers when it is free again.
+///
+class LogRing {
+public:
+    explicit LogRing(size_t capacity) : slots(capacity), mask(capacity - 1), head(0), tail(0) {
+        for (size_t i = 0; i < capacity; ++i) slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    /// false if full
+    bool push(LogEntry& e) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot* s;
+        for (;;) {
+            s = &slots[pos & mask];
+            size_t seq = s->seq.load(std::memory_order_acquire);
+            std::ptrdiff_t dif = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+            if (0 == dif) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        s->entry = std::move(e);
+        s->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// consumer only
+    bool pop(LogEntry& e) {
+        Slot& s = slots[tail & mask];
+        if (s.seq.load(std::memory_order_acquire) != tail + 1) return false;
+        e = std::move(s.entry);
+        s.seq.store(tail + mask + 1, std::memory_order_release);
+        ++tail;
+        return true;
+    }
+
+    /// consumer only
+    bool empty() const { return slots[tail & mask].seq.load(std::memory_order_acquire) != tail + 1; }
+
+    /// position of the next line queued, lines before it are written once written() passes it
+    size_t queued() const { return head.load(); }
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        LogEntry entry;
+    };
+    std::vector<Slot> slots;
+    size_t const mask;
+    std::atomic<size_t> head;
+    size_t tail;
+};
+
+/// power of two
+size_t const LOG_RING_CAPACITY = 8192;
+
+/// "yyyy-MM-dd HH:mm:ss.zzz" of the current time, formatted once per millisecond per thread
+QByteArray const& currentTimestamp() {
+    thread_local qint64 cachedMs = -1;
+    thread_local QByteArray cached;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now != cachedMs) {
+        cachedMs = now;
+        cached = QDateTime::fromMSecsSinceEpoch(now).toString("yyyy-MM-dd HH:mm:ss.zzz").toLatin1();
+    }
+    return cached;
+}
+
+char const* levelName(ria_tera::log_level lvl) {
+    switch (lvl) {
+    case ria_tera::log_level::none: return "none";
+    case ria_tera::log_level::error: return "error";
+    case ria_tera::log_level::warn: return "warn";
+    case ria_tera::log_level::info: return "info";
+    case ria_tera::log_level::debug: return "debug";
+    case ria_tera::log_level::trace: return "trace";
+    default: return "???";
+    }
+}
+
+}
+
 namespace ria_tera {
 
 TeraLogger logger;
@@ -50,6 +151,11 @@ QString LogFile::filePath() {
     }
 }
 
+void LogFile::write(QByteArray const& utf8) {
+    logStream.flush();
+    if (logFile.data()) logFile->write(utf8);
+}
+
 void LogFile::close() {
     logStream.flush();
     if (logFile.data()) {
@@ -83,17 +189,105 @@ LogFile* LogFile::openLogFile(QDir const& dir, QString const& file_prefix, QStri
 
 //============================== TeraLogger ==============================
 
-TeraLogger::TeraLogger() : console_level(log_level::none), file_level(log_level::none) {}
+struct TeraLogger::Writer {
+    explicit Writer(LogFile* f) : ring(LOG_RING_CAPACITY), file(f), written(0) {
+        thread = std::thread([this]() { run(); });
+    }
+
+    ~Writer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+    void push(LogEntry& e) {
+        while (!ring.push(e)) {
+            // full: let the writer catch up
+            wake.notify_one();
+            std::this_thread::yield();
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            wake.notify_one();
+        }
+    }
+
+    void flush() {
+        size_t target = ring.queued();
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.notify_one();
+        while (written < target) drained.wait_for(lock, std::chrono::milliseconds(10));
+    }
+
+    void run() {
+        QByteArray toConsole;
+        QByteArray toFile;
+        LogEntry e;
+        for (;;) {
+            size_t cnt = 0;
+            while (ring.pop(e)) {
+                if (e.toConsole) toConsole += e.text;
+                if (e.toFile) toFile += e.text;
+                ++cnt;
+            }
+            if (!toConsole.isEmpty()) {
+                std::cout.write(toConsole.constData(), toConsole.size());
+                std::cout.flush();
+                toConsole.clear();
+            }
+            if (!toFile.isEmpty()) {
+                LogFile* f = file.load();
+                if (nullptr != f) f->write(toFile);
+                toFile.clear();
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            written += cnt;
+            drained.notify_all();
+            if (cnt > 0) continue;
+            if (stopping) break;
+            // producers wake us only when they see this flag
+            sleeping.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ring.empty()) wake.wait_for(lock, std::chrono::milliseconds(100));
+            sleeping.store(false);
+        }
+    }
+
+    LogRing ring;
+    std::atomic<LogFile*> file;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::atomic<bool> sleeping{false};
+    bool stopping = false;
+    /// lines written, guarded by mutex
+    size_t written;
+};
+
+TeraLogger::TeraLogger() : console_level(log_level::none), file_level(log_level::none), max_level(log_level::none) {}
 
 TeraLogger::~TeraLogger() {
+    writer.reset();
     if (!logfile.isNull()) logfile->close();
 }
 
-void TeraLogger::addConsoleLog(log_level lvl) { console_level = lvl; }
+void TeraLogger::addConsoleLog(log_level lvl) {
+    console_level = lvl;
+    updateMaxLevel();
+}
 
 bool TeraLogger::addFileLog(log_level lvl, QString dir_path) {
-    file_level = lvl;
-    if (lvl == log_level::none) return true;
+    if (lvl == log_level::none) {
+        file_level = lvl;
+        updateMaxLevel();
+        return true;
+    }
 
     QString error;
     QDir dir = QDir::current();
@@ -105,7 +299,12 @@ bool TeraLogger::addFileLog(log_level lvl, QString dir_path) {
 
     LogFile* log = LogFile::openLogFile(dir, filePrefix, fileSufix, error);
     if (log) {
+        // writer moves to the new file first, flush() then waits out writes to the old one
+        if (writer) writer->file = log;
+        flush();
         logfile.reset(log);
+        file_level = lvl;
+        updateMaxLevel();
         TeraLoggerLine(log_level::info) << QString("Opened log file '%1'").arg(log->filePath()).toUtf8().constData();
         return true;
     } else {
@@ -116,17 +315,32 @@ bool TeraLogger::addFileLog(log_level lvl, QString dir_path) {
     }
 }
 
-void TeraLogger::append(log_level lvl, char const* text, bool consoleOnly) {
-    if (NULL == text) text = "NULL";
+void TeraLogger::updateMaxLevel() {
+    int lvl = qMax(console_level.load(), file_level.load());
+    if (log_level::none != lvl) startWriter();
+    max_level = lvl;
+}
+
+void TeraLogger::startWriter() {
+    if (!writer) writer.reset(new Writer(logfile.data()));
+}
 
-    if (console_level != log_level::none && lvl <= console_level) {
-        std::cout << text;
+void TeraLogger::append(log_level lvl, QByteArray const& line, bool consoleOnly) {
+    LogEntry e;
+    e.toConsole = (console_level != log_level::none && lvl <= console_level);
+    e.toFile = (!consoleOnly && !logfile.isNull() && file_level != log_level::none && lvl <= file_level);
+    if (!e.toConsole && !e.toFile) return;
+    e.text = line;
+    if (writer) {
+        writer->push(e);
+    } else {
+        // error before logging is set up
+        std::cout.write(line.constData(), line.size());
     }
+}
 
-    if (!consoleOnly && !logfile.isNull() && file_level != log_level::none && lvl <= file_level) {
-        logfile->getStream() << text;
-        logfile->getStream().flush();
-    }
+void TeraLogger::flush() {
+    if (writer) writer->flush();
 }
 
 //============================== TeraLoggerLine ==============================
@@ -134,20 +348,13 @@ void TeraLogger::append(log_level lvl, char const* text, bool consoleOnly) {
 TeraLoggerLine::TeraLoggerLine(log_level lvl) : consoleOnly(false), level(lvl) {}
 
 TeraLoggerLine::~TeraLoggerLine() {
-    QString datetime = QDateTime::currentDateTime().toString("yyyy-MM-dd HH:mm:ss.zzz");
-    QString levelStr;
-    switch (level) {
-    case log_level::none: levelStr = "none"; break;
-    case log_level::error: levelStr = "error"; break;
-    case log_level::warn: levelStr = "warn"; break;
-    case log_level::info: levelStr = "info"; break;
-    case log_level::debug: levelStr = "debug"; break;
-    case log_level::trace: levelStr = "trace"; break;
-    default: levelStr = "???";
-    }
+    QByteArray const& datetime = currentTimestamp();
+    char const* levelStr = levelName(level);
 
-    QString logLine = QString("[%1] (%2) : %3\n").arg(datetime, levelStr, message);
-    logger.append(level, logLine.toUtf8().constData());
+    QByteArray logLine;
+    logLine.reserve(datetime.size() + message.size() + 20);
+    logLine.append('[').append(datetime).append("] (").append(levelStr).append(") : ").append(message).append('\n');
+    logger.append(level, logLine, consoleOnly);
 }
 
 void TeraLoggerLine::append(char const* text) { message += text; }
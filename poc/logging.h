@@ -21,12 +21,17 @@
 #ifndef LOGGING_H_
 #define LOGGING_H_
 
+#include <atomic>
+
 #include <QDir>
 #include <QFile>
 #include <QTextStream>
 
 // info trace error
-#define TERA_LOG(level) ria_tera::TeraLoggerLine(ria_tera::log_level:: level)
+// Arguments after << are not evaluated when the level is off.
+#define TERA_LOG(level) \
+    if (!ria_tera::logger.enabled(ria_tera::log_level:: level)) {} \
+    else ria_tera::TeraLoggerLine(ria_tera::log_level:: level)
 
 #define TERA_COUT(xxx) {TERA_LOG(info) << xxx;};
 
@@ -44,6 +49,8 @@ public:
     virtual ~LogFile();
     QString filePath();
     QTextStream& getStream() { return logStream; };
+    /// Writes UTF-8 text as is, after what is buffered in the stream
+    void write(QByteArray const& utf8);
     void close();
 
     static LogFile* openLogFile(QDir const& dir, QString const& file_prefix, QString const& file_sufix, QString& error);
@@ -52,17 +59,30 @@ private:
     QTextStream logStream;
 };
 
+///
+/// Lines are queued in a lock-free ring buffer and written to console and
+/// file by a background thread in batches, so logging threads don't wait
+/// for I/O. flush() waits until everything queued so far is written.
+///
 class TeraLogger {
 public:
     TeraLogger();
     ~TeraLogger();
     void addConsoleLog(log_level lvl);
     bool addFileLog(log_level lvl, QString dir_path = QString());
-    void append(log_level lvl, char const* text, bool consoleOnly = false);
+    bool enabled(log_level lvl) const { return lvl <= max_level.load(std::memory_order_relaxed); };
+    void append(log_level lvl, QByteArray const& line, bool consoleOnly = false);
+    void flush();
 private:
-    log_level console_level;
-    log_level file_level;
+    struct Writer;
+    void startWriter();
+    void updateMaxLevel();
+
+    std::atomic<int> console_level;
+    std::atomic<int> file_level;
+    std::atomic<int> max_level;
     QScopedPointer<LogFile> logfile;
+    QScopedPointer<Writer> writer;
 };
 
 class TeraLoggerLine {
@@ -78,7 +98,7 @@ public:
 private:
     bool consoleOnly;
     log_level level;
-    QString message;
+    QByteArray message;
 };
 
 extern TeraLogger logger;
@@ -37,6 +37,7 @@
 
 #include "common/AboutDialog.h"
 #include "disk_crawler.h"
+#include "mount_table.h"
 #include "settings_window.h"
 #include "common/Configuration.h"
 
@@ -151,6 +152,11 @@ TeraMainWin::TeraMainWin(QWidget *parent) :
 
     timestapmping = false;
 
+    qRegisterMetaType<QVector<GuiTimestamperProcessor::FoundFile>>();
+    qRegisterMetaType<QVector<GuiTimestamperProcessor::PartitionSpace>>();
+    progressTimer.setSingleShot(true);
+    connect(&progressTimer, &QTimer::timeout, this, &TeraMainWin::showProgress);
+
     ///
     connect(&Configuration::instance(), SIGNAL(finished(bool, const QString&)), this, SLOT(globalConfFinished(bool, const QString&)), Qt::QueuedConnection);
     connect(&Configuration::instance(), SIGNAL(networkError(const QString&)), this, SLOT(globalConfNetworkError(const QString&)));
@@ -168,7 +174,9 @@ gui(mainWindow), jobId(jobid), dc(*this, extensions)
 }
 
 void CrawlDiskJob::run() {
+    notified.start();
     dc.crawl();
+    notify(true);
     emit signalFindingFilesDone(jobId);
 }
 
@@ -178,7 +186,9 @@ bool CrawlDiskJob::isCanceled() {
 
 bool CrawlDiskJob::processingPath(QString const& path, double progress_percent) {
     if (isCanceled()) return false;
-    emit signalProcessingPath(jobId, path, progress_percent);
+    pendingPath = path;
+    pendingProgress = progress_percent;
+    notify(false);
     return true;
 }
 
@@ -190,16 +200,65 @@ bool CrawlDiskJob::excludingPath(QString const& path) {
 
 bool CrawlDiskJob::foundFile(QString const& path) {
     if (isCanceled()) return false;
-    emit signalFoundFile(jobId, path);
+    GuiTimestamperProcessor::FoundFile f;
+    f.path = path;
+    qint64 size = 0;
+    if (!MountTable::inspect(path, size, f.partitionPath)) {
+        // gone or unreadable since crawler listed it, stamping would only fail
+        TERA_LOG(warn) << "Skipping " << path << ", can't read file information";
+        return true;
+    }
+    f.outputSize = TeraCreateAsicsJob::estimateSize(path, size);
+    found.append(f);
+    notify(false);
     return true;
 }
 
+void CrawlDiskJob::notify(bool force) {
+    if (!force && notified.elapsed() < PROGRESS_INTERVAL_MS) return;
+    if (!pendingPath.isNull()) {
+        emit signalProcessingPath(jobId, pendingPath, pendingProgress);
+        pendingPath.clear();
+    }
+    if (!found.isEmpty()) {
+        emit signalFoundFiles(jobId, found);
+        found.clear();
+    }
+    notified.restart();
+}
+
+
+SizeEstimateJob::SizeEstimateJob(int jobid, GuiTimestamperProcessor const& processor) :
+jobId(jobid), files(processor.inFiles), data(processor.foundFiles), partitions(processor.partitions)
+{
+}
+
+void SizeEstimateJob::run() {
+    QVector<GuiTimestamperProcessor::PartitionSpace> space(partitions.size());
+    for (PathStore::FileId id : files) {
+        auto const& d(data.at(static_cast<int>(id)));
+        if (d.partition >= 0) space[d.partition].needed += d.outputSize;
+    }
+    for (int p = 0; p < space.size(); ++p) {
+        space[p].rootPath = partitions.at(p);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+        if (space.at(p).needed > 0) space[p].available = QStorageInfo(partitions.at(p)).bytesAvailable();
+#endif
+    }
+    emit signalSizeEstimateDone(jobId, space);
+}
 
 void TeraMainWin::handleStartStamping() {
     QString url = processor.timeServerUrl.trimmed();
     bool useIDCardAuthentication = idCardAuth.useIDAuth(url);
 
-    stamper.getTimestamper().setTimeserverUrl(url, (useIDCardAuthentication ? &idCardAuth : nullptr));
+    stamper.getTimestamper().setTimeserverUrl(url, (useIDCardAuthentication ? idCardAuth.forUrl(url) : nullptr));
+    for (QString extra : processor.config.getTimeServerURLs()) {
+        bool extraIDAuth = idCardAuth.useIDAuth(extra);
+        if (extra == url) continue;
+        stamper.getTimestamper().addTimeserverUrl(extra, (extraIDAuth ? idCardAuth.forUrl(extra) : nullptr));
+        useIDCardAuthentication = useIDCardAuthentication || extraIDAuth;
+    }
 
     if (!checkSettingsWithGUI()) {
         return;
@@ -305,8 +364,7 @@ void TeraMainWin::doTestStamp() {
 
     //
     cancel = false;
-    processor.foundFiles.clear();
-    processor.inFiles.clear();
+    processor.clearFiles();
     timestapmping = true;
 
     // create log file
@@ -323,13 +381,26 @@ void TeraMainWin::doTestStamp() {
     progressBar->setValue(0);
     fillProgressBar();
 
-    QByteArray pseudosha256(256/8, '\0');
-    QByteArray req = stamper.getTimestamper().getTimestampRequest4Sha256(pseudosha256);
+    sendTestRequest();
+}
+
+void TeraMainWin::sendTestRequest() {
+    QByteArray pseudoDigest(Imprint::digestSize(processor.config.getImprintAlgorithm()), '\0');
+    QByteArray req = stamper.getTimestamper().getTimestampRequest4Sha256(pseudoDigest);
 
-    stamper.getTimestamper().sendTSRequest(req, true); // TODO api is rubbish
+    stamper.getTimestamper().sendTestRequest(req);
 }
 
 void TeraMainWin::timestampingTestFinished(bool success, const QByteArray &resp, const QString &errString) {
+    if (processor.config.needsImprintCheck()) {
+        // "auto" picked an algorithm the server may not take, ask again with SHA-256 if it didn't
+        processor.config.confirmImprint(success);
+        if (!success && !isCancelled()) {
+            TERA_LOG(warn) << errString;
+            sendTestRequest();
+            return;
+        }
+    }
     if (!success) {
         timestampingFinished(BatchStamper::FinishingDetails::error(errString));
         return;
@@ -342,8 +413,7 @@ void TeraMainWin::timestampingTestFinished(bool success, const QByteArray &resp,
 
     progressBar->setValue(PP_TS_TEST);
     processor.result->progressStage = GuiTimestamperProcessor::Result::SEARCHING_FILES;
-    processor.foundFiles.clear();
-    processor.inFiles.clear();
+    processor.clearFiles();
     fillProgressBar();
 
     int newJobId = jobId.fetchAndAddOrdered(1)+1;
@@ -359,8 +429,7 @@ void TeraMainWin::timestampingTestFinished(bool success, const QByteArray &resp,
         this, SLOT(processProcessingPath(int, QString, double)));
     connect(crawlJob, SIGNAL(signalExcludingPath(int, QString)),
         this, SLOT(processExcludingPath(int, QString)));
-    connect(crawlJob, SIGNAL(signalFoundFile(int, QString)),
-        this, SLOT(processFoundFile(int, QString)));
+    connect(crawlJob, &CrawlDiskJob::signalFoundFiles, this, &TeraMainWin::processFoundFiles);
     connect(crawlJob, SIGNAL(signalFindingFilesDone(int)),
         this, SLOT(processFindingFilesDone(int)));
 
@@ -377,18 +446,18 @@ void TeraMainWin::processProcessingPath(int jobid, QString path, double progress
 void TeraMainWin::processExcludingPath(int jobid, QString path) {
 }
 
-void TeraMainWin::processFoundFile(int jobid, QString path) {
+void TeraMainWin::processFoundFiles(int jobid, QVector<GuiTimestamperProcessor::FoundFile> files) {
     if (isCancelled(jobid)) return;
-    if (!processor.foundFiles.contains(path)) {
-        GuiTimestamperProcessor::InFileData ifd(path);
-        processor.foundFiles.insert(path, ifd);
-        processor.inFiles.append(path);
-    }
-    fillProgressBar();
-
-    if (processor.logfile) {
-        processor.logfile->getStream() << "Found " << path << endl;
+    bool logged = false;
+    for (GuiTimestamperProcessor::FoundFile const& f : files) {
+        if (processor.addFoundFile(f) && processor.logfile) {
+            processor.logfile->getStream() << "Found " << f.path << '\n';
+            logged = true;
+        }
     }
+    // one flush per batch, not per file
+    if (logged) processor.logfile->getStream().flush();
+    scheduleProgress();
 }
 
 void TeraMainWin::processFindingFilesDone(int jobid) {
@@ -408,6 +477,12 @@ void TeraMainWin::doFindingFilesDone() {
     processor.result->cntFound = processor.inFiles.size();
     fillProgressBar();
 
+    if (processor.logfile && !processor.paths.isEmpty()) {
+        qint64 bytes = processor.paths.memoryBytes();
+        processor.logfile->getStream() << "Path store: " << processor.paths.size() << " files, "
+            << bytes << " bytes (" << bytes / processor.paths.size() << " bytes per file)" << endl;
+    }
+
     if (processor.inFiles.size() > 0 && processor.previewFiles) {
         processor.initializeFilePreviewWindow(*filesWin);
         filesWin->open();
@@ -418,54 +493,59 @@ void TeraMainWin::doFindingFilesDone() {
 
 void TeraMainWin::startStampingFiles() {
     // TODO comment what callbacks follow in this process
-    // TODO separate thread for size estimates
-    {
-        QMap<QString,qint64> filesizesPerPartitition;
-        for (int i = 0; i < processor.inFiles.size(); ++i) {
-            QString filePath = processor.inFiles.at(i);
-            auto it = processor.foundFiles.find(filePath);
-            if (processor.foundFiles.end() != it) {
-                auto& data(it.value());
-                auto& filesizeOnPart(filesizesPerPartitition[data.partitionPath]);
-                filesizeOnPart += data.filesize;
-            }
-        }
+    // free space check in a worker, then processSizeEstimateDone -> doStartStamping
+    int newJobId = jobId.fetchAndAddOrdered(1)+1;
+    SizeEstimateJob* sizeJob = new SizeEstimateJob(newJobId, processor);
+    connect(sizeJob, &SizeEstimateJob::signalSizeEstimateDone, this, &TeraMainWin::processSizeEstimateDone);
+    QThreadPool::globalInstance()->start(sizeJob);
+}
 
-        bool spaceIssue = false;
-        QString sizeInfo;
-#if QT_VERSION < QT_VERSION_CHECK(5, 4, 0)
-#else
-        for (auto it = filesizesPerPartitition.begin(); it != filesizesPerPartitition.end(); ++it) {
-            QString partition = it.key();
-            qint64 filesTotalSize = it.value();
-            qint64 partitionAvailableSize = QStorageInfo(partition).bytesAvailable();
-            if (-1 == partitionAvailableSize) {
-                // Ignoring UNC path issue or any
-            } else if (filesTotalSize > partitionAvailableSize) {
-                spaceIssue = true;
-                sizeInfo = QString(tr("* %1: free space %2, space needed %3 (approximately)")).
-                    arg(hrPath(partition), hrSize(partitionAvailableSize), hrSize(filesTotalSize)) + "\n";
-            }
+void TeraMainWin::processSizeEstimateDone(int jobid, QVector<GuiTimestamperProcessor::PartitionSpace> space) {
+    if (isCancelled(jobid)) return;
+
+    bool spaceIssue = false;
+    QString sizeInfo;
+    for (GuiTimestamperProcessor::PartitionSpace const& p : space) {
+        if (-1 == p.available) {
+            // Ignoring UNC path issue or any
+        } else if (p.needed > p.available) {
+            spaceIssue = true;
+            sizeInfo += QString(tr("* %1: free space %2, space needed %3 (approximately)")).
+                arg(hrPath(p.rootPath), hrSize(p.available), hrSize(p.needed)) + "\n";
         }
-#endif
+    }
 
-        if (spaceIssue) {
-            QString errorMsg =
-                tr("The space needed to timestamp all the DDOC files found exceeds the amount of free space found:\n\n") +
-                sizeInfo;
-            QString message = errorMsg + "\n\n" + tr("Abort timestamping?");
+    if (spaceIssue) {
+        QString errorMsg =
+            tr("The space needed to timestamp all the DDOC files found exceeds the amount of free space found:\n\n") +
+            sizeInfo;
+        QString message = errorMsg + "\n\n" + tr("Abort timestamping?");
 
-            QMessageBox::StandardButtons button = QMessageBox::warning(this, this->windowTitle(), message, QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes);
-            if (QMessageBox::Yes == button) {
-                doUserCancel(errorMsg);
-                return;
-            }
-            // Continue timestamping with a space issue
+        QMessageBox::StandardButtons button = QMessageBox::warning(this, this->windowTitle(), message, QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes);
+        if (QMessageBox::Yes == button) {
+            doUserCancel(errorMsg);
+            return;
         }
+        // Continue timestamping with a space issue
     }
+    doStartStamping();
+}
 
+void TeraMainWin::doStartStamping() {
     nameGen.setOutExt(processor.outExt); // TODO threading issues?
-    stamper.startTimestamping(processor.timeServerUrl, processor.inFiles); // TODO url not neccessary
+    stamper.getConcurrency().setParameters(processor.config.getTsaConcurrencyParameters());
+    stamper.getBreaker().setParameters(processor.config.getTsaBreakerParameters());
+    stamper.getTimestamper().setRequestTimeout(processor.config.getTimeServerTimeout());
+    stamper.getTimestamper().setImprintAlgorithm(processor.config.getImprintAlgorithm());
+    PageCache::setMode(processor.config.getPageCacheMode());
+    IoScheduler::setLimits(processor.config.getIoLimits());
+    TsaEndpointPool const& pool = stamper.getTimestamper().getEndpoints();
+    for (int i = 0; i < pool.size(); ++i) {
+        stamper.setQuotaLimits(pool.at(i).url, processor.config.getTsaQuotaLimits(pool.at(i).url));
+    }
+    QVector<PathStore::FileId> files = processor.inFiles;
+    PhysicalOrder::sort(processor.paths, files, processor.config.getPhysicalOrder());
+    stamper.startTimestamping(processor.paths, files);
 }
 
 bool TeraMainWin::processingFile(QString const& pathIn, QString const& pathOut, int nr, int totalCnt) {
@@ -498,9 +578,7 @@ bool TeraMainWin::processingFileDone(QString const& pathIn, QString const& pathO
     else processor.result->progressFailed++;
     processor.result->progressUnprocessed = totalCnt - processor.result->progressConverted;
 
-    progressBar->setValue(PP_TS_TEST + PP_SEARCH + (int)(1.0*PP_TS*(nr+1) / totalCnt));
-    progressBar->setFormat("");
-    fillProgressBar();
+    scheduleProgress();
     return true;
 }
 
@@ -570,6 +648,11 @@ void TeraMainWin::timestampingFinished(BatchStamper::FinishingDetails details) {
             }
             logText->clear();
         }
+        if (!details.deferred.isEmpty()) {
+            processor.result->quotaDeferred = details.deferred.size();
+            processor.result->quotaDeferredUntil = details.deferredUntil;
+            processor.result->progressUnprocessed = details.deferred.size();
+        }
     }
     fillProgressBar();
     fillDoneLog();
@@ -577,6 +660,9 @@ void TeraMainWin::timestampingFinished(BatchStamper::FinishingDetails details) {
     if (processor.logfile) {
         if (details.success) {
             if (0 == processor.inFiles.size()) processor.logfile->getStream() << "No *.(" << selectedExtensions.join(", ") << ") files selected for timestamping." << endl;
+            for (QString const& f : details.deferred) {
+                processor.logfile->getStream() << "DEFERRED (time server quota used up) " << f << endl;
+            }
         } else {
             if (details.userCancelled) {
                 processor.logfile->getStream() << "Operation cancelled by user" << endl;
@@ -588,7 +674,7 @@ void TeraMainWin::timestampingFinished(BatchStamper::FinishingDetails details) {
         processor.logfile->close();
     }
 
-    processor.inFiles.clear();
+    processor.clearFiles();
     timestapmping = false;
     if (cancel.load()) setPage(PAGE::START);
     else setPage(PAGE::READY);
@@ -637,6 +723,28 @@ void TeraMainWin::fillProgressBar() {
     }
 }
 
+void TeraMainWin::scheduleProgress() {
+    if (!progressShown.isValid() || progressShown.elapsed() >= PROGRESS_INTERVAL_MS) {
+        showProgress();
+    } else if (!progressTimer.isActive()) {
+        progressTimer.start(PROGRESS_INTERVAL_MS - int(progressShown.elapsed()));
+    }
+}
+
+void TeraMainWin::showProgress() {
+    progressTimer.stop();
+    progressShown.start();
+    if (!processor.result) return;
+
+    GuiTimestamperProcessor::Result const& r = *processor.result;
+    int total = r.progressConverted + r.progressUnprocessed;
+    if (GuiTimestamperProcessor::Result::CONVERTING_FILES == r.progressStage && total > 0) {
+        progressBar->setValue(PP_TS_TEST + PP_SEARCH + (int)(1.0*PP_TS*r.progressConverted / total));
+        progressBar->setFormat("");
+    }
+    fillProgressBar();
+}
+
 void TeraMainWin::fillDoneLog() {
     logText->clear();
     if (!processor.result) return;
@@ -667,6 +775,13 @@ void TeraMainWin::fillDoneLog() {
         if (processor.result->progressUnprocessed > 0) {
             logText->append(tr("Files left unprocessed: %1").arg(QString::number(processor.result->progressUnprocessed)));
         }
+        if (processor.result->quotaDeferred > 0) {
+            QString msg = tr("Time server quota is used up, %1 files were not sent").arg(QString::number(processor.result->quotaDeferred));
+            if (processor.result->quotaDeferredUntil.isValid()) {
+                msg += tr(" (quota allows to continue approx. by %1)").arg(processor.result->quotaDeferredUntil.toString(Qt::DefaultLocaleShortDate));
+            }
+            logText->append(msg);
+        }
     }
 
     if (processor.logfile) {
@@ -830,23 +945,19 @@ void TeraMainWin::processEvents() {
 
 void TeraMainWin::handleFilesAccepted() {
     // remember old list
-    QSet<QString> oldList;
-    QStringList l = processor.inFiles;
-    for (int i = 0; i < l.size(); ++i)
-        oldList.insert(l.at(i));
-    l.clear();
+    QVector<PathStore::FileId> oldList = processor.inFiles;
 
     // update selected files list
     processor.copySelectedFiles(*filesWin);
 
-    // remove selected ones to get to know which ones were excluded
-    l = processor.inFiles;
-    for (int i = 0; i < l.size(); ++i)
-        oldList.remove(l.at(i));
-
     // log all de-selected files
     if (processor.logfile) {
-        QList<QString> list = oldList.toList();
+        QVector<bool> selected(processor.paths.size(), false);
+        for (PathStore::FileId id : processor.inFiles)
+            selected[static_cast<int>(id)] = true;
+        QStringList list;
+        for (PathStore::FileId id : oldList)
+            if (!selected.at(static_cast<int>(id))) list.append(processor.paths.path(id));
         qSort(list);
         for (int i = 0; i < list.size(); ++i) {
             processor.logfile->getStream() << "User de-selected: " << list.at(i) << endl;
@@ -23,8 +23,10 @@
 #include <QAction>
 #include <QAtomicInt>
 #include <QAtomicPointer>
+#include <QElapsedTimer>
 #include <QFileSystemModel>
 #include <QRunnable>
+#include <QTimer>
 #include <QTranslator>
 #include <QWidget>
 
@@ -46,6 +48,14 @@ namespace ria_tera {
 
 class TeraMainWin;
 
+/// GUI gets crawl and time-stamping progress at most this often
+static int const PROGRESS_INTERVAL_MS = 33;
+
+///
+/// Crawls in a worker thread. Found files are stat'ed here and handed to
+/// the GUI in batches, together with the latest processed path, at most
+/// every PROGRESS_INTERVAL_MS.
+///
 class CrawlDiskJob : public QObject, public QRunnable, public DiscCrawlMonitorCallback
 {
     Q_OBJECT
@@ -60,14 +70,38 @@ public:
 signals:
     void signalProcessingPath(int jobid, QString path, double progress_percent);
     void signalExcludingPath(int jobid, QString path);
-    void signalFoundFile(int jobid, QString path);
+    void signalFoundFiles(int jobid, QVector<GuiTimestamperProcessor::FoundFile> files);
     void signalFindingFilesDone(int jobid);
 private:
     bool isCanceled();
+    void notify(bool force);
 
     TeraMainWin& gui;
     int jobId;
     DiskCrawler dc;
+
+    QElapsedTimer notified;
+    QVector<GuiTimestamperProcessor::FoundFile> found;
+    QString pendingPath;
+    double pendingProgress = 0;
+};
+
+/// Sums expected container sizes of the selected files per partition and
+/// looks up free space, in a worker thread
+class SizeEstimateJob : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    SizeEstimateJob(int jobid, GuiTimestamperProcessor const& processor);
+    virtual void run();
+signals:
+    void signalSizeEstimateDone(int jobid, QVector<GuiTimestamperProcessor::PartitionSpace> space);
+private:
+    int jobId;
+    QVector<PathStore::FileId> files;
+    QVector<GuiTimestamperProcessor::InFileData> data;
+    QStringList partitions;
 };
 
 class TeraMainWin : public QWidget, public Ui::MainWindow, public StampingMonitorCallback
@@ -94,11 +128,12 @@ public slots:
 
     void processProcessingPath(int jobid, QString path, double progress_percent);
     void processExcludingPath(int jobid, QString path); // TODO delete
-    void processFoundFile(int jobid, QString path);
+    void processFoundFiles(int jobid, QVector<GuiTimestamperProcessor::FoundFile> files);
     void processFindingFilesDone(int jobid);
 
     void doFindingFilesDone();
     void startStampingFiles(); // TODO better name
+    void processSizeEstimateDone(int jobid, QVector<GuiTimestamperProcessor::PartitionSpace> space);
 private:
     bool processingFile(QString const& pathIn, QString const& pathOut, int nr, int totalCnt);
     bool processingFileDone(QString const& pathIn, QString const& pathOut, int nr, int totalCnt, bool success, QString const& errString);
@@ -134,12 +169,19 @@ protected:
     bool checkSettingsWithGUI();
     void fillProgressBar();
     void fillDoneLog();
+    /// Progress shown now or by progressTimer, at most every PROGRESS_INTERVAL_MS
+    void scheduleProgress();
+    /// Test request hashed with the configured imprint algorithm, answered by timestampingTestFinished
+    void sendTestRequest();
+private slots:
+    void showProgress();
 private:
     enum PAGE {START, PROCESS, READY, INTRO};
     void resetLogFormat();
     void setPage(PAGE p);
     void setBackgroundImg(QString path);
     void doUserCancel(QString msg = QString());
+    void doStartStamping();
     void loadTranslation(QString const& language_short);
 #ifdef Q_OS_OSX
     bool grantPermissions(QSet<QString> const& deniedDirs);
@@ -170,6 +212,9 @@ private:
     QString backgroundImg;
 
     QStringList selectedExtensions;
+
+    QTimer progressTimer;
+    QElapsedTimer progressShown;
 };
 
 }
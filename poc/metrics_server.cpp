@@ -0,0 +1,199 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "metrics_server.h"
+
+#include <QDir>
+#include <QFile>
+#include <QHostAddress>
+#include <QLocalSocket>
+#include <QTcpSocket>
+
+#include "stage_metrics.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+/// request line and headers, anything longer is not a scrape
+int const MAX_REQUEST_BYTES = 8 * 1024;
+
+class MetricsText {
+public:
+    void counter(char const* name, char const* help, qint64 value) {
+        head(name, help, "counter");
+        line(name, QByteArray::number(value));
+    }
+    void gauge(char const* name, char const* help, double value) {
+        head(name, help, "gauge");
+        line(name, QByteArray::number(value, 'g', 10));
+    }
+    void queues(ria_tera::StageMetrics const& m) {
+        head("tera_queue_depth", "Requests waiting in or being processed by a pipeline stage", "gauge");
+        line("tera_queue_depth{stage=\"hash\"}", QByteArray::number(m.hashQueue.loadAcquire()));
+        line("tera_queue_depth{stage=\"tsa\"}", QByteArray::number(m.tsaInFlight.loadAcquire()));
+        line("tera_queue_depth{stage=\"retry\"}", QByteArray::number(m.retryQueue.loadAcquire()));
+        line("tera_queue_depth{stage=\"write\"}", QByteArray::number(m.writeQueue.loadAcquire()));
+    }
+    void summary(char const* name, char const* help, ria_tera::LatencyHistogram const& h) {
+        head(name, help, "summary");
+        QByteArray n(name);
+        for (double q : {0.5, 0.9, 0.99}) {
+            line(n + "{quantile=\"" + QByteArray::number(q) + "\"}", QByteArray::number(h.percentile(q * 100) / 1e6, 'g', 6));
+        }
+        line(n + "_sum", QByteArray::number(h.mean() * h.count() / 1e6, 'g', 10));
+        line(n + "_count", QByteArray::number(h.count()));
+    }
+    QByteArray text;
+private:
+    void head(char const* name, char const* help, char const* type) {
+        text.append("# HELP ").append(name).append(' ').append(help).append('\n');
+        text.append("# TYPE ").append(name).append(' ').append(type).append('\n');
+    }
+    void line(QByteArray const& name, QByteArray const& value) {
+        text.append(name).append(' ').append(value).append('\n');
+    }
+};
+
+/// Socket file left over by a run that crashed: a socket nobody accepts on
+bool isStaleSocket(QString const& name) {
+#ifdef Q_OS_UNIX
+    // same resolution as QLocalServer
+    QString path = (name.startsWith('/') ? name : QDir::tempPath() + '/' + name);
+    struct stat st;
+    if (0 != lstat(QFile::encodeName(path).constData(), &st) || !S_ISSOCK(st.st_mode)) return false;
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    return !probe.waitForConnected(200);
+#else
+    Q_UNUSED(name);
+    return false;
+#endif
+}
+
+}
+
+namespace ria_tera {
+
+MetricsServer::MetricsServer() {
+    thread.setObjectName("metrics");
+}
+
+MetricsServer::~MetricsServer() {
+    thread.quit();
+    thread.wait();
+}
+
+bool MetricsServer::listen(QString const& address, QString& error) {
+    uptime.start();
+    QHostAddress host(QHostAddress::LocalHost);
+    QString port = address;
+    if (address.contains(':')) {
+        QString name = address.section(':', 0, -2);
+        host = ("localhost" == name ? QHostAddress(QHostAddress::LocalHost) : QHostAddress(name));
+        port = address.section(':', -1);
+    }
+    bool isPort = false;
+    quint16 portNr = port.toUShort(&isPort);
+    if (isPort && !host.isNull()) {
+        tcp.reset(new QTcpServer());
+        if (!tcp->listen(host, portNr)) {
+            error = QString("Can't listen on %1 for metrics: %2").arg(address, tcp->errorString());
+            tcp.reset();
+            return false;
+        }
+        QObject::connect(tcp.data(), &QTcpServer::newConnection, tcp.data(), [this]{
+            while (QTcpSocket* s = tcp->nextPendingConnection()) serve(s);
+        });
+        tcp->moveToThread(&thread);
+    } else {
+        local.reset(new QLocalServer());
+        if (isStaleSocket(address)) QLocalServer::removeServer(address);
+        if (!local->listen(address)) {
+            error = QString("Can't listen on %1 for metrics: %2").arg(address, local->errorString());
+            local.reset();
+            return false;
+        }
+        QObject::connect(local.data(), &QLocalServer::newConnection, local.data(), [this]{
+            while (QLocalSocket* s = local->nextPendingConnection()) serve(s);
+        });
+        local->moveToThread(&thread);
+    }
+    thread.start();
+    return true;
+}
+
+void MetricsServer::serve(QIODevice* socket) {
+    QObject::connect(socket, &QIODevice::readyRead, socket, [this, socket]{
+        // answered when headers end, the request itself doesn't matter
+        if (socket->bytesAvailable() > MAX_REQUEST_BYTES) {
+            socket->close();
+            socket->deleteLater();
+            return;
+        }
+        if (!socket->peek(MAX_REQUEST_BYTES).contains("\r\n\r\n")) return;
+        socket->readAll();
+        QByteArray body = render(uptime.elapsed());
+        socket->write("HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\nContent-Length: ");
+        socket->write(QByteArray::number(body.size()) + "\r\n\r\n");
+        socket->write(body);
+        if (QTcpSocket* s = qobject_cast<QTcpSocket*>(socket)) s->disconnectFromHost();
+        if (QLocalSocket* s = qobject_cast<QLocalSocket*>(socket)) s->disconnectFromServer();
+    });
+    if (QTcpSocket* s = qobject_cast<QTcpSocket*>(socket)) {
+        QObject::connect(s, &QTcpSocket::disconnected, s, &QObject::deleteLater);
+    }
+    if (QLocalSocket* s = qobject_cast<QLocalSocket*>(socket)) {
+        QObject::connect(s, &QLocalSocket::disconnected, s, &QObject::deleteLater);
+    }
+}
+
+QByteArray MetricsServer::render(qint64 uptimeMs) {
+    StageMetrics const& m = stageMetrics;
+    MetricsText t;
+    qint64 done = m.filesStamped.loadAcquire() + m.filesFailed.loadAcquire();
+    qint64 total = m.filesTotal.loadAcquire();
+    double seconds = qMax<qint64>(uptimeMs, 1) / 1000.0;
+    double rate = done / seconds;
+
+    t.counter("tera_files_found_total", "Files found by the file search", m.filesFound.loadAcquire());
+    t.gauge("tera_files", "Files to time-stamp in this run", total);
+    t.counter("tera_files_hashed_total", "Input files hashed", m.hashUs.count());
+    t.counter("tera_files_stamped_total", "Files time-stamped", m.filesStamped.loadAcquire());
+    t.counter("tera_files_failed_total", "Files that failed", m.filesFailed.loadAcquire());
+    t.counter("tera_hashed_bytes_total", "Bytes of input files hashed", m.hashedBytes.loadAcquire());
+    t.counter("tera_written_bytes_total", "Bytes stored in containers written, before compression", m.writtenBytes.loadAcquire());
+    t.counter("tera_tsa_requests_total", "Requests sent to time servers", m.tsaRequests.loadAcquire());
+    t.counter("tera_tsa_retries_total", "Requests resent to time servers", m.retries.loadAcquire());
+    t.counter("tera_tsa_errors_total", "Time server answers without a time-stamp, timeouts included", m.tsaErrors.loadAcquire());
+    t.queues(m);
+    t.gauge("tera_files_per_second", "Files finished per second since start", rate);
+    t.gauge("tera_hashed_bytes_per_second", "Bytes hashed per second since start", m.hashedBytes.loadAcquire() / seconds);
+    t.gauge("tera_eta_seconds", "Estimated time until all files are finished, -1 if unknown",
+            (done > 0 && total >= done) ? (total - done) / rate : -1.0);
+    t.gauge("tera_uptime_seconds", "Seconds since metrics were enabled", seconds);
+    t.summary("tera_hash_seconds", "Time to hash an input file", m.hashUs);
+    t.summary("tera_tsa_seconds", "Time server round trip", m.tsaUs);
+    t.summary("tera_write_seconds", "Time to write a container", m.writeUs);
+    return t.text;
+}
+
+}
@@ -0,0 +1,59 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef METRICS_SERVER_H_
+#define METRICS_SERVER_H_
+
+#include <QElapsedTimer>
+#include <QLocalServer>
+#include <QObject>
+#include <QScopedPointer>
+#include <QTcpServer>
+#include <QThread>
+
+namespace ria_tera {
+
+///
+/// \brief Serves stageMetrics in Prometheus text format while a run is active.
+///
+/// Listens on localhost or a UNIX socket and answers every HTTP request with
+/// the metrics. Runs on its own thread, so it answers also while the main
+/// thread is busy, ex. searching for files.
+///
+class MetricsServer : public QObject {
+    Q_OBJECT
+public:
+    MetricsServer();
+    ~MetricsServer();
+    /// "9100" or "127.0.0.1:9100" for TCP, anything else is a UNIX socket path
+    bool listen(QString const& address, QString& error);
+    /// Metrics text, uptimeMs is used for rates and ETA
+    static QByteArray render(qint64 uptimeMs);
+private:
+    void serve(QIODevice* socket);
+
+    QThread thread;
+    QElapsedTimer uptime;
+    QScopedPointer<QTcpServer> tcp;
+    QScopedPointer<QLocalServer> local;
+};
+
+}
+
+#endif /* METRICS_SERVER_H_ */
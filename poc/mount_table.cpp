@@ -0,0 +1,156 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "mount_table.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+#include <QStorageInfo>
+#endif
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/sysmacros.h>
+#endif
+
+#include "logging.h"
+
+namespace {
+
+QString storageRoot(QString const& path) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    return QStorageInfo(path).rootPath();
+#else
+    Q_UNUSED(path);
+    return "/";
+#endif
+}
+
+QMutex rootsMutex;
+#ifdef Q_OS_UNIX
+/// st_dev -> mount point
+bool mountsRead = false;
+QHash<quint64, QString> roots;
+
+#ifdef Q_OS_LINUX
+/// mountinfo escapes space, tab, newline and backslash as \ooo
+QString unescapeMountPath(QByteArray const& s) {
+    QByteArray res;
+    res.reserve(s.size());
+    for (int i = 0; i < s.size(); ++i) {
+        if ('\\' == s.at(i) && i + 3 < s.size()) {
+            bool ok = false;
+            int c = s.mid(i + 1, 3).toInt(&ok, 8);
+            if (ok) {
+                res.append(char(c));
+                i += 3;
+                continue;
+            }
+        }
+        res.append(s.at(i));
+    }
+    return QFile::decodeName(res);
+}
+
+/// "36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue"
+void readMountInfo() {
+    QFile f("/proc/self/mountinfo");
+    if (!f.open(QIODevice::ReadOnly)) {
+        TERA_LOG(debug) << "Can't read /proc/self/mountinfo: " << f.errorString();
+        return;
+    }
+    /// devices mounted whole, not only a subdirectory of them (bind mounts)
+    QHash<quint64, bool> whole;
+    for (QByteArray const& line : f.readAll().split('\n')) {
+        QList<QByteArray> fields = line.split(' ');
+        if (fields.size() < 5) continue;
+        QList<QByteArray> mm = fields.at(2).split(':');
+        if (mm.size() != 2) continue;
+        quint64 dev = static_cast<quint64>(makedev(mm.at(0).toUInt(), mm.at(1).toUInt()));
+        bool isWhole = ("/" == fields.at(3));
+        if (roots.contains(dev) && (whole.value(dev) || !isWhole)) continue;
+        roots.insert(dev, unescapeMountPath(fields.at(4)));
+        whole.insert(dev, isWhole);
+    }
+}
+#endif
+
+QString rootOfDevice(quint64 dev, QString const& path) {
+    QMutexLocker lock(&rootsMutex);
+#ifdef Q_OS_LINUX
+    if (!mountsRead) readMountInfo();
+#endif
+    mountsRead = true;
+    auto it = roots.find(dev);
+    if (roots.end() != it) return it.value();
+    QString root = storageRoot(path);
+    roots.insert(dev, root);
+    return root;
+}
+#else
+/// files come directory by directory
+QString lastDir;
+QString lastRoot;
+#endif
+
+}
+
+namespace ria_tera {
+
+bool MountTable::inspect(QString const& path, qint64& size, QString& root) {
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (0 != ::stat(QFile::encodeName(path).constData(), &st)) return false;
+    size = static_cast<qint64>(st.st_size);
+    root = rootOfDevice(static_cast<quint64>(st.st_dev), path);
+    return true;
+#else
+    QFileInfo fi(path);
+    if (!fi.exists()) return false;
+    size = fi.size();
+    root = rootPath(path);
+    return true;
+#endif
+}
+
+QString MountTable::rootPath(QString const& path) {
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (0 != ::stat(QFile::encodeName(path).constData(), &st)) return storageRoot(path);
+    return rootOfDevice(static_cast<quint64>(st.st_dev), path);
+#else
+    QString dir = path.left(path.lastIndexOf('/'));
+    QMutexLocker lock(&rootsMutex);
+    if (dir != lastDir || lastRoot.isNull()) {
+        lastDir = dir;
+        lastRoot = storageRoot(path);
+    }
+    return lastRoot;
+#endif
+}
+
+}
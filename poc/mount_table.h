@@ -0,0 +1,45 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef MOUNT_TABLE_H_
+#define MOUNT_TABLE_H_
+
+#include <QString>
+
+namespace ria_tera {
+
+///
+/// \brief Finds the partition a file is on without a QStorageInfo per file.
+///
+/// On Linux the st_dev of a file is looked up among the mounts read once
+/// from /proc/self/mountinfo; elsewhere, or for devices not found there,
+/// QStorageInfo is asked once per device (per directory where there is no
+/// st_dev) and the answer cached. Thread safe.
+///
+class MountTable {
+public:
+    /// Size of file and root path of its partition ("/" before Qt 5.4);
+    /// false if the file can't be stat'ed
+    static bool inspect(QString const& path, qint64& size, QString& root);
+    static QString rootPath(QString const& path);
+};
+
+}
+
+#endif /* MOUNT_TABLE_H_ */
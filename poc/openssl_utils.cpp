@@ -30,6 +30,8 @@
 
 #include <QtGlobal>
 
+#include "imprint.h"
+
 #if (OPENSSL_VERSION_NUMBER & 0xFFFF00000) == 0x010000000
     #define TERA_OLD_OPENSSL
 #endif
@@ -383,15 +385,20 @@ end:
     return resp;
 }
 
-QByteArray create_timestamp_request(QByteArray const& sha256) // TODO check size
+QByteArray create_timestamp_request(QByteArray const& hash)
 {
     TS_REQ *query = NULL; // TODO
 
     BIO *data_bio = NULL;
-    QByteArray hashHex = sha256.toHex();
+    QByteArray hashHex = hash.toHex();
     const char *digest = hashHex.constData();
 
-    const EVP_MD *md = EVP_get_digestbyname("sha256"); // TODO
+    Imprint::Algorithm alg = Imprint::DEFAULT;
+    if (!Imprint::fromDigestSize(hash.size(), alg)) {
+        std::cout << "unsupported digest length " << hash.size() << std::endl;
+        return QByteArray();
+    }
+    const EVP_MD *md = EVP_get_digestbyname(Imprint::name(alg));
     const char *policy = NULL; // TODO
     int no_nonce = 0;
     int cert = 1;
@@ -420,4 +427,49 @@ QByteArray create_timestamp_request(QByteArray const& sha256) // TODO check size
     return res;
 }
 
+bool timestamp_matches_request(QByteArray const& timestamp, QByteArray const& request, QString& error) {
+    bool res = false;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(request.constData());
+    TS_REQ* req = d2i_TS_REQ(NULL, &p, request.size());
+    const unsigned char* t = reinterpret_cast<const unsigned char*>(timestamp.constData());
+    PKCS7* token = d2i_PKCS7(NULL, &t, timestamp.size());
+    TS_TST_INFO* tstInfo = (NULL != token ? PKCS7_to_TS_TST_INFO(token) : NULL);
+    TS_MSG_IMPRINT* reqImprint = NULL;
+    TS_MSG_IMPRINT* tstImprint = NULL;
+    const ASN1_INTEGER* reqNonce = NULL;
+    const ASN1_INTEGER* tstNonce = NULL;
+
+    if (NULL == req) {
+        error = "Couldn't parse time-stamp request";
+        goto end;
+    }
+    if (NULL == tstInfo) {
+        error = "Couldn't parse time-stamp token";
+        goto end;
+    }
+    reqImprint = TS_REQ_get_msg_imprint(req);
+    tstImprint = TS_TST_INFO_get_msg_imprint(tstInfo);
+    if (0 != OBJ_cmp(TS_MSG_IMPRINT_get_algo(reqImprint)->algorithm, TS_MSG_IMPRINT_get_algo(tstImprint)->algorithm)) {
+        error = "Time-stamp has different hash algorithm than requested";
+        goto end;
+    }
+    if (0 != ASN1_STRING_cmp(TS_MSG_IMPRINT_get_msg(reqImprint), TS_MSG_IMPRINT_get_msg(tstImprint))) {
+        error = "Time-stamp is for different data than requested";
+        goto end;
+    }
+    reqNonce = TS_REQ_get_nonce(req);
+    tstNonce = TS_TST_INFO_get_nonce(tstInfo);
+    if (NULL != reqNonce && (NULL == tstNonce || 0 != ASN1_INTEGER_cmp(reqNonce, tstNonce))) {
+        error = "Time-stamp nonce does not match request";
+        goto end;
+    }
+    res = true;
+
+end:
+    TS_TST_INFO_free(tstInfo);
+    PKCS7_free(token);
+    TS_REQ_free(req);
+    return res;
+}
+
 } // namespace
@@ -25,13 +25,15 @@
 #define _TERA_OPENSSL_UTILS_H_
 
 #include <QByteArray>
+#include <QString>
 
 namespace ria_tera {
 
 ///
-/// \brief Converts sha256 hash into timestamp request suitable for sending to time server.
+/// \brief Converts hash into timestamp request suitable for sending to time server.
+/// Hash algorithm (SHA-256/384/512) is chosen by the length of digest.
 ///
-QByteArray create_timestamp_request(QByteArray const& sha256);
+QByteArray create_timestamp_request(QByteArray const& digest);
 
 ///
 /// \brief Extracts timestamp from time server response
@@ -41,6 +43,14 @@ QByteArray create_timestamp_request(QByteArray const& sha256);
 ///
 bool extract_timestamp_from_ts_response(QByteArray const& response, QByteArray& timestamp);
 
+///
+/// \brief Checks that timestamp token covers the request: same imprint algorithm, digest and nonce
+/// \param[in] timestamp token extracted from time server response
+/// \param[in] request DER encoded request sent to time server
+/// \param[out] error description of mismatch
+///
+bool timestamp_matches_request(QByteArray const& timestamp, QByteArray const& request, QString& error);
+
 } // namespace
 
 #endif /* _TERA_OPENSSL_UTILS_H_ */
@@ -0,0 +1,197 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "page_cache.h"
+
+#include <cstdlib>
+
+#include <QAtomicInteger>
+#include <QFile>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+/// read size; O_DIRECT needs buffer, offset and size aligned to the logical block size
+qint64 const CHUNK_BYTES = 1024 * 1024;
+size_t const DIRECT_ALIGNMENT = 4096;
+
+QAtomicInt currentMode(ria_tera::PageCache::CACHED);
+QAtomicInteger<qint64> readBytes(0);
+
+}
+
+namespace ria_tera {
+
+char const* PageCache::name(Mode m) {
+    switch (m) {
+    case DONTNEED: return "dontneed";
+    case DIRECT: return "direct";
+    default: return "cached";
+    }
+}
+
+bool PageCache::fromName(QString const& n, Mode& m) {
+    QString norm = n.trimmed().toLower();
+    for (Mode c : {CACHED, DONTNEED, DIRECT}) {
+        if (norm == name(c)) {
+            m = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+QStringList PageCache::names() {
+    return QStringList() << name(CACHED) << name(DONTNEED) << name(DIRECT);
+}
+
+void PageCache::setMode(Mode m) {
+    currentMode.storeRelease(m);
+}
+
+PageCache::Mode PageCache::mode() {
+    return static_cast<Mode>(currentMode.loadAcquire());
+}
+
+bool PageCache::readFile(QString const& path, std::function<void(char const*, qint64)> const& consume, QString& error) {
+#ifdef Q_OS_LINUX
+    QByteArray fname = QFile::encodeName(path);
+    Mode m = mode();
+    bool direct = false;
+    int fd = -1;
+    if (DIRECT == m) {
+        fd = ::open(fname.constData(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        direct = (fd >= 0);
+    }
+    if (fd < 0) fd = ::open(fname.constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = QString("Couldn't open file '%1'").arg(path);
+        return false;
+    }
+    if (CACHED != m && !direct) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    void* buf = nullptr;
+    if (0 != posix_memalign(&buf, DIRECT_ALIGNMENT, CHUNK_BYTES)) {
+        ::close(fd);
+        error = QString("Couldn't read file '%1': out of memory").arg(path);
+        return false;
+    }
+    qint64 offset = 0;
+    bool ok = true;
+    for (;;) {
+        ssize_t r = ::read(fd, buf, CHUNK_BYTES);
+        if (r < 0 && EINTR == errno) continue;
+        if (r < 0 && EINVAL == errno && direct) {
+            // file system accepted O_DIRECT on open but not for this file
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            direct = false;
+            continue;
+        }
+        if (r < 0) {
+            ok = false;
+            break;
+        }
+        if (0 == r) break;
+        consume(static_cast<char const*>(buf), r);
+        if (CACHED != m && !direct) posix_fadvise(fd, offset, r, POSIX_FADV_DONTNEED);
+        offset += r;
+    }
+    // read-ahead past the last consumed chunk
+    if (CACHED != m && !direct) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    free(buf);
+    ::close(fd);
+    countRead(offset);
+    if (!ok) error = QString("Couldn't read file '%1'").arg(path);
+    return ok;
+#else
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = QString("Couldn't open file '%1'").arg(path);
+        return false;
+    }
+    QByteArray buf(static_cast<int>(CHUNK_BYTES), Qt::Uninitialized);
+    qint64 total = 0;
+    for (;;) {
+        qint64 r = file.read(buf.data(), CHUNK_BYTES);
+        if (r < 0) {
+            error = QString("Couldn't read file '%1'").arg(path);
+            countRead(total);
+            return false;
+        }
+        if (0 == r) break;
+        consume(buf.constData(), r);
+        total += r;
+    }
+    countRead(total);
+    return true;
+#endif
+}
+
+void PageCache::drop(int fd) {
+#ifdef Q_OS_LINUX
+    if (dropping() && fd >= 0) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+    Q_UNUSED(fd);
+#endif
+}
+
+void PageCache::dropFile(QString const& path, bool written) {
+#ifdef Q_OS_LINUX
+    if (!dropping()) return;
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    if (written) fdatasync(fd);
+    drop(fd);
+    ::close(fd);
+#else
+    Q_UNUSED(path);
+    Q_UNUSED(written);
+#endif
+}
+
+void PageCache::countRead(qint64 bytes) {
+    readBytes.fetchAndAddRelaxed(bytes);
+}
+
+qint64 PageCache::bytesRead() {
+    return readBytes.loadAcquire();
+}
+
+qint64 PageCache::systemCachedBytes() {
+#ifdef Q_OS_LINUX
+    QFile meminfo("/proc/meminfo");
+    if (!meminfo.open(QIODevice::ReadOnly)) return -1;
+    // contents of /proc files can't be read with size, read line by line
+    for (QByteArray line = meminfo.readLine(); !line.isEmpty(); line = meminfo.readLine()) {
+        if (line.startsWith("Cached:")) {
+            QList<QByteArray> parts = line.simplified().split(' ');
+            if (parts.size() >= 2) return parts[1].toLongLong() * 1024;
+        }
+    }
+#endif
+    return -1;
+}
+
+}
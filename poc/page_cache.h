@@ -0,0 +1,70 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef PAGE_CACHE_H_
+#define PAGE_CACHE_H_
+
+#include <functional>
+
+#include <QString>
+#include <QStringList>
+
+namespace ria_tera {
+
+///
+/// \brief How file reads treat the OS page cache.
+///
+/// Stamping a large archive reads every byte once; with CACHED that evicts
+/// everything else from the page cache. DONTNEED drops each chunk right after
+/// it is consumed, DIRECT bypasses the cache with O_DIRECT (files on file
+/// systems without O_DIRECT are read as in DONTNEED). Only Linux honours the
+/// advice, other systems always read cached.
+///
+class PageCache {
+public:
+    enum Mode {CACHED, DONTNEED, DIRECT};
+
+    static char const* name(Mode m);
+    static bool fromName(QString const& name, Mode& m);
+    static QStringList names();
+
+    /// process wide, set before any files are read
+    static void setMode(Mode m);
+    static Mode mode();
+    static bool dropping() { return CACHED != mode(); }
+
+    /// Reads the file in chunks honouring the mode
+    static bool readFile(QString const& path, std::function<void(char const*, qint64)> const& consume, QString& error);
+    /// Drops pages of an open file that has been read whole
+    static void drop(int fd);
+    /// Drops pages of a file read or written by someone else (libzip);
+    /// written files are flushed first, dirty pages can't be dropped.
+    static void dropFile(QString const& path, bool written);
+
+    /// bytes of input files read by hashing and container creation
+    static void countRead(qint64 bytes);
+    static qint64 bytesRead();
+    /// System wide page cache size ("Cached" in /proc/meminfo), -1 if unknown
+    static qint64 systemCachedBytes();
+};
+
+}
+
+#endif /* PAGE_CACHE_H_ */
@@ -0,0 +1,155 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "path_store.h"
+
+#include <QHash>
+
+namespace ria_tera {
+
+PathStore::PathStore() : lastDir(NO_DIR) {}
+
+PathStore::FileId PathStore::add(QString const& path) {
+    int sep = path.lastIndexOf('/');
+    quint32 dir = (sep < 0 ? NO_DIR : dirOf(path.left(sep), true));
+    return intern(files, fileTable, dir, path.mid(sep + 1).toUtf8(), true);
+}
+
+PathStore::FileId PathStore::find(QString const& path) const {
+    int sep = path.lastIndexOf('/');
+    quint32 dir = NO_DIR;
+    if (sep >= 0) {
+        dir = findDir(path.left(sep));
+        if (NO_DIR == dir) return NO_FILE;
+    }
+    return lookup(files, fileTable, dir, path.mid(sep + 1).toUtf8());
+}
+
+QString PathStore::path(FileId id) const {
+    Entry const& f = files.at(static_cast<int>(id));
+    QString name = QString::fromUtf8(nameOf(f));
+    if (NO_DIR == f.parent) return name;
+    return dirPath(f.parent) + '/' + name;
+}
+
+QString PathStore::fileName(FileId id) const {
+    return QString::fromUtf8(nameOf(files.at(static_cast<int>(id))));
+}
+
+QStringList PathStore::paths(QVector<FileId> const& ids) const {
+    QStringList res;
+    res.reserve(ids.size());
+    for (FileId id : ids) res.append(path(id));
+    return res;
+}
+
+void PathStore::clear() {
+    dirs.clear();
+    files.clear();
+    arena.clear();
+    dirTable.clear();
+    fileTable.clear();
+    lastDirPath.clear();
+    lastDir = NO_DIR;
+}
+
+qint64 PathStore::memoryBytes() const {
+    return qint64(dirs.capacity() + files.capacity()) * sizeof(Entry) + arena.capacity() +
+           qint64(dirTable.capacity() + fileTable.capacity()) * sizeof(quint32);
+}
+
+uint PathStore::hashOf(quint32 parent, char const* name, int len) {
+    return qHash(QByteArray::fromRawData(name, len), parent);
+}
+
+quint32 PathStore::lookup(QVector<Entry> const& entries, QVector<quint32> const& table, quint32 parent, QByteArray const& name) const {
+    if (table.isEmpty()) return NO_DIR;
+    uint mask = static_cast<uint>(table.size() - 1);
+    for (uint slot = hashOf(parent, name.constData(), name.size()) & mask; 0 != table.at(slot); slot = (slot + 1) & mask) {
+        Entry const& e = entries.at(static_cast<int>(table.at(slot) - 1));
+        if (e.parent == parent && 0 == qstrcmp(nameOf(e), name.constData())) return table.at(slot) - 1;
+    }
+    return NO_DIR;
+}
+
+void PathStore::rehash(QVector<Entry> const& entries, QVector<quint32>& table, int capacity) const {
+    table = QVector<quint32>(capacity, 0);
+    uint mask = static_cast<uint>(capacity - 1);
+    for (int i = 0; i < entries.size(); ++i) {
+        char const* n = nameOf(entries.at(i));
+        uint slot = hashOf(entries.at(i).parent, n, static_cast<int>(qstrlen(n))) & mask;
+        while (0 != table.at(slot)) slot = (slot + 1) & mask;
+        table[slot] = static_cast<quint32>(i + 1);
+    }
+}
+
+quint32 PathStore::intern(QVector<Entry>& entries, QVector<quint32>& table, quint32 parent, QByteArray const& name, bool create) {
+    quint32 found = lookup(entries, table, parent, name);
+    if (NO_DIR != found || !create) return found;
+
+    // load factor stays under 1/2, probe sequences stay short
+    if ((entries.size() + 1) * 2 > table.size()) rehash(entries, table, qMax(64, table.size() * 2));
+    Entry e;
+    e.parent = parent;
+    e.name = static_cast<quint32>(arena.size());
+    arena.append(name);
+    arena.append('\0');
+    entries.append(e);
+    quint32 idx = static_cast<quint32>(entries.size() - 1);
+
+    uint mask = static_cast<uint>(table.size() - 1);
+    uint slot = hashOf(parent, name.constData(), name.size()) & mask;
+    while (0 != table.at(slot)) slot = (slot + 1) & mask;
+    table[slot] = idx + 1;
+    return idx;
+}
+
+quint32 PathStore::dirOf(QString const& dirPath, bool create) {
+    if (NO_DIR != lastDir && dirPath == lastDirPath) return lastDir;
+    quint32 dir = NO_DIR;
+    // "/a/b" -> "", "a", "b"; "C:/a" -> "C:", "a"; joining them gives the path back
+    for (QString const& component : dirPath.split('/')) {
+        dir = intern(dirs, dirTable, dir, component.toUtf8(), create);
+        if (NO_DIR == dir) return NO_DIR;
+    }
+    lastDirPath = dirPath;
+    lastDir = dir;
+    return dir;
+}
+
+quint32 PathStore::findDir(QString const& dirPath) const {
+    if (NO_DIR != lastDir && dirPath == lastDirPath) return lastDir;
+    quint32 dir = NO_DIR;
+    for (QString const& component : dirPath.split('/')) {
+        dir = lookup(dirs, dirTable, dir, component.toUtf8());
+        if (NO_DIR == dir) return NO_DIR;
+    }
+    return dir;
+}
+
+QString PathStore::dirPath(quint32 dir) const {
+    QStringList components;
+    for (quint32 d = dir; NO_DIR != d; d = dirs.at(static_cast<int>(d)).parent) {
+        components.prepend(QString::fromUtf8(nameOf(dirs.at(static_cast<int>(d)))));
+    }
+    return components.join('/');
+}
+
+}
@@ -0,0 +1,89 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef PATH_STORE_H_
+#define PATH_STORE_H_
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+namespace ria_tera {
+
+///
+/// \brief Compact storage for millions of file paths.
+///
+/// Directories are interned component by component, each file keeps its
+/// directory id and its name as UTF-8 in one arena; about 8 bytes plus the
+/// name length per file instead of a UTF-16 QString of the full path. Files
+/// are referred to by 32-bit ids, ids stay valid until clear().
+/// Copies share data until either one is modified (implicit sharing).
+///
+class PathStore {
+public:
+    typedef quint32 FileId;
+    static FileId const NO_FILE = 0xFFFFFFFFu;
+
+    PathStore();
+    /// Id of path, added if not there yet
+    FileId add(QString const& path);
+    /// NO_FILE if path hasn't been added
+    FileId find(QString const& path) const;
+    QString path(FileId id) const;
+    QString fileName(FileId id) const;
+    QStringList paths(QVector<FileId> const& ids) const;
+    int size() const { return files.size(); };
+    bool isEmpty() const { return files.isEmpty(); };
+    void clear();
+    /// Heap memory held, for statistics
+    qint64 memoryBytes() const;
+private:
+    /// directory or file: parent directory and offset of '\0' terminated UTF-8 name in arena
+    struct Entry {
+        quint32 parent;
+        quint32 name;
+    };
+    static quint32 const NO_DIR = 0xFFFFFFFFu;
+
+    char const* nameOf(Entry const& e) const { return arena.constData() + e.name; };
+    static uint hashOf(quint32 parent, char const* name, int len);
+    /// Index of entry (parent, name) in entries, NO_DIR if not there and !create
+    quint32 intern(QVector<Entry>& entries, QVector<quint32>& table, quint32 parent, QByteArray const& name, bool create);
+    quint32 lookup(QVector<Entry> const& entries, QVector<quint32> const& table, quint32 parent, QByteArray const& name) const;
+    void rehash(QVector<Entry> const& entries, QVector<quint32>& table, int capacity) const;
+    quint32 dirOf(QString const& dirPath, bool create);
+    quint32 findDir(QString const& dirPath) const;
+    QString dirPath(quint32 dir) const;
+
+    QVector<Entry> dirs;
+    QVector<Entry> files;
+    QByteArray arena;
+    /// open addressing hash tables, entry index + 1, 0 - empty slot
+    QVector<quint32> dirTable;
+    QVector<quint32> fileTable;
+    /// consecutive files of a crawl are mostly in the same directory
+    QString lastDirPath;
+    quint32 lastDir;
+};
+
+}
+
+#endif /* PATH_STORE_H_ */
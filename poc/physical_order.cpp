@@ -0,0 +1,170 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "physical_order.h"
+
+#include <algorithm>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMap>
+#include <QPair>
+#include <QVector>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "io_scheduler.h"
+#include "logging.h"
+
+namespace {
+
+#ifdef Q_OS_LINUX
+bool inodeOf(QByteArray const& path, quint64& key) {
+    struct stat st;
+    if (0 != ::stat(path.constData(), &st)) return false;
+    key = static_cast<quint64>(st.st_ino);
+    return true;
+}
+
+/// Physical offset of the first extent; empty, unreadable files and inline data get 0.
+/// False if the file system has no FIEMAP.
+bool firstExtentOf(QByteArray const& path, quint64& key) {
+    key = 0;
+    int fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return true;
+    struct {
+        struct fiemap map;
+        struct fiemap_extent extent;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.map.fm_start = 0;
+    req.map.fm_length = FIEMAP_MAX_OFFSET;
+    req.map.fm_extent_count = 1;
+    bool ok = (0 == ioctl(fd, FS_IOC_FIEMAP, &req.map));
+    int err = errno;
+    ::close(fd);
+    if (!ok) return (EOPNOTSUPP != err && ENOTTY != err);
+    key = (req.map.fm_mapped_extents > 0 && !(req.extent.fe_flags & FIEMAP_EXTENT_UNKNOWN) ? req.extent.fe_physical : 0);
+    return true;
+}
+#endif
+
+}
+
+namespace ria_tera {
+
+char const* PhysicalOrder::name(Mode m) {
+    switch (m) {
+    case INODE: return "inode";
+    case EXTENT: return "extent";
+    default: return "none";
+    }
+}
+
+bool PhysicalOrder::fromName(QString const& n, Mode& m) {
+    QString norm = n.trimmed().toLower();
+    for (Mode c : {NONE, INODE, EXTENT}) {
+        if (norm == name(c)) {
+            m = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+QStringList PhysicalOrder::names() {
+    return QStringList() << name(NONE) << name(INODE) << name(EXTENT);
+}
+
+void PhysicalOrder::sort(QStringList& paths, Mode m) {
+    QVector<int> perm = order(paths.size(), [&](int i) { return paths.at(i); }, m);
+    if (perm.isEmpty()) return;
+    QStringList original = paths;
+    for (int k = 0; k < perm.size(); ++k) paths[k] = original.at(perm[k]);
+}
+
+void PhysicalOrder::sort(PathStore const& store, QVector<PathStore::FileId>& files, Mode m) {
+    QVector<int> perm = order(files.size(), [&](int i) { return store.path(files.at(i)); }, m);
+    if (perm.isEmpty()) return;
+    QVector<PathStore::FileId> original = files;
+    for (int k = 0; k < perm.size(); ++k) files[k] = original.at(perm[k]);
+}
+
+QVector<int> PhysicalOrder::order(int n, std::function<QString(int)> const& pathAt, Mode m) {
+    QVector<int> perm;
+#ifdef Q_OS_LINUX
+    if (NONE == m) return perm;
+    QElapsedTimer timer;
+    timer.start();
+
+    // positions of files per rotational device
+    QMap<quint64, QVector<int>> byDevice;
+    for (int i = 0; i < n; ++i) {
+        IoScheduler::Device d = IoScheduler::device(pathAt(i));
+        if (IoScheduler::ROTATIONAL == d.type) byDevice[d.id].append(i);
+    }
+    if (byDevice.isEmpty()) return perm;
+
+    perm.reserve(n);
+    for (int i = 0; i < n; ++i) perm.append(i);
+    for (QVector<int> const& positions : byDevice) {
+        QVector<QPair<quint64, int>> keyed(positions.size());
+        bool extents = (EXTENT == m);
+        for (int k = 0; k < positions.size() && extents; ++k) {
+            keyed[k] = qMakePair(quint64(0), positions[k]);
+            extents = firstExtentOf(QFile::encodeName(pathAt(positions[k])), keyed[k].first);
+        }
+        if (!extents) {
+            // inode order asked for, or no FIEMAP on this file system: inodes for the whole device
+            for (int k = 0; k < positions.size(); ++k) {
+                keyed[k] = qMakePair(quint64(0), positions[k]);
+                inodeOf(QFile::encodeName(pathAt(positions[k])), keyed[k].first);
+            }
+        }
+        // stable: files with equal keys (unreadable ones) keep their order
+        std::stable_sort(keyed.begin(), keyed.end(), [](QPair<quint64, int> const& a, QPair<quint64, int> const& b) {
+            return a.first < b.first;
+        });
+        for (int k = 0; k < positions.size(); ++k) {
+            perm[positions[k]] = keyed[k].second;
+        }
+    }
+    int sorted = 0;
+    for (QVector<int> const& positions : byDevice) sorted += positions.size();
+    TERA_LOG(info) << "Ordered " << sorted << " files on " << byDevice.size() << " rotational devices by "
+                   << name(m) << " in " << QString::number(timer.elapsed()) << " ms";
+#else
+    Q_UNUSED(n);
+    Q_UNUSED(pathAt);
+    Q_UNUSED(m);
+#endif
+    return perm;
+}
+
+}
@@ -0,0 +1,62 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef PHYSICAL_ORDER_H_
+#define PHYSICAL_ORDER_H_
+
+#include <functional>
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "path_store.h"
+
+namespace ria_tera {
+
+///
+/// \brief Orders files of spinning disks by their place on disk.
+///
+/// Directory listing order is unrelated to where file data lies, so reading
+/// in that order seeks all over the disk. Sorting by inode number comes close
+/// on most file systems; sorting by the first physical extent (FIEMAP, Linux)
+/// follows the data itself. Falls back to inode where FIEMAP isn't supported.
+///
+class PhysicalOrder {
+public:
+    enum Mode {NONE, INODE, EXTENT};
+
+    static char const* name(Mode m);
+    static bool fromName(QString const& name, Mode& m);
+    static QStringList names();
+
+    /// Sorts files of each rotational device among the positions they had in
+    /// paths; files on other devices stay where they are, so devices still
+    /// interleave and are processed in parallel.
+    static void sort(QStringList& paths, Mode m);
+    static void sort(PathStore const& store, QVector<PathStore::FileId>& files, Mode m);
+private:
+    /// perm[k] - old position of the file to put at k, empty if nothing moves
+    static QVector<int> order(int n, std::function<QString(int)> const& pathAt, Mode m);
+};
+
+}
+
+#endif /* PHYSICAL_ORDER_H_ */
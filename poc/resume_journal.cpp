@@ -0,0 +1,107 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "resume_journal.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace {
+
+QByteArray const HEADER("# TeRa resume journal v1");
+
+}
+
+namespace ria_tera {
+
+ResumeJournal::ResumeJournal(QString const& path) : journalPath(path) {}
+
+QString ResumeJournal::defaultPath() {
+#if QT_VERSION < QT_VERSION_CHECK(5, 4, 0)
+    return QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/tera_resume.journal";
+#else
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/tera_resume.journal";
+#endif
+}
+
+bool ResumeJournal::exists() const {
+    return QFileInfo(journalPath).exists();
+}
+
+bool ResumeJournal::read(QList<Entry>& entries, QString& error) const {
+    entries.clear();
+    QFile f(journalPath);
+    if (!f.open(QIODevice::ReadOnly)) {
+        error = QString("Couldn't open resume journal '%1'").arg(journalPath);
+        return false;
+    }
+
+    QByteArray header = f.readLine().trimmed();
+    if (HEADER != header) {
+        error = QString("'%1' is not a resume journal").arg(journalPath);
+        return false;
+    }
+
+    while (!f.atEnd()) {
+        QByteArray line = f.readLine();
+        if (line.endsWith('\n')) line.chop(1);
+        if (line.isEmpty()) continue;
+        int tab = line.indexOf('\t');
+        if (tab < 0) {
+            entries.append(Entry(QString::fromUtf8(line)));
+        } else {
+            entries.append(Entry(QString::fromUtf8(line.left(tab)), QString::fromUtf8(line.mid(tab + 1))));
+        }
+    }
+    return true;
+}
+
+bool ResumeJournal::write(QList<Entry> const& entries, QString& error) const {
+    QDir().mkpath(QFileInfo(journalPath).absolutePath());
+
+    // journal is replaced atomically, a crash leaves the previous version
+    QSaveFile f(journalPath);
+    if (!f.open(QIODevice::WriteOnly)) {
+        error = QString("Couldn't write resume journal '%1'").arg(journalPath);
+        return false;
+    }
+    f.write(HEADER + "\n");
+    for (Entry const& e : entries) {
+        f.write(e.in.toUtf8());
+        if (!e.out.isEmpty()) {
+            f.write("\t");
+            f.write(e.out.toUtf8());
+        }
+        f.write("\n");
+    }
+    if (!f.commit()) {
+        error = QString("Couldn't write resume journal '%1'").arg(journalPath);
+        return false;
+    }
+    return true;
+}
+
+bool ResumeJournal::remove() const {
+    return !exists() || QFile::remove(journalPath);
+}
+
+}
@@ -0,0 +1,58 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef RESUME_JOURNAL_H_
+#define RESUME_JOURNAL_H_
+
+#include <QList>
+#include <QString>
+
+namespace ria_tera {
+
+///
+/// \brief Files left unprocessed by a run, so the next run can continue with them.
+///
+/// UTF-8 text file, one "<input path>[TAB<output path>]" per line.
+///
+class ResumeJournal {
+public:
+    class Entry {
+    public:
+        Entry(QString const& i = QString(), QString const& o = QString()) : in(i), out(o) {};
+        QString in;
+        /// empty - output name is generated
+        QString out;
+    };
+
+    explicit ResumeJournal(QString const& path = defaultPath());
+    static QString defaultPath();
+
+    QString path() const { return journalPath; };
+    bool exists() const;
+    bool read(QList<Entry>& entries, QString& error) const;
+    /// Replaces journal content
+    bool write(QList<Entry> const& entries, QString& error) const;
+    bool remove() const;
+private:
+    QString journalPath;
+};
+
+}
+
+#endif /* RESUME_JOURNAL_H_ */
@@ -0,0 +1,209 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "run_stats.h"
+
+#include "logging.h"
+#include "page_cache.h"
+#include "stage_metrics.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+QElapsedTimer startedTimer() {
+    QElapsedTimer t;
+    t.start();
+    return t;
+}
+
+// initialized before main(), close enough to process start
+QElapsedTimer const processTimer = startedTimer();
+
+double mbPerSec(qint64 bytes, qint64 ms) {
+    return bytes / 1024.0 / 1024.0 * 1000.0 / qMax<qint64>(ms, 1);
+}
+
+QJsonObject latencyJson(ria_tera::LatencyHistogram const& h) {
+    QJsonObject o;
+    o["count"] = h.count();
+    o["mean_us"] = qint64(h.mean());
+    o["p50_us"] = h.percentile(50);
+    o["p90_us"] = h.percentile(90);
+    o["p99_us"] = h.percentile(99);
+    o["p999_us"] = h.percentile(99.9);
+    o["max_us"] = h.max();
+    return o;
+}
+
+}
+
+namespace ria_tera {
+
+RunStats::RunStats() = default;
+
+void RunStats::startupDone(bool fromCache) {
+    if (startupMs >= 0) return;
+    startupMs = sinceProcessStart();
+    configFromCache = fromCache;
+}
+
+qint64 RunStats::sinceProcessStart() {
+    return processTimer.elapsed();
+}
+
+void RunStats::ioStarted() {
+    pageCacheMode = PageCache::name(PageCache::mode());
+    ioBytesBefore = PageCache::bytesRead();
+    cachedBefore = PageCache::systemCachedBytes();
+    ioTimer.start();
+}
+
+void RunStats::ioDone() {
+    if (!ioTimer.isValid()) return;
+    ioMs = ioTimer.elapsed();
+    ioBytes = PageCache::bytesRead() - ioBytesBefore;
+    cachedAfter = PageCache::systemCachedBytes();
+}
+
+qint64 RunStats::peakRssBytes() {
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return -1;
+    return qint64(pmc.PeakWorkingSetSize);
+#else
+    struct rusage ru;
+    if (0 != getrusage(RUSAGE_SELF, &ru)) return -1;
+#if defined(Q_OS_MAC)
+    return qint64(ru.ru_maxrss);
+#else
+    // kilobytes on Linux and BSDs
+    return qint64(ru.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+void RunStats::log() const {
+    if (startupMs >= 0) {
+        TERA_LOG(info) << "   Startup latency: " << QString::number(startupMs) << " ms"
+                       << (configFromCache ? " (cached configuration)" : " (downloaded configuration)");
+    }
+    if (dedupUnique > 0) {
+        TERA_LOG(info) << "   Deduplication: " << QString::number(dedupFiles) << " files, "
+                       << QString::number(dedupUnique) << " time server requests (ratio "
+                       << QString::number(double(dedupFiles) / dedupUnique, 'f', 2) << ")";
+    }
+    if (pathFiles > 0) {
+        TERA_LOG(info) << "   Path store: " << QString::number(pathFiles) << " files, "
+                       << QString::number(pathBytes / 1024.0 / 1024.0, 'f', 1) << " MB ("
+                       << QString::number(pathBytes / pathFiles) << " bytes per file)";
+    }
+    if (ioMs >= 0 && ioBytes > 0) {
+        double mb = ioBytes / 1024.0 / 1024.0;
+        TERA_LOG(info) << "   File I/O: " << QString::number(mb, 'f', 1) << " MB read in "
+                       << QString::number(ioMs / 1000.0, 'f', 1) << " s ("
+                       << QString::number(mb * 1000.0 / qMax<qint64>(ioMs, 1), 'f', 1) << " MB/s), page cache mode "
+                       << pageCacheMode;
+        if (cachedBefore >= 0 && cachedAfter >= 0) {
+            TERA_LOG(info) << "   Page cache: " << QString::number(cachedBefore / 1024 / 1024) << " MB before, "
+                           << QString::number(cachedAfter / 1024 / 1024) << " MB after ("
+                           << QString::number((cachedAfter - cachedBefore) / 1024 / 1024) << " MB)";
+        }
+    }
+    StageMetrics const& m = stageMetrics;
+    if (m.hashUs.count() > 0) {
+        TERA_LOG(info) << "   Hash time: " << m.hashUs.summary();
+    }
+    if (m.tsaUs.count() > 0) {
+        TERA_LOG(info) << "   Time server latency: " << m.tsaUs.summary();
+    }
+    if (m.writeUs.count() > 0) {
+        TERA_LOG(info) << "   Container write time: " << m.writeUs.summary();
+    }
+    if (ioMs > 0) {
+        TERA_LOG(info) << "   Throughput: " << QString::number(mbPerSec(m.hashedBytes.loadAcquire(), ioMs), 'f', 1)
+                       << " MB/s hashed, " << QString::number(succeededFiles * 1000.0 / ioMs, 'f', 1)
+                       << " files/s time-stamped, " << QString::number(m.writtenBytes.loadAcquire() / 1024.0 / 1024.0, 'f', 1)
+                       << " MB written";
+    }
+    QString quota;
+    if (quotaUsedToday >= 0) {
+        quota = QString(", quota used %1 today, %2 this month").arg(quotaUsedToday).arg(quotaUsedThisMonth);
+    }
+    TERA_LOG(info) << "   Time server requests: " << QString::number(m.tsaRequests.loadAcquire()) << " ("
+                   << QString::number(m.retries.loadAcquire()) << " retries)" << quota;
+    qint64 rss = peakRssBytes();
+    if (rss >= 0) {
+        TERA_LOG(info) << "   Peak RSS: " << QString::number(rss / 1024.0 / 1024.0, 'f', 1) << " MB";
+    }
+}
+
+bool RunStats::writeReport(QString const& path, QString& error) const {
+    StageMetrics const& m = stageMetrics;
+    QJsonObject files;
+    files["found"] = foundFiles;
+    files["succeeded"] = succeededFiles;
+    files["failed"] = failedFiles;
+    files["per_sec"] = (ioMs > 0 ? succeededFiles * 1000.0 / ioMs : 0.0);
+
+    QJsonObject hash = latencyJson(m.hashUs);
+    hash["bytes"] = m.hashedBytes.loadAcquire();
+    hash["mb_per_sec"] = (ioMs > 0 ? mbPerSec(m.hashedBytes.loadAcquire(), ioMs) : 0.0);
+
+    QJsonObject tsa = latencyJson(m.tsaUs);
+    tsa["requests"] = m.tsaRequests.loadAcquire();
+    tsa["retries"] = m.retries.loadAcquire();
+    tsa["quota_used_today"] = quotaUsedToday;
+    tsa["quota_used_this_month"] = quotaUsedThisMonth;
+    tsa["dedup_files"] = dedupFiles;
+    tsa["dedup_unique"] = dedupUnique;
+
+    QJsonObject write = latencyJson(m.writeUs);
+    write["bytes"] = m.writtenBytes.loadAcquire();
+
+    QJsonObject report;
+    report["startup_ms"] = startupMs;
+    report["duration_ms"] = ioMs;
+    report["bytes_read"] = ioBytes;
+    report["page_cache_mode"] = pageCacheMode;
+    report["peak_rss_bytes"] = peakRssBytes();
+    report["files"] = files;
+    report["hash"] = hash;
+    report["tsa"] = tsa;
+    report["write"] = write;
+
+    QSaveFile f(path);
+    QByteArray json = QJsonDocument(report).toJson();
+    if (!f.open(QIODevice::WriteOnly) || f.write(json) != json.size() || !f.commit()) {
+        error = QString("Can't write report '%1': %2").arg(path, f.errorString());
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,77 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef RUN_STATS_H_
+#define RUN_STATS_H_
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QtGlobal>
+
+namespace ria_tera {
+
+/// Figures collected during one timestamping run, printed at the end of the run
+class RunStats {
+public:
+    RunStats();
+
+    /// Called when configuration is available and work can start
+    void startupDone(bool configFromCache);
+    /// Milliseconds since process start
+    static qint64 sinceProcessStart();
+    /// Marks start and end of file I/O for throughput and page cache footprint
+    void ioStarted();
+    void ioDone();
+
+    void log() const;
+    /// Machine readable form of what log() prints, for monitoring
+    bool writeReport(QString const& path, QString& error) const;
+    /// Peak resident set size of the process, -1 if unknown
+    static qint64 peakRssBytes();
+
+    qint64 startupMs = -1;
+    bool configFromCache = false;
+    /// files time-stamped by digest and distinct digests among them
+    qint64 dedupFiles = 0;
+    qint64 dedupUnique = 0;
+    /// page cache mode, bytes read from input files, duration and
+    /// system wide page cache size at start and end
+    QString pageCacheMode;
+    qint64 ioBytes = 0;
+    qint64 ioMs = -1;
+    qint64 cachedBefore = -1;
+    qint64 cachedAfter = -1;
+    /// files found by the crawl and memory holding their paths
+    qint64 pathFiles = 0;
+    qint64 pathBytes = 0;
+    /// outcome of input files
+    qint64 foundFiles = 0;
+    qint64 succeededFiles = 0;
+    qint64 failedFiles = 0;
+    /// requests used from time server quota ledger, -1 if quota is not limited
+    int quotaUsedToday = -1;
+    int quotaUsedThisMonth = -1;
+private:
+    QElapsedTimer ioTimer;
+    qint64 ioBytesBefore = 0;
+};
+
+}
+
+#endif /* RUN_STATS_H_ */
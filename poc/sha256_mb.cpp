@@ -0,0 +1,159 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "sha256_mb.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+#include <openssl/sha.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TERA_SHA256_MB_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace {
+
+using ria_tera::Sha256MultiBuffer;
+
+class CpuFeatures {
+public:
+    bool avx2 = false;
+    bool avx512 = false;
+    /// SHA extensions, OpenSSL single-stream SHA-256 is fast with them
+    bool sha = false;
+
+    CpuFeatures() {
+#ifdef TERA_SHA256_MB_X86
+        unsigned int r1[4] = {0, 0, 0, 0};
+        unsigned int r7[4] = {0, 0, 0, 0};
+        if (!cpuid(1, r1) || !cpuid(7, r7)) return;
+        sha = (r7[1] & (1u << 29)) != 0;
+        bool osxsave = (r1[2] & (1u << 27)) != 0;
+        if (!osxsave) return;
+        unsigned long long xcr0 = xgetbv();
+        avx2 = (xcr0 & 0x6) == 0x6 && (r7[1] & (1u << 5)) != 0;
+        // opmask, upper ZMM and ZMM16-31 state enabled by OS
+        avx512 = (xcr0 & 0xe6) == 0xe6 && (r7[1] & (1u << 16)) != 0;
+#endif
+    }
+private:
+#ifdef TERA_SHA256_MB_X86
+    static bool cpuid(unsigned int leaf, unsigned int* r) {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (static_cast<unsigned int>(info[0]) < leaf) return false;
+        __cpuidex(info, static_cast<int>(leaf), 0);
+        for (int i = 0; i < 4; ++i) r[i] = static_cast<unsigned int>(info[i]);
+        return true;
+#else
+        return 0 != __get_cpuid_count(leaf, 0, &r[0], &r[1], &r[2], &r[3]);
+#endif
+    }
+    static unsigned long long xgetbv() {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        unsigned int lo, hi;
+        __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+    }
+#endif
+};
+
+CpuFeatures const& cpu() {
+    static CpuFeatures const f;
+    return f;
+}
+
+Sha256MultiBuffer::Kernel detect() {
+    char const* forced = getenv("TERA_SHA256_KERNEL");
+    if (forced) {
+        for (Sha256MultiBuffer::Kernel k : {Sha256MultiBuffer::SCALAR, Sha256MultiBuffer::AVX2, Sha256MultiBuffer::AVX512}) {
+            if (0 == strcmp(forced, Sha256MultiBuffer::name(k)) && Sha256MultiBuffer::supported(k)) return k;
+        }
+    }
+    // 16 lanes beat SHA extensions, 8 lanes don't
+    if (cpu().avx512) return Sha256MultiBuffer::AVX512;
+    if (cpu().avx2 && !cpu().sha) return Sha256MultiBuffer::AVX2;
+    return Sha256MultiBuffer::SCALAR;
+}
+
+}
+
+namespace ria_tera {
+
+Sha256MultiBuffer::Kernel Sha256MultiBuffer::best() {
+    static Kernel const k = detect();
+    return k;
+}
+
+bool Sha256MultiBuffer::supported(Kernel k) {
+    if (SCALAR == k) return true;
+    if (AVX2 == k) return cpu().avx2;
+    if (AVX512 == k) return cpu().avx512;
+    return false;
+}
+
+char const* Sha256MultiBuffer::name(Kernel k) {
+    switch (k) {
+    case AVX2: return "avx2";
+    case AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+int Sha256MultiBuffer::lanes(Kernel k) {
+    switch (k) {
+    case AVX2: return 8;
+    case AVX512: return 16;
+    default: return 1;
+    }
+}
+
+void Sha256MultiBuffer::hash(Message* msgs, int n, Kernel k) {
+    if (!supported(k)) k = SCALAR;
+#ifdef TERA_SHA256_MB_X86
+    if (AVX512 == k) {
+        hashAvx512(msgs, n);
+        return;
+    } else if (AVX2 == k) {
+        hashAvx2(msgs, n);
+        return;
+    }
+#endif
+    hashScalar(msgs, n);
+}
+
+void Sha256MultiBuffer::hashScalar(Message* msgs, int n) {
+    for (int i = 0; i < n; ++i) {
+        SHA256(msgs[i].data, static_cast<size_t>(msgs[i].len), msgs[i].digest);
+    }
+}
+
+}
@@ -0,0 +1,64 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef SHA256_MB_H_
+#define SHA256_MB_H_
+
+#include <cstdint>
+
+namespace ria_tera {
+
+///
+/// \brief SHA-256 of many independent messages at once.
+///
+/// The SIMD kernels hash one message per vector lane in lockstep (8 lanes with
+/// AVX2, 16 with AVX-512), which pays off for many small files where single-stream
+/// hashing leaves the vector units idle. Kernel is picked at runtime; SCALAR is
+/// OpenSSL's single-stream SHA-256 and works everywhere.
+///
+class Sha256MultiBuffer {
+public:
+    enum Kernel {SCALAR, AVX2, AVX512};
+    static int const DIGEST_SIZE = 32;
+
+    class Message {
+    public:
+        unsigned char const* data;
+        uint64_t len;
+        /// DIGEST_SIZE bytes
+        unsigned char* digest;
+    };
+
+    /// Fastest supported kernel, can be forced with TERA_SHA256_KERNEL=scalar|avx2|avx512
+    static Kernel best();
+    static bool supported(Kernel k);
+    static char const* name(Kernel k);
+    static int lanes(Kernel k);
+
+    static void hash(Message* msgs, int n, Kernel k = best());
+private:
+    static void hashScalar(Message* msgs, int n);
+    static void hashAvx2(Message* msgs, int n);
+    static void hashAvx512(Message* msgs, int n);
+};
+
+}
+
+#endif /* SHA256_MB_H_ */
@@ -0,0 +1,55 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "sha256_mb.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <immintrin.h>
+
+#include "sha256_mb_kernel.h"
+
+namespace {
+
+struct Avx2 {
+    static int const LANES = 8;
+    typedef __m256i T;
+    static T load(uint32_t const* p) { return _mm256_load_si256(reinterpret_cast<T const*>(p)); }
+    static void store(uint32_t* p, T v) { _mm256_store_si256(reinterpret_cast<T*>(p), v); }
+    static T set1(uint32_t v) { return _mm256_set1_epi32(static_cast<int>(v)); }
+    static T add(T a, T b) { return _mm256_add_epi32(a, b); }
+    static T xor3(T a, T b, T c) { return _mm256_xor_si256(_mm256_xor_si256(a, b), c); }
+    template <int N> static T rotr(T x) { return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32 - N)); }
+    template <int N> static T shr(T x) { return _mm256_srli_epi32(x, N); }
+    static T ch(T e, T f, T g) { return _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)); }
+    static T maj(T a, T b, T c) { return _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b))); }
+};
+
+}
+
+namespace ria_tera {
+
+void Sha256MultiBuffer::hashAvx2(Message* msgs, int n) {
+    hashLanes<Avx2>(msgs, n);
+}
+
+}
+
+#endif
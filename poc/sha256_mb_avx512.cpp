@@ -0,0 +1,56 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "sha256_mb.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <immintrin.h>
+
+#include "sha256_mb_kernel.h"
+
+namespace {
+
+struct Avx512 {
+    static int const LANES = 16;
+    typedef __m512i T;
+    static T load(uint32_t const* p) { return _mm512_load_si512(p); }
+    static void store(uint32_t* p, T v) { _mm512_store_si512(p, v); }
+    static T set1(uint32_t v) { return _mm512_set1_epi32(static_cast<int>(v)); }
+    static T add(T a, T b) { return _mm512_add_epi32(a, b); }
+    // 0x96 - a ^ b ^ c, 0xca - a ? b : c, 0xe8 - majority
+    static T xor3(T a, T b, T c) { return _mm512_ternarylogic_epi32(a, b, c, 0x96); }
+    template <int N> static T rotr(T x) { return _mm512_ror_epi32(x, N); }
+    template <int N> static T shr(T x) { return _mm512_srli_epi32(x, N); }
+    static T ch(T e, T f, T g) { return _mm512_ternarylogic_epi32(e, f, g, 0xca); }
+    static T maj(T a, T b, T c) { return _mm512_ternarylogic_epi32(a, b, c, 0xe8); }
+};
+
+}
+
+namespace ria_tera {
+
+void Sha256MultiBuffer::hashAvx512(Message* msgs, int n) {
+    hashLanes<Avx512>(msgs, n);
+}
+
+}
+
+#endif
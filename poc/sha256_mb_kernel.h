@@ -0,0 +1,181 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+///
+/// Multi-buffer SHA-256 kernel, included only by the per-ISA translation units
+/// (sha256_mb_avx2.cpp, sha256_mb_avx512.cpp) which are compiled with matching
+/// instruction set flags. Everything here has internal linkage, so code built
+/// for one instruction set never gets picked by the linker for another.
+///
+#ifndef SHA256_MB_KERNEL_H_
+#define SHA256_MB_KERNEL_H_
+
+#include <cstdint>
+#include <cstring>
+
+#include "sha256_mb.h"
+
+namespace {
+
+uint32_t const K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+uint32_t const IV256[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+uint64_t blockCount(uint64_t len) {
+    // message + 0x80 + 64 bit length, rounded up to 64 byte blocks
+    return (len + 8) / 64 + 1;
+}
+
+/// Block b of the padded message
+void paddedBlock(ria_tera::Sha256MultiBuffer::Message const& m, uint64_t b, unsigned char* blk) {
+    uint64_t off = b * 64;
+    if (off + 64 <= m.len) {
+        memcpy(blk, m.data + off, 64);
+        return;
+    }
+    memset(blk, 0, 64);
+    if (off < m.len) memcpy(blk, m.data + off, m.len - off);
+    if (off <= m.len) blk[m.len - off] = 0x80;
+    if (b + 1 == blockCount(m.len)) {
+        uint64_t bits = m.len * 8;
+        for (int i = 0; i < 8; ++i) blk[63 - i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+}
+
+uint32_t be32(unsigned char const* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+/// 64 rounds on all lanes. V provides the vector type and operations, state and
+/// message words are word-major: st[word][lane], w[word][lane].
+template <class V>
+void compress(uint32_t (*st)[V::LANES], uint32_t (*w)[V::LANES]) {
+    typedef typename V::T T;
+    T W[16];
+    for (int i = 0; i < 16; ++i) W[i] = V::load(w[i]);
+    T a = V::load(st[0]), b = V::load(st[1]), c = V::load(st[2]), d = V::load(st[3]);
+    T e = V::load(st[4]), f = V::load(st[5]), g = V::load(st[6]), h = V::load(st[7]);
+
+    for (int j = 0; j < 64; j += 16) {
+        for (int i = 0; i < 16; ++i) {
+            if (j > 0) {
+                T w2 = W[(i - 2) & 15], w15 = W[(i - 15) & 15];
+                T s1 = V::xor3(V::template rotr<17>(w2), V::template rotr<19>(w2), V::template shr<10>(w2));
+                T s0 = V::xor3(V::template rotr<7>(w15), V::template rotr<18>(w15), V::template shr<3>(w15));
+                W[i] = V::add(V::add(s1, W[(i - 7) & 15]), V::add(s0, W[i]));
+            }
+            T S1 = V::xor3(V::template rotr<6>(e), V::template rotr<11>(e), V::template rotr<25>(e));
+            T t1 = V::add(V::add(h, S1), V::add(V::ch(e, f, g), V::add(V::set1(K256[j + i]), W[i])));
+            T S0 = V::xor3(V::template rotr<2>(a), V::template rotr<13>(a), V::template rotr<22>(a));
+            T t2 = V::add(S0, V::maj(a, b, c));
+            h = g; g = f; f = e; e = V::add(d, t1);
+            d = c; c = b; b = a; a = V::add(t1, t2);
+        }
+    }
+
+    V::store(st[0], V::add(V::load(st[0]), a));
+    V::store(st[1], V::add(V::load(st[1]), b));
+    V::store(st[2], V::add(V::load(st[2]), c));
+    V::store(st[3], V::add(V::load(st[3]), d));
+    V::store(st[4], V::add(V::load(st[4]), e));
+    V::store(st[5], V::add(V::load(st[5]), f));
+    V::store(st[6], V::add(V::load(st[6]), g));
+    V::store(st[7], V::add(V::load(st[7]), h));
+}
+
+///
+/// Hashes messages V::LANES at a time. A lane whose message ends is refilled
+/// with the next message right away, so lanes stay busy when lengths differ.
+///
+template <class V>
+void hashLanes(ria_tera::Sha256MultiBuffer::Message* msgs, int n) {
+    int const L = V::LANES;
+    struct Lane {
+        int msg;
+        uint64_t block;
+        uint64_t blocks;
+    };
+    Lane lanes[L];
+    alignas(64) uint32_t st[8][L];
+    alignas(64) uint32_t w[16][L];
+    unsigned char blk[64];
+
+    int next = 0;
+    int active = 0;
+    auto start = [&](int l) {
+        if (next >= n) {
+            lanes[l].msg = -1;
+            return;
+        }
+        lanes[l].msg = next;
+        lanes[l].block = 0;
+        lanes[l].blocks = blockCount(msgs[next].len);
+        for (int i = 0; i < 8; ++i) st[i][l] = IV256[i];
+        ++next;
+        ++active;
+    };
+    for (int l = 0; l < L; ++l) start(l);
+
+    while (active > 0) {
+        for (int l = 0; l < L; ++l) {
+            if (lanes[l].msg < 0) {
+                for (int i = 0; i < 16; ++i) w[i][l] = 0;
+                continue;
+            }
+            ria_tera::Sha256MultiBuffer::Message const& m = msgs[lanes[l].msg];
+            unsigned char const* p = m.data + lanes[l].block * 64;
+            if ((lanes[l].block + 1) * 64 > m.len) {
+                paddedBlock(m, lanes[l].block, blk);
+                p = blk;
+            }
+            for (int i = 0; i < 16; ++i) w[i][l] = be32(p + 4 * i);
+        }
+
+        compress<V>(st, w);
+
+        for (int l = 0; l < L; ++l) {
+            if (lanes[l].msg < 0 || ++lanes[l].block < lanes[l].blocks) continue;
+            unsigned char* out = msgs[lanes[l].msg].digest;
+            for (int i = 0; i < 8; ++i) {
+                out[4 * i]     = static_cast<unsigned char>(st[i][l] >> 24);
+                out[4 * i + 1] = static_cast<unsigned char>(st[i][l] >> 16);
+                out[4 * i + 2] = static_cast<unsigned char>(st[i][l] >> 8);
+                out[4 * i + 3] = static_cast<unsigned char>(st[i][l]);
+            }
+            --active;
+            start(l);
+        }
+    }
+}
+
+}
+
+#endif /* SHA256_MB_KERNEL_H_ */
@@ -0,0 +1,84 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "stage_metrics.h"
+
+#include <QtAlgorithms>
+
+namespace ria_tera {
+
+StageMetrics stageMetrics;
+
+LatencyHistogram::LatencyHistogram() : total(0), sum(0), maxValue(0) {
+}
+
+int LatencyHistogram::bucketOf(qint64 us) {
+    quint64 v = quint64(qBound<qint64>(0, us, (Q_INT64_C(1) << MAX_BITS) - 1));
+    if (v < 2 * SUB_COUNT) return int(v);
+    int shift = (63 - qCountLeadingZeroBits(v)) - SUB_BITS;
+    // v >> shift is in [SUB_COUNT, 2 * SUB_COUNT)
+    return shift * SUB_COUNT + int(v >> shift);
+}
+
+qint64 LatencyHistogram::bucketTop(int bucket) {
+    if (bucket < 2 * SUB_COUNT) return bucket;
+    int shift = bucket / SUB_COUNT - 1;
+    qint64 low = qint64(bucket - shift * SUB_COUNT) << shift;
+    return low + (Q_INT64_C(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(qint64 us) {
+    if (us < 0) us = 0;
+    counts[bucketOf(us)].fetchAndAddRelaxed(1);
+    sum.fetchAndAddRelaxed(us);
+    qint64 m = maxValue.loadAcquire();
+    while (us > m && !maxValue.testAndSetRelaxed(m, us, m)) {}
+    total.fetchAndAddRelease(1);
+}
+
+double LatencyHistogram::mean() const {
+    qint64 n = count();
+    return n > 0 ? double(sum.loadAcquire()) / n : 0;
+}
+
+qint64 LatencyHistogram::percentile(double p) const {
+    qint64 n = count();
+    if (n <= 0) return 0;
+    qint64 rank = qMax<qint64>(1, qint64(p / 100.0 * n + 0.5));
+    qint64 seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += counts[i].loadAcquire();
+        if (seen >= rank) return qMin(bucketTop(i), max());
+    }
+    return max();
+}
+
+QString LatencyHistogram::formatUs(qint64 us) {
+    if (us < 1000) return QString("%1 us").arg(us);
+    if (us < 1000 * 1000) return QString::number(us / 1000.0, 'f', 1) + " ms";
+    return QString::number(us / 1000.0 / 1000.0, 'f', 2) + " s";
+}
+
+QString LatencyHistogram::summary() const {
+    return QString("n %1, mean %2, p50 %3, p90 %4, p99 %5, p99.9 %6, max %7").arg(
+                QString::number(count()), formatUs(qint64(mean())), formatUs(percentile(50)), formatUs(percentile(90)),
+                formatUs(percentile(99)), formatUs(percentile(99.9)), formatUs(max()));
+}
+
+}
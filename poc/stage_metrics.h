@@ -0,0 +1,95 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef STAGE_METRICS_H_
+#define STAGE_METRICS_H_
+
+#include <QAtomicInteger>
+#include <QString>
+
+namespace ria_tera {
+
+///
+/// \brief Log-linear histogram of durations in microseconds, in the manner of HdrHistogram.
+///
+/// Every power of two is split into 32 buckets, so percentiles are within ~3%.
+/// record() is lock free and may be called from any thread.
+///
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    void record(qint64 us);
+    qint64 count() const { return total.loadAcquire(); };
+    qint64 max() const { return maxValue.loadAcquire(); };
+    double mean() const;
+    /// Smallest value that p percent of recorded values don't exceed, 0 if empty
+    qint64 percentile(double p) const;
+    /// "n 1234, mean 4.2 ms, p50 3.1 ms, p90 ..., max ..."
+    QString summary() const;
+
+    static QString formatUs(qint64 us);
+private:
+    static int const SUB_BITS = 5;
+    static int const SUB_COUNT = 1 << SUB_BITS;
+    /// values are capped at 2^40 us (12 days)
+    static int const MAX_BITS = 40;
+    static int const BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+    static int bucketOf(qint64 us);
+    /// Largest value that falls into bucket
+    static qint64 bucketTop(int bucket);
+
+    QAtomicInteger<quint32> counts[BUCKETS];
+    QAtomicInteger<qint64> total;
+    QAtomicInteger<qint64> sum;
+    QAtomicInteger<qint64> maxValue;
+};
+
+/// Per stage figures of a run, updated from the I/O queue and network threads and read by MetricsServer
+class StageMetrics {
+public:
+    LatencyHistogram hashUs;
+    /// time server round trip, retries included
+    LatencyHistogram tsaUs;
+    LatencyHistogram writeUs;
+    QAtomicInteger<qint64> hashedBytes;
+    /// content of written containers, before compression
+    QAtomicInteger<qint64> writtenBytes;
+    /// requests posted to time servers and resends among them
+    QAtomicInteger<qint64> tsaRequests;
+    QAtomicInteger<qint64> retries;
+    /// answers other than a time-stamp, timeouts included
+    QAtomicInteger<qint64> tsaErrors;
+
+    /// files found by the search, given to BatchStamper and finished by it
+    QAtomicInteger<qint64> filesFound;
+    QAtomicInteger<qint64> filesTotal;
+    QAtomicInteger<qint64> filesStamped;
+    QAtomicInteger<qint64> filesFailed;
+    /// requests being hashed, sent, waiting for a resend and written to containers
+    QAtomicInteger<qint64> hashQueue;
+    QAtomicInteger<qint64> tsaInFlight;
+    QAtomicInteger<qint64> retryQueue;
+    QAtomicInteger<qint64> writeQueue;
+};
+
+extern StageMetrics stageMetrics;
+
+}
+
+#endif /* STAGE_METRICS_H_ */
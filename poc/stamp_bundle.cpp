@@ -0,0 +1,146 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "stamp_bundle.h"
+
+#include <QDataStream>
+#include <QSaveFile>
+
+namespace {
+
+QByteArray const MAGIC("TERABNDL");
+quint32 const VERSION = 1;
+/// magic + version + count + index offset
+int const HEADER_SIZE = 8 + 4 + 4 + 8;
+
+}
+
+namespace ria_tera {
+
+QByteArray StampBundle::serialize(Entry const& e) {
+    QByteArray res;
+    QDataStream ds(&res, QIODevice::WriteOnly);
+    ds.setVersion(QDataStream::Qt_5_0);
+    ds << e.in << e.out << e.size << e.mtime << e.digest << e.request << e.token;
+    return res;
+}
+
+bool StampBundle::write(QString const& path, QList<Entry> const& entries, QString& error) {
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly)) {
+        error = QString("Couldn't create bundle '%1'").arg(path);
+        return false;
+    }
+
+    QDataStream ds(&f);
+    ds.setVersion(QDataStream::Qt_5_0);
+    ds.writeRawData(MAGIC.constData(), MAGIC.size());
+    ds << VERSION << (quint32)entries.size() << (quint64)0;
+
+    QVector<QPair<quint64, quint32>> idx;
+    idx.reserve(entries.size());
+    quint64 offset = HEADER_SIZE;
+    for (Entry const& e : entries) {
+        QByteArray rec = serialize(e);
+        ds.writeRawData(rec.constData(), rec.size());
+        idx.append(qMakePair(offset, (quint32)rec.size()));
+        offset += rec.size();
+    }
+    for (auto const& i : idx) {
+        ds << i.first << i.second;
+    }
+
+    // index offset is known only now
+    f.seek(8 + 4 + 4);
+    ds << offset;
+    if (QDataStream::Ok != ds.status() || !f.commit()) {
+        error = QString("Couldn't write bundle '%1'").arg(path);
+        return false;
+    }
+    return true;
+}
+
+StampBundle::StampBundle() {}
+
+bool StampBundle::open(QString const& path, QString& error) {
+    index.clear();
+    file.close();
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = QString("Couldn't open bundle '%1'").arg(path);
+        return false;
+    }
+
+    QDataStream ds(&file);
+    ds.setVersion(QDataStream::Qt_5_0);
+    QByteArray magic(MAGIC.size(), 0);
+    ds.readRawData(magic.data(), magic.size());
+    quint32 version = 0, cnt = 0;
+    quint64 indexOffset = 0;
+    ds >> version >> cnt >> indexOffset;
+    if (MAGIC != magic || VERSION != version || QDataStream::Ok != ds.status() ||
+            indexOffset + (quint64)cnt * 12 > (quint64)file.size()) {
+        error = QString("'%1' is not a time-stamp bundle").arg(path);
+        return false;
+    }
+
+    file.seek(indexOffset);
+    index.reserve(cnt);
+    for (quint32 i = 0; i < cnt; ++i) {
+        quint64 off = 0;
+        quint32 len = 0;
+        ds >> off >> len;
+        if (off + len > indexOffset) {
+            error = QString("Bundle '%1' has damaged index").arg(path);
+            index.clear();
+            return false;
+        }
+        index.append(qMakePair(off, len));
+    }
+    return QDataStream::Ok == ds.status();
+}
+
+bool StampBundle::entry(int i, Entry& e, QString& error) {
+    if (i < 0 || i >= index.size() || !file.seek(index[i].first)) {
+        error = QString("No entry %1 in bundle").arg(i);
+        return false;
+    }
+    QByteArray rec = file.read(index[i].second);
+    QDataStream ds(rec);
+    ds.setVersion(QDataStream::Qt_5_0);
+    ds >> e.in >> e.out >> e.size >> e.mtime >> e.digest >> e.request >> e.token;
+    if (QDataStream::Ok != ds.status()) {
+        error = QString("Damaged entry %1 in bundle '%2'").arg(QString::number(i), file.fileName());
+        return false;
+    }
+    return true;
+}
+
+bool StampBundle::readAll(QList<Entry>& entries, QString& error) {
+    entries.clear();
+    entries.reserve(index.size());
+    for (int i = 0; i < index.size(); ++i) {
+        Entry e;
+        if (!entry(i, e, error)) return false;
+        entries.append(e);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,73 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef STAMP_BUNDLE_H_
+#define STAMP_BUNDLE_H_
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+namespace ria_tera {
+
+///
+/// \brief File for carrying time-stamp requests and responses over an air gap.
+///
+/// Layout: header (magic, version, entry count, index offset), records, index.
+/// The index holds offset and length of every record, so entries can be read
+/// one by one without loading the whole bundle. A requests bundle and a
+/// responses bundle have the same layout, the latter has token filled.
+///
+class StampBundle {
+public:
+    class Entry {
+    public:
+        QString in;
+        /// empty - output name is generated on import
+        QString out;
+        qint64 size = 0;
+        /// last modification, ms since epoch; file is not hashed again on import
+        qint64 mtime = 0;
+        QByteArray digest;
+        QByteArray request;
+        /// time-stamp token, empty in a requests bundle or if stamping failed
+        QByteArray token;
+    };
+
+    static bool write(QString const& path, QList<Entry> const& entries, QString& error);
+
+    StampBundle();
+    bool open(QString const& path, QString& error);
+    int count() const { return index.size(); };
+    bool entry(int i, Entry& e, QString& error);
+    /// All entries, stops at first damaged one
+    bool readAll(QList<Entry>& entries, QString& error);
+private:
+    static QByteArray serialize(Entry const& e);
+
+    QFile file;
+    QVector<QPair<quint64, quint32>> index;
+};
+
+}
+
+#endif /* STAMP_BUNDLE_H_ */
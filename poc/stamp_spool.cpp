@@ -0,0 +1,417 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "stamp_spool.h"
+
+#include <algorithm>
+
+#include <QAtomicInt>
+#include <QDataStream>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutex>
+#include <QRunnable>
+#include <QStandardPaths>
+#include <QMap>
+#include <QtEndian>
+#include <QVector>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+#include "io_scheduler.h"
+#include "logging.h"
+#include "openssl_utils.h"
+#include "stage_metrics.h"
+
+namespace {
+
+QByteArray const MAGIC("TERASPOOL1");
+
+bool cutTornTail(QString const& path, qint64 goodSize, QString& error) {
+    TERA_LOG(warn) << "Cutting torn record from the end of " << path;
+    if (!QFile::resize(path, goodSize)) {
+        error = QString("Couldn't repair spool file '%1'").arg(path);
+        return false;
+    }
+    return true;
+}
+
+void fsyncFile(QFile& f) {
+    f.flush();
+#ifdef Q_OS_UNIX
+    ::fsync(f.handle());
+#endif
+}
+
+/// Memory for one batch of small files per hashing thread
+qint64 const BATCH_BYTES = 8 * 1024 * 1024;
+
+class SpoolHashJob : public QRunnable {
+public:
+    SpoolHashJob(QVector<ria_tera::StampSpool::Entry>& e, QVector<int> const& f, ria_tera::Imprint::Algorithm a,
+                 QStringList& err, QMutex& m, QAtomicInt& n) :
+        entries(e), files(f), alg(a), errors(err), mutex(m), next(n), batchBytes(0) {}
+    void run() {
+        int batchFiles = ria_tera::Imprint::smallFileBatch();
+        bool batching = ria_tera::Imprint::batchesSmallFiles(alg);
+
+        for (int k = next.fetchAndAddOrdered(1); k < files.size(); k = next.fetchAndAddOrdered(1)) {
+            int i = files[k];
+            // taken before reading, a later change shows up as a different mtime
+            QFileInfo fi(entries[i].in);
+            qint64 size = fi.size();
+            entries[i].mtime = fi.lastModified().toMSecsSinceEpoch();
+            if (batching && size <= ria_tera::Imprint::SMALL_FILE_BYTES) {
+                batch.append(i);
+                batchSizes.append(size);
+                batchBytes += size;
+                if (batch.size() >= batchFiles || batchBytes >= BATCH_BYTES) hashBatch();
+                continue;
+            }
+            hashFile(i);
+        }
+        hashBatch();
+    }
+private:
+    void hashFile(int i) {
+        ria_tera::StampSpool::Entry& e = entries[i];
+        QString error;
+        QElapsedTimer timer;
+        timer.start();
+        if (!ria_tera::Imprint::hashFile(e.in, alg, e.digest, error)) {
+            e.digest.clear();
+            QMutexLocker lock(&mutex);
+            errors.append(error);
+            return;
+        }
+        e.size = QFileInfo(e.in).size();
+        ria_tera::stageMetrics.hashUs.record(timer.nsecsElapsed() / 1000);
+        ria_tera::stageMetrics.hashedBytes.fetchAndAddRelaxed(e.size);
+        e.request = create_timestamp_request(e.digest);
+    }
+    /// Reads the batch in one go and hashes it in SIMD lanes
+    void hashBatch() {
+        if (batch.isEmpty()) return;
+        QElapsedTimer timer;
+        timer.start();
+        QStringList paths;
+        for (int idx : batch) paths.append(entries[idx].in);
+        QVector<QByteArray> digests;
+        QStringList readErrors;
+        ria_tera::Imprint::hashSmallFiles(paths, batchSizes, digests, readErrors);
+
+        QVector<int> read;
+        QVector<int> unread;
+        for (int j = 0; j < batch.size(); ++j) {
+            if (!readErrors[j].isEmpty()) {
+                unread.append(batch[j]);
+                continue;
+            }
+            ria_tera::StampSpool::Entry& e = entries[batch[j]];
+            e.size = batchSizes[j];
+            e.digest = digests[j];
+            read.append(batch[j]);
+        }
+        // files of a batch are read and hashed together, each gets an equal share of the time
+        qint64 perFileUs = (read.isEmpty() ? 0 : timer.nsecsElapsed() / 1000 / read.size());
+        for (int idx : read) {
+            entries[idx].request = create_timestamp_request(entries[idx].digest);
+            ria_tera::stageMetrics.hashUs.record(perFileUs);
+            ria_tera::stageMetrics.hashedBytes.fetchAndAddRelaxed(entries[idx].size);
+        }
+        // changed or unreadable, the streaming path reports it
+        for (int idx : unread) hashFile(idx);
+        batch.clear();
+        batchSizes.clear();
+        batchBytes = 0;
+    }
+
+    QVector<ria_tera::StampSpool::Entry>& entries;
+    /// indexes in entries of files on one device
+    QVector<int> const& files;
+    ria_tera::Imprint::Algorithm alg;
+    QStringList& errors;
+    QMutex& mutex;
+    QAtomicInt& next;
+    /// small files waiting to be read and hashed together
+    QVector<int> batch;
+    QVector<qint64> batchSizes;
+    qint64 batchBytes;
+};
+
+/// Files of one storage device and next one to take
+struct DeviceQueue {
+    ria_tera::IoScheduler::Device device;
+    QVector<int> files;
+    QAtomicInt next;
+};
+
+}
+
+namespace ria_tera {
+
+StampSpool::StampSpool(QString const& dir) : spoolDir(dir), nextSeq(1), unsynced(0) {}
+
+StampSpool::~StampSpool() {
+    if (data.isOpen()) sync();
+}
+
+QString StampSpool::defaultDir() {
+#if QT_VERSION < QT_VERSION_CHECK(5, 4, 0)
+    return QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/spool";
+#else
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/spool";
+#endif
+}
+
+bool StampSpool::open(QString& error) {
+    if (!QDir().mkpath(spoolDir)) {
+        error = QString("Couldn't create spool directory '%1'").arg(spoolDir);
+        return false;
+    }
+    data.setFileName(QDir(spoolDir).filePath("spool.dat"));
+    done.setFileName(QDir(spoolDir).filePath("done.dat"));
+    if (!load(error)) return false;
+
+    if (!data.open(QIODevice::ReadWrite | QIODevice::Append) || !done.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        error = QString("Couldn't open spool in '%1'").arg(spoolDir);
+        return false;
+    }
+    if (0 == data.size()) {
+        data.write(MAGIC);
+    }
+    return true;
+}
+
+bool StampSpool::load(QString& error) {
+    entries.clear();
+    seqByPath.clear();
+    nextSeq = 1;
+
+    QFile d(data.fileName());
+    if (!d.exists()) return true;
+    if (!d.open(QIODevice::ReadOnly)) {
+        error = QString("Couldn't read spool '%1'").arg(d.fileName());
+        return false;
+    }
+    QByteArray all = d.readAll();
+    if (!all.startsWith(MAGIC)) {
+        error = QString("'%1' is not a spool file").arg(d.fileName());
+        return false;
+    }
+
+    int p = MAGIC.size();
+    while (p + 4 <= all.size()) {
+        quint32 len = qFromBigEndian<quint32>(reinterpret_cast<uchar const*>(all.constData() + p));
+        if (p + 4 + (qint64)len + 2 > all.size()) break; // torn tail
+        QByteArray payload = all.mid(p + 4, len);
+        quint16 crc = qFromBigEndian<quint16>(reinterpret_cast<uchar const*>(all.constData() + p + 4 + len));
+        p += 4 + len + 2;
+        Entry e;
+        if (crc != qChecksum(payload.constData(), payload.size()) || !deserialize(payload, e)) {
+            TERA_LOG(warn) << "Skipping damaged spool record";
+            continue;
+        }
+        entries.insert(e.seq, e);
+        seqByPath.insert(e.in, e.seq);
+        nextSeq = qMax(nextSeq, e.seq + 1);
+    }
+    d.close();
+    // records appended after a torn one would be read as part of it
+    if (p < all.size() && !cutTornTail(d.fileName(), p, error)) return false;
+
+    QFile dn(done.fileName());
+    if (dn.open(QIODevice::ReadOnly)) {
+        QByteArray seqs = dn.readAll();
+        dn.close();
+        if (0 != seqs.size() % 8 && !cutTornTail(dn.fileName(), seqs.size() / 8 * 8, error)) return false;
+        for (int i = 0; i + 8 <= seqs.size(); i += 8) {
+            quint64 seq = qFromBigEndian<quint64>(reinterpret_cast<uchar const*>(seqs.constData() + i));
+            auto it = entries.find(seq);
+            if (entries.end() == it) continue;
+            seqByPath.remove(it.value().in);
+            entries.erase(it);
+        }
+    }
+    return true;
+}
+
+QByteArray StampSpool::serialize(Entry const& e) {
+    QByteArray res;
+    QDataStream ds(&res, QIODevice::WriteOnly);
+    ds.setVersion(QDataStream::Qt_5_0);
+    ds << e.seq << e.in << e.out << e.size << e.digest << e.request << e.mtime;
+    return res;
+}
+
+bool StampSpool::deserialize(QByteArray const& payload, Entry& e) {
+    QDataStream ds(payload);
+    ds.setVersion(QDataStream::Qt_5_0);
+    ds >> e.seq >> e.in >> e.out >> e.size >> e.digest >> e.request;
+    // records of older versions have no mtime, those files are hashed again
+    if (!ds.atEnd()) ds >> e.mtime;
+    return QDataStream::Ok == ds.status();
+}
+
+bool StampSpool::append(Entry& e, QString& error) {
+    e.seq = nextSeq++;
+    QByteArray payload = serialize(e);
+    uchar hdr[4];
+    qToBigEndian<quint32>(payload.size(), hdr);
+    uchar crc[2];
+    qToBigEndian<quint16>(qChecksum(payload.constData(), payload.size()), crc);
+
+    QByteArray rec;
+    rec.reserve(payload.size() + 6);
+    rec.append(reinterpret_cast<char const*>(hdr), 4);
+    rec.append(payload);
+    rec.append(reinterpret_cast<char const*>(crc), 2);
+    if (data.write(rec) != rec.size()) {
+        error = QString("Couldn't write to spool '%1'").arg(data.fileName());
+        return false;
+    }
+    entries.insert(e.seq, e);
+    seqByPath.insert(e.in, e.seq);
+    return true;
+}
+
+bool StampSpool::spoolFiles(QStringList const& files, QMap<QString, QString> const& fixedOut, Imprint::Algorithm alg, QStringList& errors) {
+    QVector<Entry> hashed;
+    hashed.reserve(files.size());
+    for (QString const& f : files) {
+        if (contains(f)) continue;
+        Entry e;
+        e.in = f;
+        e.out = fixedOut.value(f);
+        hashed.append(e);
+    }
+    if (hashed.isEmpty()) return true;
+
+    bool res = hashFiles(hashed, alg, errors);
+    for (Entry& e : hashed) {
+        if (e.digest.isEmpty()) continue;
+        QString error;
+        if (!append(e, error)) {
+            errors.append(error);
+            res = false;
+            break;
+        }
+    }
+    sync();
+    return res;
+}
+
+bool StampSpool::refreshChanged(Imprint::Algorithm alg, QStringList& errors) {
+    QVector<Entry> changed;
+    QStringList gone;
+    for (Entry const& e : qAsConst(entries)) {
+        QFileInfo fi(e.in);
+        if (!fi.exists()) {
+            errors.append(QString("'%1' doesn't exist any more, removed from spool").arg(e.in));
+            gone.append(e.in);
+        } else if (fi.size() != e.size || fi.lastModified().toMSecsSinceEpoch() != e.mtime) {
+            Entry c;
+            c.in = e.in;
+            c.out = e.out;
+            changed.append(c);
+        }
+    }
+    for (QString const& in : gone) markDone(in);
+    if (changed.isEmpty()) {
+        sync();
+        return gone.isEmpty();
+    }
+
+    TERA_LOG(info) << QString::number(changed.size()) << " files have changed since they were spooled, hashing them again";
+    bool res = hashFiles(changed, alg, errors) && gone.isEmpty();
+    for (Entry& e : changed) {
+        markDone(e.in);
+        if (e.digest.isEmpty()) continue; // unreadable, in errors
+        QString error;
+        if (!append(e, error)) {
+            errors.append(error);
+            res = false;
+            break;
+        }
+    }
+    sync();
+    return res;
+}
+
+bool StampSpool::hashFiles(QVector<Entry>& entries, Imprint::Algorithm alg, QStringList& errors) {
+    // devices are hashed in parallel, each with as many workers as it handles well
+    QMap<quint64, DeviceQueue> queues;
+    for (int i = 0; i < entries.size(); ++i) {
+        IoScheduler::Device d = IoScheduler::device(entries[i].in);
+        DeviceQueue& q = queues[d.id];
+        q.device = d;
+        q.files.append(i);
+    }
+    IoScheduler io;
+    QMutex mutex;
+    int errCnt = errors.size();
+    for (DeviceQueue& q : queues) {
+        int workers = qMin(IoScheduler::concurrency(q.device), q.files.size());
+        for (int w = 0; w < workers; ++w) {
+            io.start(new SpoolHashJob(entries, q.files, alg, errors, mutex, q.next), q.device);
+        }
+    }
+    io.waitForDone();
+    return errors.size() == errCnt;
+}
+
+void StampSpool::markDone(QString const& in) {
+    auto it = seqByPath.find(in);
+    if (seqByPath.end() == it) return;
+    uchar buf[8];
+    qToBigEndian<quint64>(it.value(), buf);
+    done.write(reinterpret_cast<char const*>(buf), 8);
+    entries.remove(it.value());
+    seqByPath.erase(it);
+    if (++unsynced >= 64) sync();
+    else done.flush();
+}
+
+void StampSpool::sync() {
+    if (data.isOpen()) fsyncFile(data);
+    if (done.isOpen()) fsyncFile(done);
+    unsynced = 0;
+}
+
+QList<StampSpool::Entry> StampSpool::pending() const {
+    QList<Entry> res = entries.values();
+    std::sort(res.begin(), res.end(), [](Entry const& a, Entry const& b) {
+        if (a.size != b.size) return a.size > b.size;
+        return a.seq < b.seq;
+    });
+    return res;
+}
+
+void StampSpool::compact() {
+    if (!entries.isEmpty()) return;
+    data.close();
+    done.close();
+    QFile::remove(data.fileName());
+    QFile::remove(done.fileName());
+}
+
+}
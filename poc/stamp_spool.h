@@ -0,0 +1,101 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef STAMP_SPOOL_H_
+#define STAMP_SPOOL_H_
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "imprint.h"
+
+namespace ria_tera {
+
+///
+/// \brief Durable on-disk queue of hashed files waiting for time server.
+///
+/// Files are hashed and their time-stamp requests are appended to spool.dat,
+/// so the work survives network outages and restarts. Sent files are recorded
+/// in done.dat by sequence number. Both files are append-only; a torn record at
+/// the end (crash while writing) is cut off on load.
+///
+class StampSpool {
+public:
+    class Entry {
+    public:
+        quint64 seq = 0;
+        QString in;
+        /// empty - output name is generated when sent
+        QString out;
+        qint64 size = 0;
+        /// modification time in ms when hashed, 0 if unknown
+        qint64 mtime = 0;
+        QByteArray digest;
+        QByteArray request;
+    };
+
+    explicit StampSpool(QString const& dir = defaultDir());
+    ~StampSpool();
+    static QString defaultDir();
+    QString dir() const { return spoolDir; };
+
+    bool open(QString& error);
+    /// Hashes files in parallel and appends them, files already in spool are skipped
+    bool spoolFiles(QStringList const& files, QMap<QString, QString> const& fixedOut, Imprint::Algorithm alg, QStringList& errors);
+    bool append(Entry& e, QString& error);
+    /// Hashes pending files again if they changed since spooling, so the request matches
+    /// the content put in the container. Files that are gone or unreadable are dropped.
+    bool refreshChanged(Imprint::Algorithm alg, QStringList& errors);
+    /// Fills digest, size, mtime and request of entries with in set, on all cores.
+    /// Entries that couldn't be read are left with empty digest.
+    static bool hashFiles(QVector<Entry>& entries, Imprint::Algorithm alg, QStringList& errors);
+    void markDone(QString const& in);
+    /// fsync both files
+    void sync();
+
+    bool contains(QString const& in) const { return seqByPath.contains(in); };
+    int pendingCount() const { return entries.size(); };
+    /// Pending entries in sending order, largest files first so
+    /// the long container writes don't end up in the tail of the run
+    QList<Entry> pending() const;
+    /// Removes spool files if nothing is pending
+    void compact();
+private:
+    bool load(QString& error);
+    static QByteArray serialize(Entry const& e);
+    static bool deserialize(QByteArray const& payload, Entry& e);
+
+    QString spoolDir;
+    QFile data;
+    QFile done;
+    QHash<quint64, Entry> entries;
+    QHash<QString, quint64> seqByPath;
+    quint64 nextSeq;
+    int unsynced;
+};
+
+}
+
+#endif /* STAMP_SPOOL_H_ */
@@ -34,6 +34,8 @@
 
 #include "utils.h"
 #include "config.h"
+#include "resume_journal.h"
+#include "stamp_spool.h"
 
 namespace {
 
@@ -49,6 +51,22 @@ QString const ext_out_param("ext_out");
 QString const excl_dir_param("excl_dir");
 QString const no_ini_excl_dirs_param("no_ini_excl_dirs");
 QString const ts_url_param("ts_url");
+QString const ts_max_requests_param("ts_max_requests");
+QString const hash_algorithm_param("hash_algorithm");
+QString const page_cache_param("page_cache");
+QString const io_order_param("io_order");
+QString const resume_param("resume");
+QString const journal_param("journal");
+QString const spool_param("spool");
+QString const flush_spool_param("flush_spool");
+QString const spool_dir_param("spool_dir");
+QString const export_requests_param("export_requests");
+QString const submit_requests_param("submit_requests");
+QString const responses_param("responses");
+QString const import_responses_param("import_responses");
+QString const trace_file_param("trace_file");
+QString const report_param("report");
+QString const metrics_listen_param("metrics_listen");
 QString const log_level_param("log_level");
 QString const logfile_level_param("logfile_level");
 QString const logfile_dir_param("logfile_dir");
@@ -123,8 +141,67 @@ int main(int argc, char *argv[]) {
     QString parTSDefault = (config.getTimeServerURL().isEmpty() ? "ex. http://demo.sk.ee/tsa" : QString("(default %1)").arg(config.getTimeServerURL())); // TODO
     parser.addOption(
             QCommandLineOption(ts_url_param,
-                    QString("time server url %1").arg(parTSDefault),
+                    QString("time server url %1; can be repeated, requests are spread over healthy time servers").arg(parTSDefault),
                     ts_url_param));
+    parser.addOption(
+            QCommandLineOption(ts_max_requests_param,
+                    "maximum number of parallel time server requests, actual number is adapted to time server's latency and errors (default from config file)",
+                    ts_max_requests_param));
+    parser.addOption(
+            QCommandLineOption(hash_algorithm_param,
+                    "hash algorithm of time-stamp requests: " + ria_tera::Imprint::names().join(", ") + " or " +
+                    ria_tera::Config::HASH_ALGORITHM_AUTO +  " for the fastest one on this machine that time server accepts (default from config file)",
+                    hash_algorithm_param));
+    parser.addOption(
+            QCommandLineOption(page_cache_param,
+                    "how input files use the OS page cache: " + ria_tera::PageCache::names().join(", ") +
+                    "; dontneed and direct keep large runs from evicting other programs' data (default from config file)",
+                    page_cache_param));
+    parser.addOption(
+            QCommandLineOption(io_order_param,
+                    "order of files on spinning disks: " + ria_tera::PhysicalOrder::names().join(", ") +
+                    "; inode and extent (physical location) give near sequential reads (default from config file)",
+                    io_order_param));
+    parser.addOption(
+            QCommandLineOption(resume_param,
+                    "time-stamp files left over by a previous run that ran out of time server quota; can't be used with --" +
+                        file_in_param + " or --" + dir_in_param));
+    parser.addOption(
+            QCommandLineOption(journal_param,
+                    "resume journal file (default " + ria_tera::ResumeJournal::defaultPath() + ")", journal_param));
+    parser.addOption(
+            QCommandLineOption(spool_param,
+                    "hash input files into spool first and send time-stamp requests from there; requests not sent stay in spool"));
+    parser.addOption(
+            QCommandLineOption(QStringList() << flush_spool_param << "flush-spool",
+                    "send time-stamp requests left in spool and create their containers; can't be used with --" +
+                        file_in_param + " or --" + dir_in_param));
+    parser.addOption(
+            QCommandLineOption(spool_dir_param,
+                    "spool directory (default " + ria_tera::StampSpool::defaultDir() + ")", spool_dir_param));
+    parser.addOption(
+            QCommandLineOption(export_requests_param,
+                    "hash input files and write time-stamp requests to a bundle file, no network is used", export_requests_param));
+    parser.addOption(
+            QCommandLineOption(submit_requests_param,
+                    "send time-stamp requests from a bundle file and write time-stamps to --" + responses_param, submit_requests_param));
+    parser.addOption(
+            QCommandLineOption(responses_param,
+                    "responses bundle file written by --" + submit_requests_param, responses_param));
+    parser.addOption(
+            QCommandLineOption(import_responses_param,
+                    "create containers from a responses bundle file, files are not hashed again", import_responses_param));
+    parser.addOption(
+            QCommandLineOption(trace_file_param,
+                    "write timing of processing stages of every file to a Chrome trace-event file "
+                    "(open in chrome://tracing or Perfetto)", trace_file_param));
+    parser.addOption(
+            QCommandLineOption(report_param,
+                    "write latency histograms and throughput of the run to a JSON file", report_param));
+    parser.addOption(
+            QCommandLineOption(metrics_listen_param,
+                    "serve Prometheus metrics of the run over HTTP on a localhost port, host:port or UNIX socket path",
+                    metrics_listen_param));
     parser.addOption(
             QCommandLineOption(ext_out_param,
                     "extension for output file (default '" + ria_tera::Config::DEFAULT_OUT_EXTENSION + "')", ext_out_param));
@@ -190,12 +267,105 @@ int main(int argc, char *argv[]) {
         parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
     }
 
-    if (!parser.isSet(file_in_param) && !parser.isSet(dir_in_param)) {
+    bool resume = parser.isSet(resume_param);
+    if (resume && (parser.isSet(file_in_param) || parser.isSet(dir_in_param))) {
+        std::cout << "<" << QSTR_TO_CCHAR(resume_param) << "> can't be used together with <"
+                << QSTR_TO_CCHAR(file_in_param) << "> or <" << QSTR_TO_CCHAR(dir_in_param) << ">." << std::endl;
+        parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
+    }
+
+    bool submit_requests = parser.isSet(submit_requests_param);
+    bool import_responses = parser.isSet(import_responses_param);
+    if ((submit_requests || import_responses) && (parser.isSet(file_in_param) || parser.isSet(dir_in_param) || resume)) {
+        std::cout << "<" << QSTR_TO_CCHAR(submit_requests_param) << "> and <" << QSTR_TO_CCHAR(import_responses_param)
+                << "> can't be used together with <" << QSTR_TO_CCHAR(file_in_param) << ">, <"
+                << QSTR_TO_CCHAR(dir_in_param) << "> or <" << QSTR_TO_CCHAR(resume_param) << ">." << std::endl;
+        parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
+    }
+    if (submit_requests && import_responses) {
+        std::cout << "<" << QSTR_TO_CCHAR(submit_requests_param) << "> and <"
+                << QSTR_TO_CCHAR(import_responses_param) << "> can't be both set." << std::endl;
+        parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
+    }
+    if (submit_requests != parser.isSet(responses_param)) {
+        std::cout << "<" << QSTR_TO_CCHAR(submit_requests_param) << "> and <"
+                << QSTR_TO_CCHAR(responses_param) << "> have to be set together." << std::endl;
+        parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
+    }
+    if (parser.isSet(export_requests_param) && (resume || parser.isSet(spool_param) || parser.isSet(flush_spool_param))) {
+        std::cout << "<" << QSTR_TO_CCHAR(export_requests_param) << "> can't be used together with <"
+                << QSTR_TO_CCHAR(resume_param) << "> or spool options." << std::endl;
+        parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
+    }
+
+    QString hash_algorithm;
+    if (parser.isSet(hash_algorithm_param)) {
+        hash_algorithm = parser.value(hash_algorithm_param).trimmed().toLower();
+        ria_tera::Imprint::Algorithm alg;
+        if (ria_tera::Config::HASH_ALGORITHM_AUTO != hash_algorithm && !ria_tera::Imprint::fromName(hash_algorithm, alg)) {
+            std::cout << "Illegal '" << QSTR_TO_CCHAR(hash_algorithm_param) << "' value '" << QSTR_TO_CCHAR(hash_algorithm)
+                    << "' (allowed values: " << QSTR_TO_CCHAR(ria_tera::Imprint::names().join(", ")) << ", "
+                    << QSTR_TO_CCHAR(ria_tera::Config::HASH_ALGORITHM_AUTO) << ")" << std::endl;
+            parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
+        }
+    }
+
+    QString page_cache;
+    if (parser.isSet(page_cache_param)) {
+        page_cache = parser.value(page_cache_param).trimmed().toLower();
+        ria_tera::PageCache::Mode mode;
+        if (!ria_tera::PageCache::fromName(page_cache, mode)) {
+            std::cout << "Illegal '" << QSTR_TO_CCHAR(page_cache_param) << "' value '" << QSTR_TO_CCHAR(page_cache)
+                    << "' (allowed values: " << QSTR_TO_CCHAR(ria_tera::PageCache::names().join(", ")) << ")" << std::endl;
+            parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
+        }
+    }
+
+    QString io_order;
+    if (parser.isSet(io_order_param)) {
+        io_order = parser.value(io_order_param).trimmed().toLower();
+        ria_tera::PhysicalOrder::Mode order;
+        if (!ria_tera::PhysicalOrder::fromName(io_order, order)) {
+            std::cout << "Illegal '" << QSTR_TO_CCHAR(io_order_param) << "' value '" << QSTR_TO_CCHAR(io_order)
+                    << "' (allowed values: " << QSTR_TO_CCHAR(ria_tera::PhysicalOrder::names().join(", ")) << ")" << std::endl;
+            parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
+        }
+    }
+
+    bool flush_spool = parser.isSet(flush_spool_param);
+    bool spool = parser.isSet(spool_param);
+    if (flush_spool && (parser.isSet(file_in_param) || parser.isSet(dir_in_param) || resume || spool)) {
+        std::cout << "<" << QSTR_TO_CCHAR(flush_spool_param) << "> can't be used together with <"
+                << QSTR_TO_CCHAR(file_in_param) << ">, <" << QSTR_TO_CCHAR(dir_in_param) << ">, <"
+                << QSTR_TO_CCHAR(resume_param) << "> or <" << QSTR_TO_CCHAR(spool_param) << ">." << std::endl;
+        parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
+    }
+    if (spool && resume) {
+        std::cout << "<" << QSTR_TO_CCHAR(spool_param) << "> and <"
+                << QSTR_TO_CCHAR(resume_param) << "> can't be both set." << std::endl;
+        parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
+    }
+    QString spool_dir = ria_tera::StampSpool::defaultDir();
+    if (parser.isSet(spool_dir_param)) {
+        spool_dir = parser.value(spool_dir_param);
+    }
+
+    if (!resume && !flush_spool && !submit_requests && !import_responses &&
+            !parser.isSet(file_in_param) && !parser.isSet(dir_in_param)) {
         std::cout << "<" << QSTR_TO_CCHAR(file_in_param) << "> or <"
                 << QSTR_TO_CCHAR(dir_in_param) << "> has to be set." << std::endl;
         parser.showHelp(EXIT_CODE_WRONG_ARGUMENTS);
     }
 
+    QString journal_path = ria_tera::ResumeJournal::defaultPath();
+    if (parser.isSet(journal_param)) {
+        journal_path = parser.value(journal_param);
+    }
+    if (resume && !ria_tera::ResumeJournal(journal_path).exists()) {
+        std::cout << "Resume journal '" << QSTR_TO_CCHAR(journal_path) << "' does not exist." << std::endl;
+        return EXIT_CODE_WRONG_ARGUMENTS;
+    }
+
     if (!in_file.isEmpty() && !QFileInfo(in_file).exists()) {
         std::cout << "Input file '" << QSTR_TO_CCHAR(in_file) << "' does not exist." << std::endl;
         return EXIT_CODE_WRONG_ARGUMENTS;
@@ -248,6 +418,7 @@ int main(int argc, char *argv[]) {
     }
 
     if (!ria_tera::logger.addFileLog(file_log_lvl, logfile_dir)) {
+        ria_tera::logger.flush();
         std::cout << QString("Add '--%1 %2' to disable logging to a file or use '--%3 <path>' to set directory for logfile.").
             arg(logfile_level_param,
                 log_level_to_string(ria_tera::log_level::none),
@@ -280,19 +451,33 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    QString time_server_url;
+    QStringList time_server_urls;
     if (parser.isSet(ts_url_param)) {
-        time_server_url = parser.value(ts_url_param);
+        time_server_urls = parser.values(ts_url_param);
     } else {
-        time_server_url = config.getTimeServerURL();
+        time_server_urls = config.getTimeServerURLs();
+    }
+    for (int i = 0; i < time_server_urls.size(); ++i) {
+        time_server_urls[i] = time_server_urls[i].trimmed();
     }
-    time_server_url = time_server_url.trimmed();
+    time_server_urls.removeAll(QString());
 
-    if (time_server_url.isEmpty()) {
+    bool offline = parser.isSet(export_requests_param) || import_responses;
+    if (time_server_urls.isEmpty() && !offline) {
         std::cerr << "Time server url not set" << std::endl;
         return EXIT_CODE_WRONG_ARGUMENTS;
     }
 
+    int ts_max_requests = 0;
+    if (parser.isSet(ts_max_requests_param)) {
+        bool ok = false;
+        ts_max_requests = parser.value(ts_max_requests_param).toInt(&ok);
+        if (!ok || ts_max_requests < 1) {
+            std::cout << "Illegal '" << QSTR_TO_CCHAR(ts_max_requests_param) << "' value '" << QSTR_TO_CCHAR(parser.value(ts_max_requests_param)) << "'" << std::endl;
+            return EXIT_CODE_WRONG_ARGUMENTS;
+        }
+    }
+
     QSet<QString> excl_dirs_set;
 
     QStringList ex= parser.values(excl_dir_param);
@@ -314,7 +499,9 @@ int main(int argc, char *argv[]) {
             TERA_COUT("Parameter - input-directory (non-recursive): " << QSTR_TO_CCHAR(in_dir));
         }
     }
-    TERA_COUT("Parameter - time-server url: " << QSTR_TO_CCHAR(time_server_url));
+    for (QString const& url : time_server_urls) {
+        TERA_COUT("Parameter - time-server url: " << QSTR_TO_CCHAR(url));
+    }
 
     if (!file_out.isEmpty()) {
         TERA_COUT("Parameter - Output file: " << file_out.toUtf8().constData());
@@ -341,9 +528,25 @@ int main(int argc, char *argv[]) {
     ioparams.in_dir_recursive = in_dir_recursive;
     ioparams.in_extensions    = extensions;
     ioparams.file_out         = file_out;
+    ioparams.ts_max_requests  = ts_max_requests;
+    ioparams.hash_algorithm   = hash_algorithm;
+    ioparams.page_cache       = page_cache;
+    ioparams.io_order         = io_order;
+    ioparams.resume           = resume;
+    ioparams.journal          = journal_path;
+    ioparams.spool            = spool;
+    ioparams.flush_spool      = flush_spool;
+    ioparams.spool_dir        = spool_dir;
+    ioparams.export_requests  = parser.value(export_requests_param);
+    ioparams.submit_requests  = parser.value(submit_requests_param);
+    ioparams.responses_out    = parser.value(responses_param);
+    ioparams.import_responses = parser.value(import_responses_param);
+    ioparams.trace_file       = parser.value(trace_file_param);
+    ioparams.report           = parser.value(report_param);
+    ioparams.metrics_listen   = parser.value(metrics_listen_param);
 
     ria_tera::TeRaMonitor monitor;
-    monitor.kickstart(time_server_url, ioparams);
+    monitor.kickstart(time_server_urls, ioparams);
 
     return a.exec();
 }
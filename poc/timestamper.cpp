@@ -19,6 +19,8 @@
 
 // TODO ll
 #include "timestamper.h"
+#include "stage_metrics.h"
+#include "trace.h"
 
 #include <iostream>
 
@@ -28,7 +30,6 @@
 #include <QCryptographicHash>
 #include <QCoreApplication>
 #include <QNetworkReply>
-#include <QThreadPool>
 #include <QTimer>
 
 #include <zip.h>
@@ -50,22 +51,113 @@
 #endif
 #endif
 
+#include "config.h"
 #include "logging.h"
 #include "openssl_utils.h"
+#include "page_cache.h"
+
+namespace {
+
+/// mimetype, manifest, time-stamp token and zip headers
+qint64 const CONTAINER_OVERHEAD_BYTES = 8 * 1024;
+
+}
 
 namespace ria_tera {
 
-TeraCreateAsicsJob::TeraCreateAsicsJob(qint64 id, QString const& out, QString const& in, QByteArray const& ts)
-    : jobId(id), outpath(out), infile(in), timestamp(ts)
+TeraCreateAsicsJob::TeraCreateAsicsJob(qint64 id, QString const& out, QString const& in, QByteArray const& ts, qint64 fileId)
+    : jobId(id), fileId(fileId), outpath(out), infile(in), inputBytes(0), storedBytes(0), timestamp(ts)
 {
 }
 
 void TeraCreateAsicsJob::run() {
     QString errorStr;
-    bool res = createAsicsContainer(errorStr);
+    bool res;
+    QElapsedTimer timer;
+    timer.start();
+    {
+        Trace::Span span("container", "io", fileId);
+        res = createAsicsContainer(errorStr);
+    }
+    if (res) {
+        stageMetrics.writeUs.record(timer.nsecsElapsed() / 1000);
+        stageMetrics.writtenBytes.fetchAndAddRelaxed(storedBytes);
+    }
     emit finished(jobId, res, errorStr);
 }
 
+TeraHashJob::TeraHashJob(qint64 id, QString const& in, Imprint::Algorithm alg, qint64 fileId)
+    : jobId(id), fileId(fileId), infile(in), imprint(alg)
+{
+}
+
+void TeraHashJob::run() {
+    QByteArray digest;
+    QString error;
+    qint64 bytes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    {
+        Trace::Span span("hash", "io", fileId);
+        if (!Imprint::hashFile(infile, imprint, digest, error, &bytes)) digest.clear();
+    }
+    if (!digest.isEmpty()) {
+        stageMetrics.hashUs.record(timer.nsecsElapsed() / 1000);
+        stageMetrics.hashedBytes.fetchAndAddRelaxed(bytes);
+    }
+    emit finished(jobId, digest, error);
+}
+
+TeraHashBatchJob::TeraHashBatchJob(QVector<qint64> const& ids, QStringList const& in) : jobIds(ids), infiles(in)
+{
+}
+
+void TeraHashBatchJob::run() {
+    QVector<qint64> ids;
+    QStringList paths;
+    QVector<qint64> sizes;
+    for (int i = 0; i < infiles.size(); ++i) {
+        QFileInfo fi(infiles[i]);
+        if (!fi.isFile() || fi.size() > Imprint::SMALL_FILE_BYTES) {
+            emit streamNeeded(jobIds[i]);
+            continue;
+        }
+        ids.append(jobIds[i]);
+        paths.append(infiles[i]);
+        sizes.append(fi.size());
+    }
+    if (ids.isEmpty()) return;
+
+    QVector<QByteArray> digests;
+    QStringList errors;
+    QElapsedTimer timer;
+    timer.start();
+    {
+        Trace::Span span("hash_batch", "io");
+        Imprint::hashSmallFiles(paths, sizes, digests, errors);
+    }
+    // files of a batch are read and hashed together, each gets an equal share of the time
+    qint64 perFileUs = timer.nsecsElapsed() / 1000 / ids.size();
+    for (int i = 0; i < ids.size(); ++i) {
+        if (digests[i].isEmpty()) {
+            // changed or unreadable, the streaming path reports it
+            emit streamNeeded(ids[i]);
+            continue;
+        }
+        stageMetrics.hashUs.record(perFileUs);
+        stageMetrics.hashedBytes.fetchAndAddRelaxed(sizes[i]);
+        emit finished(ids[i], digests[i], QString());
+    }
+}
+
+qint64 TeraCreateAsicsJob::estimateSize(QString const& in, qint64 inSize) {
+    // input is deflated (libzip default): DDOC is XML around base64 data and
+    // base64 doesn't shrink below 3/4; other containers are zip files already
+    static QString const ddoc = "." + Config::EXTENSION_DDOC;
+    qint64 content = (in.endsWith(ddoc, Qt::CaseInsensitive) ? inSize * 4 / 5 : inSize);
+    return content + CONTAINER_OVERHEAD_BYTES;
+}
+
 bool TeraCreateAsicsJob::createAsicsContainer(QString& errorStr) {
     int error = 0;
 
@@ -92,6 +184,10 @@ bool TeraCreateAsicsJob::createAsicsContainer(QString& errorStr) {
 #endif
             return false;
         }
+        // libzip read the input and wrote the container through the page cache
+        PageCache::countRead(inputBytes);
+        PageCache::dropFile(infile, false);
+        PageCache::dropFile(outpath, true);
     } else {
         errorStr = QString("Error while creating '%1': %2").arg(outpath, errorStr);
 #ifndef OLD_LIBZIP_NO_ZIP_DISCARD
@@ -108,10 +204,12 @@ bool TeraCreateAsicsJob::createAsicsContainer(QString& errorStr) {
 
 bool TeraCreateAsicsJob::fillTmpAsicsContainer(zip* zip, QByteArray const& mimeCont, QString& errorStr) {
     int error = 0;
+    storedBytes = mimeCont.size() + timestamp.size();
 
     if (!addFile(zip, "mimetype", mimeCont, errorStr)) return false;
 
     if (!insertInputFile(zip, infile, errorStr)) return false;
+    storedBytes += inputBytes;
 
     QString metaDirName = "META-INF";
     if (zip_dir_add(zip, metaDirName.toUtf8().constData(), ZIP_FL_ENC_UTF_8) < 0) {
@@ -132,6 +230,10 @@ bool TeraCreateAsicsJob::insertInputFile(zip_t* zip, QString const& path, QStrin
         errorStr = QString("could not add '%1' to ddoc - failed to create source file. %2").arg(path, zip_strerror(zip));
         return false;
     }
+    // libzip stat'ed the file when creating the source
+    struct zip_stat st;
+    zip_stat_init(&st);
+    if (0 == zip_source_stat(source, &st) && (st.valid & ZIP_STAT_SIZE)) inputBytes = static_cast<qint64>(st.size);
 
     QFileInfo fileinfo(path);
     int index = (int)zip_file_add(zip, fileinfo.fileName().toUtf8().constData(), source, ZIP_FL_OVERWRITE | ZIP_FL_ENC_UTF_8);
@@ -163,7 +265,7 @@ bool TeraCreateAsicsJob::addFile(zip_t* zip, QString const& name, QByteArray con
 }
 
 
-TimeStamper::TimeStamper() : jobId(0), sslConf(nullptr)
+TimeStamper::TimeStamper() : requestTimeout(30*1000), imprint(Imprint::DEFAULT), tokens(TOKEN_CACHE_BYTES)
 {
     QObject::connect(&nam, SIGNAL(finished(QNetworkReply*)), this, SLOT(tsReplyFinished(QNetworkReply*)));
     QObject::connect(&nam, &QNetworkAccessManager::sslErrors, this, [=](QNetworkReply *reply, const QList<QSslError> &errors){
@@ -174,12 +276,14 @@ TimeStamper::TimeStamper() : jobId(0), sslConf(nullptr)
             switch (error.error())
             {
             case QSslError::UnableToGetLocalIssuerCertificate:
-            case QSslError::CertificateUntrusted:
+            case QSslError::CertificateUntrusted: {
+                TimeStamperRequestConfigurationFactory* sslConf = configuratorFor(reply);
                 if (nullptr != sslConf && sslConf->isTrusted(reply->sslConfiguration().peerCertificate())) {
                     noissue = true;
-                ignore << error;
+                    ignore << error;
                 }
                 break;
+            }
             default: break;
             }
             if (!noissue) {
@@ -190,105 +294,237 @@ TimeStamper::TimeStamper() : jobId(0), sslConf(nullptr)
     });
 }
 
-static bool calculateSha256(QString const& filePath, QByteArray& sha256, QString& error) {
-    QCryptographicHash hashCalculator(QCryptographicHash::Sha256);
-
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly)) {
-        error.clear();
-        error.push_back("Couldn't open file '");
-        error.push_back(filePath);
-        error.push_back("'");
-        return false;
-    }
-
-    bool res = hashCalculator.addData(&file);
-    if (!res) {
-        error.clear();
-        error.push_back("Couldn't read file '");
-        error.push_back(filePath);
-        error.push_back("'");
-    }
-    file.close();
+QByteArray TimeStamper::getTimestampRequest4Sha256(QByteArray& sha256) { // TODO redesign
+    return create_timestamp_request(sha256);
+}
 
-    sha256 = hashCalculator.result();
-    return res;
+void TimeStamper::sendTestRequest(QByteArray const& timestampRequest) {
+    Request r;
+    r.test = true;
+    r.request = timestampRequest;
+    post(r);
 }
 
-bool TimeStamper::getTimestampRequest(QByteArray& tsrequest, QString& error) {
-    QByteArray sha256;
-    if (!calculateSha256(inputFilePath, sha256, error)) return false;
-    tsrequest = create_timestamp_request(sha256);
-    return true;
+void TimeStamper::sendProbe() {
+    Request r;
+    r.test = true;
+    r.probe = true;
+    QByteArray digest = QCryptographicHash::hash(QByteArray(), Imprint::qtAlgorithm(imprint));
+    r.request = create_timestamp_request(digest);
+    post(r);
 }
 
-QByteArray TimeStamper::getTimestampRequest4Sha256(QByteArray& sha256) { // TODO redesign
-    return create_timestamp_request(sha256);
+TimeStamperRequestConfigurationFactory* TimeStamper::configuratorFor(QNetworkReply* reply) const {
+    auto it = pending.find(reply);
+    if (pending.end() == it || it.value().endpoint < 0) return nullptr;
+    return endpoints.at(it.value().endpoint).configurator;
 }
 
-void TimeStamper::sendTSRequest(QByteArray const& timestampRequest, bool test, int retries)
+void TimeStamper::post(Request r)
 {
-    TERA_LOG(debug) << "Connecting to time-server: " << timeserverUrl.toUtf8().constData();
-    TERA_LOG(trace) << "Request (in Hex):\n" << timestampRequest.toHex().constData();
+    if (0 == endpoints.size()) {
+        finishFailed(r, "Time server url not set");
+        return;
+    }
+    if (r.test) {
+        r.endpoint = endpoints.pick();
+    } else {
+        // quota is taken only for requests that go out, not for deduplicated or failed files
+        TsaQuota::Grant grant = TsaQuota::GRANTED;
+        qint64 waitMs = 0;
+        r.endpoint = endpoints.acquireQuota(grant, waitMs);
+        if (TsaQuota::EXHAUSTED == grant) {
+            finishFailed(r, tr("The number of queries for time-stamps has been reached."), TS_FINISH_DETAILS::QUOTA_EXCEEDED);
+            return;
+        } else if (TsaQuota::WAIT == grant) {
+            postLater(r, waitMs);
+            return;
+        }
+    }
+    TsaEndpointPool::Endpoint const& ep = endpoints.at(r.endpoint);
+    TERA_LOG(debug) << "Connecting to time-server: " << ep.url.toUtf8().constData();
+    TERA_LOG(trace) << "Request (in Hex):\n" << r.request.toHex().constData();
 
-    QUrl url(timeserverUrl);
+    QUrl url(ep.url);
     QNetworkRequest request;
     request.setUrl(url);
     request.setRawHeader(QByteArray("Content-Type"), QByteArray("application/timestamp-query"));
 
-    if (nullptr != sslConf) {
-        sslConf->configureRequest(request);
+    if (nullptr != ep.configurator) {
+        ep.configurator->configureRequest(request);
     }
 
-    if (retries > 0) retriesLeft = retries;
-    else retriesLeft = 0;
+    r.sent.start();
+    r.traceSent = (Trace::enabled() ? Trace::now() : -1);
+    r.traceTls = r.traceFirstByte = -1;
+    QNetworkReply* reply = nam.post(request, r.request);
+    pending.insert(reply, r);
+    if (r.traceSent >= 0) {
+        // QNetworkAccessManager doesn't tell when TCP connection is up, so connect time is part of TLS span
+        QObject::connect(reply, &QNetworkReply::encrypted, this, [this, reply]{
+            auto it = pending.find(reply);
+            if (pending.end() != it) it->traceTls = Trace::now();
+        });
+        QObject::connect(reply, &QNetworkReply::metaDataChanged, this, [this, reply]{
+            auto it = pending.find(reply);
+            if (pending.end() != it && it->traceFirstByte < 0) it->traceFirstByte = Trace::now();
+        });
+    }
+    // breaker probes are not charged against the quota
+    endpoints.onSent(r.endpoint, !r.probe);
+    stageMetrics.tsaRequests.fetchAndAddRelaxed(1);
+    publishDepths();
+
+    if (requestTimeout > 0) {
+        QTimer::singleShot(requestTimeout, reply, [reply]{
+            if (reply->isRunning()) {
+                reply->setProperty("teraTimedOut", true);
+                reply->abort();
+            }
+        });
+    }
+}
 
-    QNetworkReply* r = nam.post(request, timestampRequest);
-    lastPostPtr = r;
-    if (!test) {
-        lastRequest = timestampRequest;
-    } else {
-        lastRequest = QByteArray();
+void TimeStamper::scheduleRetry(Request r) {
+    int attempt = MAX_RETRIES - r.retriesLeft + 1;
+    r.retriesLeft--;
+    stageMetrics.retries.fetchAndAddRelaxed(1);
+    postLater(r, TsaCircuitBreaker::backoff(RETRY_DELAY_MS, attempt, 30 * 1000, 0.5));
+}
+
+void TimeStamper::postLater(Request const& r, qint64 delayMs) {
+    qint64 id = r.id;
+    delayed.insert(id, r);
+    publishDepths();
+    QTimer::singleShot(delayMs, this, [this, id]{
+        auto it = delayed.find(id);
+        if (delayed.end() == it) return; // aborted meanwhile
+        Request rr = it.value();
+        delayed.erase(it);
+        publishDepths();
+        post(rr);
+    });
+}
+
+void TimeStamper::publishDepths() {
+    stageMetrics.hashQueue.storeRelease(hashing.size());
+    stageMetrics.tsaInFlight.storeRelease(pending.size());
+    stageMetrics.retryQueue.storeRelease(delayed.size());
+    stageMetrics.writeQueue.storeRelease(writing.size());
+}
+
+void TimeStamper::abortAll() {
+    QList<QNetworkReply*> replies = pending.keys();
+    pending.clear();
+    delayed.clear();
+    sharing.clear();
+    hashing.clear();
+    hashBatch.clear();
+    for (QNetworkReply* reply : replies) {
+        reply->abort();
     }
+    writing.clear();
+    publishDepths();
+}
 
-    if (test) {
-        testReplies.insert(r);
+QList<qint64> TimeStamper::abortNetworkRequests() {
+    QList<qint64> ids = delayed.keys() + hashing.keys();
+    delayed.clear();
+    hashing.clear();
+    hashBatch.clear();
+    QList<QNetworkReply*> replies;
+    for (auto it = pending.begin(); it != pending.end(); ) {
+        if (it.value().test) {
+            ++it;
+            continue;
+        }
+        ids.append(it.value().id);
+        replies.append(it.key());
+        it = pending.erase(it);
+    }
+    for (QList<Request> const& followers : sharing) {
+        for (Request const& f : followers) ids.append(f.id);
+    }
+    sharing.clear();
+    for (QNetworkReply* reply : replies) {
+        reply->abort();
     }
+    publishDepths();
+    return ids;
+}
+
+int TimeStamper::pendingCount() const {
+    return hashing.size() + pending.size() + delayed.size() + writing.size();
 }
 
 void TimeStamper::tsReplyFinished(QNetworkReply *reply) {
-    bool testRequest = testReplies.contains(reply);
-    if (testRequest) {
-        testReplies.remove(reply);
+    reply->deleteLater();
+
+    auto it = pending.find(reply);
+    if (pending.end() == it) {
+        TERA_LOG(debug) << "Reply to an aborted request. Ignoring";
+        return;
+    }
+    Request r = it.value();
+    pending.erase(it);
+    publishDepths();
+
+    if (r.traceSent >= 0) {
+        qint64 done = Trace::now();
+        Trace::async("tsa", "net", r.id, r.traceSent, done, r.fileId);
+        if (r.traceTls >= 0) Trace::async("connect_tls", "net", r.id, r.traceSent, r.traceTls);
+        if (r.traceFirstByte >= 0) {
+            Trace::async("first_byte", "net", r.id, r.traceSent, r.traceFirstByte);
+            Trace::async("download", "net", r.id, r.traceFirstByte, done);
+        }
     }
 
-    reply->deleteLater();
+    int httpStatus = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    bool timedOut = reply->property("teraTimedOut").toBool();
+    TsaOutcome outcome = tsa_outcome(httpStatus, timedOut, QNetworkReply::NoError != reply->error());
+    endpoints.onResponse(r.endpoint, r.sent.elapsed(), outcome);
+    if (!r.probe) stageMetrics.tsaUs.record(r.sent.nsecsElapsed() / 1000);
+    emit tsResponseReceived(r.sent.elapsed(), outcome);
 
-    if (!testRequest && lastPostPtr != reply) {
-        TERA_LOG(error) << "Delayed TS reply. Ignoring";
+    if (r.probe) {
+        // any answer from the server means it is up again
+        emit probeFinished(TSA_SUCCESS == outcome || TSA_THROTTLED == outcome);
         return;
     }
 
     if (QNetworkReply::NoError != reply->error()) {
         QString error;
-        if(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 403)
+        if(httpStatus == 403)
             error.push_back(tr("The number of queries for time-stamps has been reached(5000 per day/25 000 per month)."));
+        else if (timedOut)
+            error.push_back(tr("Time-stamping request timed out"));
         else
             error.push_back(tr("Time-stamping request failed: %1").arg(reply->errorString()));
-        if (!testRequest && retriesLeft > 0) {
-            error.push_back(QString(". Trying to resend data. %1 retries left.").arg(QString::number(retriesLeft)) );
+        if (403 == httpStatus && !r.test && endpoints.quotaExhausted(r.endpoint)) {
+            TERA_LOG(warn) << error << " Trying another time server.";
+            post(r);
+            return;
+        } else if (403 == httpStatus) {
+            // no point in retrying before quota is renewed
+            finishFailed(r, error, TS_FINISH_DETAILS::QUOTA_EXCEEDED);
+            return;
+        } else if (!r.test && r.retriesLeft > 0) {
+            error.push_back(QString(". Trying to resend data. %1 retries left.").arg(QString::number(r.retriesLeft)) );
             TERA_LOG(warn) << error;
-            sendTSRequest(lastRequest, false, retriesLeft - 1);
+            scheduleRetry(r);
             return;
         } else {
             TS_FINISH_DETAILS details = TS_FINISH_DETAILS::OTHER;
+            if (TSA_SERVER_ERROR == outcome || TSA_TIMEOUT == outcome || TSA_OTHER_ERROR == outcome) {
+                details = TS_FINISH_DETAILS::TSA_UNAVAILABLE;
+            }
             if (QNetworkReply::SslHandshakeFailedError == reply->error()) {
                 details = TS_FINISH_DETAILS::SSL_HANDSHAKE_ERROR;
-                if (nullptr != sslConf) {
+                if (nullptr != endpoints.at(r.endpoint).configurator) {
                     error = tr("Couldn't use ID-card for authentication. ") + error;
                 }
             }
-            notifyClientOnTimestampingFinished(testRequest, false, error, details);
+            finishFailed(r, error, details);
             return;
         }
     }
@@ -300,36 +536,79 @@ void TimeStamper::tsReplyFinished(QNetworkReply *reply) {
 
     QByteArray timestamp = timeserverResponse;
 
-    if (!extract_timestamp_from_ts_response(timeserverResponse, timestamp)) {
+    qint64 extractStart = (Trace::enabled() ? Trace::now() : -1);
+    bool extracted = extract_timestamp_from_ts_response(timeserverResponse, timestamp);
+    if (extractStart >= 0) Trace::complete("token_extract", "cpu", extractStart, Trace::now(), r.fileId);
+    if (!extracted) {
         QString error = "Time-server's response did not contain timestamp.";
-        if (!testRequest && retriesLeft > 0) {
-            error.push_back(QString(". Trying to resend data. %1 retries left.").arg(QString::number(retriesLeft)) );
+        if (!r.test && r.retriesLeft > 0) {
+            error.push_back(QString(". Trying to resend data. %1 retries left.").arg(QString::number(r.retriesLeft)) );
             TERA_LOG(warn) << error;
-            sendTSRequest(lastRequest, false, retriesLeft - 1);
+            scheduleRetry(r);
             return;
         }
-        notifyClientOnTimestampingFinished(testRequest, false, error);
+        finishFailed(r, error);
         return;
     }
 
     TERA_LOG(trace) << "Time-stamp (in Hex):\n" << timestamp.toHex().constData();
 
-    if (testRequest) {
-        notifyClientOnTimestampingFinished(testRequest, true, "");
+    // a test token has to match too, a server that swapped the imprint algorithm doesn't take it
+    QString mismatch;
+    if (!timestamp_matches_request(timestamp, r.request, mismatch)) {
+        if (r.retriesLeft > 0) {
+            TERA_LOG(warn) << mismatch << ". Trying to resend data. " << r.retriesLeft << " retries left.";
+            scheduleRetry(r);
+            return;
+        }
+        finishFailed(r, mismatch);
+        return;
+    }
+
+    if (r.test) {
+        notifyClientOnTimestampingFinished(r, true, "");
         return;
     }
 
-    QFile file(inputFilePath);
-    QString fileName = file.fileName();
+    deliver(r, timestamp);
+    if (!r.digest.isEmpty()) {
+        tokens.insert(r.digest, new QByteArray(timestamp), timestamp.size());
+        for (Request const& f : sharing.take(r.digest)) {
+            deliver(f, timestamp);
+        }
+    }
+}
 
-    TERA_LOG(trace) << "Writing output file: " << outputFilePath.toUtf8().constData();
-    TeraCreateAsicsJob* createAsicsJob = new TeraCreateAsicsJob(++jobId, outputFilePath, inputFilePath, timestamp);
+void TimeStamper::deliver(Request const& r, QByteArray const& token) {
+    if (r.outputFilePath.isEmpty()) {
+        emit tokenReceived(r.id, token);
+        notifyClientOnTimestampingFinished(r, true, "");
+        return;
+    }
+
+    TERA_LOG(trace) << "Writing output file: " << r.outputFilePath.toUtf8().constData();
+    writing.insert(r.id, r.outputFilePath);
+    publishDepths();
+    TeraCreateAsicsJob* createAsicsJob = new TeraCreateAsicsJob(r.id, r.outputFilePath, r.inputFilePath, token, r.fileId);
     QObject::connect(createAsicsJob, &TeraCreateAsicsJob::finished, this, &TimeStamper::createAsicsContainerFinished);
-    QThreadPool::globalInstance()->start(createAsicsJob);
+    io.start(createAsicsJob, r.outputFilePath);
+}
+
+void TimeStamper::finishFailed(Request const& r, QString const& errString, TS_FINISH_DETAILS details) {
+    notifyClientOnTimestampingFinished(r, false, errString, details);
+    if (r.test || r.digest.isEmpty()) return;
+    // files sharing the digest fail the same way, so quota/outage handling sees each of them
+    for (Request const& f : sharing.take(r.digest)) {
+        notifyClientOnTimestampingFinished(f, false, errString, details);
+    }
 }
 
 void TimeStamper::createAsicsContainerFinished(qint64 doneJobId, bool asicsSuccess, QString err) {
-    if (jobId != doneJobId) return;
+    auto it = writing.find(doneJobId);
+    if (writing.end() == it) return;
+    QString outputFilePath = it.value();
+    writing.erase(it);
+    publishDepths();
 
     QString error;
     if (!asicsSuccess) { // TODO ... error is not necessary, err should contain everything
@@ -338,38 +617,155 @@ void TimeStamper::createAsicsContainerFinished(qint64 doneJobId, bool asicsSucce
         error.push_back("': ");
         error.push_back(err);
     }
-    notifyClientOnTimestampingFinished(false, asicsSuccess, error);
+    emit timestampingFinished(doneJobId, asicsSuccess, error, TS_FINISH_DETAILS::OTHER);
 }
 
-void TimeStamper::notifyClientOnTimestampingFinished(bool test, bool success, const QString &errString, TS_FINISH_DETAILS details, const QByteArray &resp) {
+void TimeStamper::notifyClientOnTimestampingFinished(Request const& r, bool success, const QString &errString, TS_FINISH_DETAILS details, const QByteArray &resp) {
     // TODO bad design
-    if (test) {
+    if (r.probe) {
+        emit probeFinished(success);
+    } else if (r.test) {
         emit timestampingTestFinished(success, resp, errString);
     } else {
-        emit timestampingFinished(success, errString, details);
+        emit timestampingFinished(r.id, success, errString, details);
     }
 }
 
 
 void TimeStamper::setTimeserverUrl(QString const& url, TimeStamperRequestConfigurationFactory* configurator) {
-    sslConf = configurator;
-    timeserverUrl = url;
+    endpoints.clear();
+    endpoints.add(url, configurator);
+}
+
+void TimeStamper::addTimeserverUrl(QString const& url, TimeStamperRequestConfigurationFactory* configurator) {
+    endpoints.add(url, configurator);
 }
 
-void TimeStamper::startTimestamping(QString const& tsUrl, QString const& infile, QString const& outfile) {
-    QString errorMsg;
-    //if (timeserverUrl != tsUrl) sslConf = NULL; // TODO ???
-    timeserverUrl = tsUrl;
-    inputFilePath = infile;
-    outputFilePath = outfile;
+QString TimeStamper::getTimeserverUrl() const {
+    return (endpoints.size() > 0 ? endpoints.at(0).url : QString());
+}
 
-    QByteArray request;
-    bool res = getTimestampRequest(request, errorMsg);
-    if (!res) {
-        emit timestampingFinished(false, errorMsg);
-    } else {
-        sendTSRequest(request, false, 3);
+TsaEndpointPool& TimeStamper::getEndpoints() {
+    return endpoints;
+}
+
+void TimeStamper::setRequestTimeout(int msecs) {
+    requestTimeout = msecs;
+}
+
+void TimeStamper::setImprintAlgorithm(Imprint::Algorithm a) {
+    imprint = a;
+}
+
+Imprint::Algorithm TimeStamper::imprintAlgorithm() const {
+    return imprint;
+}
+
+void TimeStamper::startTimestamping(qint64 requestId, QString const& infile, QString const& outfile, Prepared const& prepared, qint64 fileId) {
+    Request r;
+    r.id = requestId;
+    r.fileId = fileId;
+    r.inputFilePath = infile;
+    r.outputFilePath = outfile;
+    r.retriesLeft = MAX_RETRIES;
+
+    if (!prepared.request.isEmpty()) {
+        // hashed earlier, ex. spooled
+        r.digest = prepared.digest;
+        r.request = prepared.request;
+        postOrShare(r);
+        return;
     }
+    hashing.insert(requestId, r);
+    publishDepths();
+    if (!Imprint::batchesSmallFiles(imprint)) {
+        startHashJob(r);
+        return;
+    }
+    // requests dispatched together are hashed together
+    if (hashBatch.isEmpty()) QTimer::singleShot(0, this, SLOT(startHashBatch()));
+    hashBatch.append(requestId);
+    if (hashBatch.size() >= Imprint::smallFileBatch()) startHashBatch();
+}
+
+void TimeStamper::startHashJob(Request const& r) {
+    TeraHashJob* hashJob = new TeraHashJob(r.id, r.inputFilePath, imprint, r.fileId);
+    QObject::connect(hashJob, &TeraHashJob::finished, this, &TimeStamper::hashFinished);
+    io.start(hashJob, r.inputFilePath);
+}
+
+void TimeStamper::startHashBatch() {
+    QVector<qint64> ids;
+    QStringList paths;
+    for (qint64 id : hashBatch) {
+        auto it = hashing.find(id);
+        if (hashing.end() == it) continue; // aborted meanwhile
+        ids.append(id);
+        paths.append(it.value().inputFilePath);
+    }
+    hashBatch.clear();
+    if (ids.isEmpty()) return;
+    TeraHashBatchJob* job = new TeraHashBatchJob(ids, paths);
+    QObject::connect(job, &TeraHashBatchJob::finished, this, &TimeStamper::hashFinished);
+    QObject::connect(job, &TeraHashBatchJob::streamNeeded, this, &TimeStamper::hashStreaming);
+    // files of a dispatch round mostly share a device
+    io.start(job, paths.first());
+}
+
+void TimeStamper::hashStreaming(qint64 jobId) {
+    auto it = hashing.find(jobId);
+    if (hashing.end() == it) return; // aborted meanwhile
+    startHashJob(it.value());
+}
+
+void TimeStamper::hashFinished(qint64 jobId, QByteArray digest, QString err) {
+    auto it = hashing.find(jobId);
+    if (hashing.end() == it) return; // aborted meanwhile
+    Request r = it.value();
+    hashing.erase(it);
+    publishDepths();
+    if (digest.isEmpty()) {
+        emit timestampingFinished(jobId, false, err, TS_FINISH_DETAILS::OTHER);
+        return;
+    }
+    r.digest = digest;
+    {
+        Trace::Span span("request_build", "cpu", r.fileId);
+        r.request = create_timestamp_request(r.digest);
+    }
+    postOrShare(r);
+}
+
+void TimeStamper::postOrShare(Request r) {
+    if (r.digest.isEmpty()) {
+        post(r);
+        return;
+    }
+    ++dedup.files;
+    if (QByteArray* token = tokens.object(r.digest)) {
+        TERA_LOG(debug) << "Reusing time-stamp for identical file: " << r.inputFilePath;
+        deliver(r, *token);
+        return;
+    }
+    auto it = sharing.find(r.digest);
+    if (sharing.end() != it) {
+        TERA_LOG(debug) << "Waiting for time-stamp of identical file: " << r.inputFilePath;
+        it.value().append(r);
+        return;
+    }
+    ++dedup.unique;
+    sharing.insert(r.digest, QList<Request>());
+    post(r);
+}
+
+void TimeStamper::resetDedup() {
+    sharing.clear();
+    tokens.clear();
+    dedup = DedupStats();
+}
+
+TimeStamper::DedupStats TimeStamper::dedupStats() const {
+    return dedup;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -380,6 +776,7 @@ OutputNameGenerator::OutputNameGenerator(QStringList const& inExts, QString cons
 }
 
 QString OutputNameGenerator::getOutFile(QString const& filePath) {
+    QMutexLocker lock(&mutex);
     if (fixedConversion.contains(filePath)) {
         return fixedConversion[filePath];
     }
@@ -393,28 +790,74 @@ QString OutputNameGenerator::getOutFile(QString const& filePath) {
         }
     }
 
-    QString res;
-    int nr = 0;
-    do {
+    QDir dir(fileInfo.absolutePath());
+    DirReservations& dr = reservationsFor(dir.absolutePath());
+    int& nr = dr.nextNr[nameKey(name)];
+    while (true) {
         QString newName;
         if (nr > 0) {
             newName = name + "(" + QString::number(nr) + ")" + outExtension;
         } else {
             newName = name + outExtension;
         }
-        QFileInfo outFileInfo(QDir(fileInfo.path()), newName);
-        if (!outFileInfo.exists()) {
-            res = outFileInfo.absoluteFilePath();
-        }
         ++nr;
-    } while (res.isEmpty());
-    return res;
+
+        QString key = nameKey(newName);
+        if (!dr.taken.contains(key)) {
+            dr.taken.insert(key);
+            dr.outstanding.insert(key);
+            return dir.absoluteFilePath(newName);
+        }
+    }
+}
+
+OutputNameGenerator::DirReservations& OutputNameGenerator::reservationsFor(QString const& dirPath) {
+    auto it = reservations.find(dirPath);
+    if (reservations.end() != it) return it.value();
+
+    DirReservations& dr = reservations[dirPath];
+    QStringList entries = QDir(dirPath).entryList(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+    dr.taken.reserve(entries.size());
+    for (QString const& entry : entries) {
+        dr.taken.insert(nameKey(entry));
+    }
+    return dr;
+}
+
+QString OutputNameGenerator::nameKey(QString const& name) {
+#if defined(Q_OS_WIN32) || defined(Q_OS_OSX)
+    // case insensitive file systems
+    return name.toLower();
+#else
+    return name;
+#endif
+}
+
+void OutputNameGenerator::releaseOutFile(QString const& outPath) {
+    if (outPath.isEmpty()) return;
+    QFileInfo fileInfo(outPath);
+    QMutexLocker lock(&mutex);
+    auto it = reservations.find(QDir(fileInfo.absolutePath()).absolutePath());
+    if (reservations.end() == it) return;
+    it.value().outstanding.remove(nameKey(fileInfo.fileName()));
+    if (it.value().outstanding.isEmpty()) reservations.erase(it);
+}
+
+void OutputNameGenerator::clearReservations() {
+    QMutexLocker lock(&mutex);
+    reservations.clear();
 }
 
 void OutputNameGenerator::setFixedOutFile(QString const& in_file, QString const& file_out) {
+    QMutexLocker lock(&mutex);
     fixedConversion[in_file] = file_out;
 }
 
+QString OutputNameGenerator::getFixedOutFile(QString const& in_file) {
+    QMutexLocker lock(&mutex);
+    return fixedConversion.value(in_file);
+}
+
 void OutputNameGenerator::setInExts(QStringList const& inExts) {
     inExtensions.clear();
     for (QString const& ext : inExts) {
@@ -433,18 +876,47 @@ void OutputNameGenerator::setOutExt(QString const& oe) {
 }
 
 BatchStamper::BatchStamper(StampingMonitorCallback& mon, OutputNameGenerator& ng, bool end_on_first_fail) :
-    monitor(mon), namegen(ng), instaFail(end_on_first_fail), pos(-1)
+    monitor(mon), namegen(ng), instaFail(end_on_first_fail), tokenOnly(false), running(false), pos(-1), doneCnt(0), nextRequestId(0),
+    quotaWait(false)
 {
     QObject::connect(this, SIGNAL(triggerNext()),
                      this, SLOT(processNext()));
-    QObject::connect(&ts, SIGNAL(timestampingFinished(bool,QString,int)),
-                     this, SLOT(timestampFinished(bool,QString,int)));
+    // queued, so results never arrive while processNext is dispatching
+    QObject::connect(&ts, SIGNAL(timestampingFinished(qint64,bool,QString,int)),
+                     this, SLOT(timestampFinished(qint64,bool,QString,int)), Qt::QueuedConnection);
+    QObject::connect(&ts, SIGNAL(tsResponseReceived(qint64,int)),
+                     this, SLOT(tsResponseReceived(qint64,int)));
+    QObject::connect(&ts, SIGNAL(probeFinished(bool)),
+                     this, SLOT(probeFinished(bool)), Qt::QueuedConnection);
+    QObject::connect(&ts, SIGNAL(tokenReceived(qint64,QByteArray)),
+                     this, SLOT(tsTokenReceived(qint64,QByteArray)));
+}
+
+void BatchStamper::startTimestamping(QStringList const& inputFiles) {
+    PathStore store;
+    QVector<PathStore::FileId> files;
+    files.reserve(inputFiles.size());
+    for (QString const& f : inputFiles) files.append(store.add(f));
+    startTimestamping(store, files);
 }
 
-void BatchStamper::startTimestamping(QString const& tsUrl, QStringList const& inputFiles) {
+void BatchStamper::startTimestamping(PathStore const& store, QVector<PathStore::FileId> const& files) {
+    namegen.clearReservations();
+    ts.abortAll();
+    ts.resetDedup();
+    inFlight.clear();
+    requeued.clear();
+    deferred.clear();
+    quotaWait = false;
+    ts.getEndpoints().configureQuotas(quotaLimits);
+    concurrency.reset();
+    breaker.reset();
+    running = true;
     pos = -1;
-    timeServerUrl = tsUrl;
-    input = inputFiles;
+    doneCnt = 0;
+    paths = store;
+    input = files;
+    stageMetrics.filesTotal.storeRelease(files.size());
     emit triggerNext();
 }
 
@@ -452,33 +924,192 @@ TimeStamper& BatchStamper::getTimestamper() {
     return ts;
 }
 
+TsaConcurrencyController& BatchStamper::getConcurrency() {
+    return concurrency;
+}
+
+void BatchStamper::setQuotaLimits(QString const& url, TsaQuota::Limits const& limits) {
+    quotaLimits.insert(url, limits);
+}
+
+TsaCircuitBreaker& BatchStamper::getBreaker() {
+    return breaker;
+}
+
+void BatchStamper::setPreparedRequests(QHash<QString, TimeStamper::Prepared> const& requests) {
+    preparedRequests = requests;
+}
+
+void BatchStamper::setTokenOnly(bool to) {
+    tokenOnly = to;
+}
+
+int BatchStamper::currentWindow() const {
+    return concurrency.window();
+}
+
+int BatchStamper::inFlightCount() const {
+    return inFlight.size();
+}
+
 void BatchStamper::processNext() {
-    if ((pos+1) >= input.size()) {
+    if (!running) return;
+
+    while (!quotaWait && breaker.allowsRequests() && inFlight.size() < concurrency.window() &&
+            (!requeued.isEmpty() || (pos+1) < input.size())) {
+        // nothing is taken here, TimeStamper takes quota when the request is posted
+        qint64 waitMs = 0;
+        TsaQuota::Grant grant = ts.getEndpoints().quotaState(waitMs);
+        if (TsaQuota::EXHAUSTED == grant) {
+            deferRemaining();
+            break;
+        } else if (TsaQuota::WAIT == grant) {
+            quotaWait = true;
+            QTimer::singleShot(waitMs, this, SLOT(quotaWaitDone()));
+            break;
+        }
+
+        InFile f;
+        if (!requeued.isEmpty()) {
+            f = requeued.takeFirst();
+        } else {
+            ++pos;
+            f.nr = pos;
+            f.in = paths.path(input.at(pos));
+            if (!tokenOnly) f.out = namegen.getOutFile(f.in);
+        }
+        if (!monitor.processingFile(f.in, f.out, f.nr, input.size())) {
+            finish(FinishingDetails::cancelled());
+            return;
+        }
+        qint64 id = ++nextRequestId;
+        inFlight.insert(id, f);
+        ts.startTimestamping(id, f.in, f.out, preparedRequests.value(f.in), input.at(f.nr));
+    }
+
+    if (inFlight.isEmpty() && !quotaWait && breaker.allowsRequests() && requeued.isEmpty() && (pos+1) >= input.size()) {
         pos = input.size();
-        emit timestampingFinished(FinishingDetails(true, ""));
-        return;
+        finish(FinishingDetails(true, ""));
     }
-    ++pos;
-    curIn = input[pos];
-    curOut = namegen.getOutFile(curIn);
-    if (!monitor.processingFile(curIn, curOut, pos, input.size())) {
-        emit timestampingFinished(FinishingDetails::cancelled());
-        return;
+}
+
+void BatchStamper::quotaWaitDone() {
+    quotaWait = false;
+    processNext();
+}
+
+void BatchStamper::deferRemaining() {
+    for (InFile const& f : requeued) {
+        deferred.append(f.in);
+        namegen.releaseOutFile(f.out);
+    }
+    requeued.clear();
+    for (int i = pos+1; i < input.size(); ++i) {
+        deferred.append(paths.path(input.at(i)));
     }
-    ts.startTimestamping(timeServerUrl, curIn, curOut);
+    pos = input.size() - 1;
 }
 
-void BatchStamper::timestampFinished(bool success, QString errString, int i_details) {
+void BatchStamper::timestampFinished(qint64 requestId, bool success, QString errString, int i_details) {
+    auto it = inFlight.find(requestId);
+    if (!running || inFlight.end() == it) return;
+    InFile f = it.value();
+    inFlight.erase(it);
+
     TimeStamper::TS_FINISH_DETAILS details = static_cast<TimeStamper::TS_FINISH_DETAILS>(i_details);
-    if (!monitor.processingFileDone(curIn, curOut, pos, input.size(), success, errString)) {
-        emit timestampingFinished(FinishingDetails::cancelled());
+    if (TimeStamper::TS_FINISH_DETAILS::TSA_UNAVAILABLE == details && !breaker.allowsRequests()) {
+        // outage, not a problem of that file
+        requeued.append(f);
+        emit triggerNext();
+        return;
+    }
+    // written or given up, its name no longer needs the directory listing
+    namegen.releaseOutFile(f.out);
+    if (TimeStamper::TS_FINISH_DETAILS::QUOTA_EXCEEDED == details) {
+        // not a failure, file waits for the next quota period; no endpoint has quota left
+        deferred.append(f.in);
+        deferRemaining();
+        emit triggerNext();
+        return;
+    }
+    (success ? stageMetrics.filesStamped : stageMetrics.filesFailed).fetchAndAddRelaxed(1);
+    if (!monitor.processingFileDone(f.in, f.out, doneCnt++, input.size(), success, errString)) {
+        finish(FinishingDetails::cancelled());
         return;
     }
     if (!success && (instaFail || TimeStamper::TS_FINISH_DETAILS::SSL_HANDSHAKE_ERROR == details)) {
-        emit timestampingFinished(FinishingDetails(success, errString));
+        finish(FinishingDetails(success, errString));
     } else {
         emit triggerNext();
     }
 }
 
+void BatchStamper::tsResponseReceived(qint64 latencyMs, int outcome) {
+    concurrency.onResponse(latencyMs, static_cast<TsaOutcome>(outcome));
+    if (TSA_SUCCESS != outcome) stageMetrics.tsaErrors.fetchAndAddRelaxed(1);
+    if (running && breaker.onResponse(static_cast<TsaOutcome>(outcome))) {
+        // queued, so the request being answered is already rescheduled or reported
+        QMetaObject::invokeMethod(this, "pauseForOutage", Qt::QueuedConnection);
+    }
+}
+
+void BatchStamper::pauseForOutage() {
+    if (!running) return;
+    // requests still out would fail the same way, take them back
+    for (qint64 id : ts.abortNetworkRequests()) {
+        auto it = inFlight.find(id);
+        if (inFlight.end() == it) continue;
+        requeued.append(it.value());
+        inFlight.erase(it);
+    }
+    TERA_LOG(warn) << "Time server is not responding, pausing for " << (int)(breaker.probeDelay() / 1000) << "s (" <<
+            (requeued.size() + input.size() - pos - 1) << " files waiting)";
+    QTimer::singleShot(breaker.probeDelay(), this, SLOT(probeTsa()));
+}
+
+void BatchStamper::probeTsa() {
+    if (!running || TsaCircuitBreaker::OPEN != breaker.state()) return;
+    if (breaker.outageTooLong()) {
+        finish(FinishingDetails::error(QString("Time server has been unavailable for %1 minutes").
+                arg(QString::number(breaker.outageMs() / 60000))));
+        return;
+    }
+    breaker.probeStarted();
+    ts.sendProbe();
+}
+
+void BatchStamper::probeFinished(bool success) {
+    if (!running || TsaCircuitBreaker::HALF_OPEN != breaker.state()) return;
+    breaker.probeFinished(success);
+    if (success) {
+        TERA_LOG(info) << "Time server is responding again, continuing";
+        emit triggerNext();
+    } else {
+        TERA_LOG(warn) << "Time server still not responding, next try in " << (int)(breaker.probeDelay() / 1000) << "s";
+        QTimer::singleShot(breaker.probeDelay(), this, SLOT(probeTsa()));
+    }
+}
+
+void BatchStamper::tsTokenReceived(qint64 requestId, QByteArray token) {
+    auto it = inFlight.find(requestId);
+    if (inFlight.end() == it) return;
+    emit tokenReceived(it.value().in, token);
+}
+
+void BatchStamper::finish(FinishingDetails details) {
+    running = false;
+    quotaWait = false;
+    ts.abortAll();
+    inFlight.clear();
+    requeued.clear();
+    namegen.clearReservations();
+    ts.getEndpoints().flushQuotas();
+    if (!deferred.isEmpty()) {
+        details.deferred = deferred;
+        details.deferredUntil = ts.getEndpoints().estimateQuotaClearTime(deferred.size());
+        deferred.clear();
+    }
+    emit timestampingFinished(details);
+}
+
 }
@@ -23,7 +23,12 @@
 
 #include <QObject>
 #include <QByteArray>
+#include <QCache>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QMap>
+#include <QMutex>
 #include <QRunnable>
 #include <QPointer>
 #include <QScopedPointer>
@@ -32,6 +37,13 @@
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
 
+#include "imprint.h"
+#include "io_scheduler.h"
+#include "path_store.h"
+#include "tsa_breaker.h"
+#include "tsa_concurrency.h"
+#include "tsa_pool.h"
+#include "tsa_quota.h"
 #include "utils.h"
 
 struct zip;
@@ -41,19 +53,27 @@ namespace ria_tera {
 class TeraCreateAsicsJob : public QObject, public QRunnable {
     Q_OBJECT
 public:
-    TeraCreateAsicsJob(qint64 id, QString const& out, QString const& in, QByteArray const& ts);
+    TeraCreateAsicsJob(qint64 id, QString const& out, QString const& in, QByteArray const& ts, qint64 fileId = -1);
 signals:
     void finished(qint64 jobId, bool asicsSuccess, QString error);
 public:
     void run();
     bool createAsicsContainer(QString& errorStr);
+    /// Expected size of the container for an input file, for free space checks
+    static qint64 estimateSize(QString const& in, qint64 inSize);
 private:
     bool fillTmpAsicsContainer(zip* zip, QByteArray const& mimeCont, QString& errorStr);
     bool insertInputFile(zip* zip, QString const& path, QString& errorStr);
     bool addFile(zip* zip, QString const& name, QByteArray const& data, QString& errorStr);
     qint64 jobId;
+    /// for trace events
+    qint64 fileId;
     QString outpath;
     QString infile;
+    /// input file size as libzip saw it
+    qint64 inputBytes;
+    /// input, token and mimetype put into the container, before compression
+    qint64 storedBytes;
 
     // This byte arrays needs to remain untouched after they are added to zip...
     // see https://nih.at/libzip/zip_source_buffer.html
@@ -61,6 +81,39 @@ private:
 };
 
 
+/// Hashes the input file of a request on an I/O queue
+class TeraHashJob : public QObject, public QRunnable {
+    Q_OBJECT
+public:
+    TeraHashJob(qint64 id, QString const& in, Imprint::Algorithm alg, qint64 fileId = -1);
+signals:
+    void finished(qint64 jobId, QByteArray digest, QString error);
+public:
+    void run();
+private:
+    qint64 jobId;
+    qint64 fileId;
+    QString infile;
+    Imprint::Algorithm imprint;
+};
+
+/// Hashes small input files of several requests together (Imprint::hashSmallFiles);
+/// files too big for that or unreadable are handed back for a TeraHashJob
+class TeraHashBatchJob : public QObject, public QRunnable {
+    Q_OBJECT
+public:
+    TeraHashBatchJob(QVector<qint64> const& ids, QStringList const& in);
+signals:
+    void finished(qint64 jobId, QByteArray digest, QString error);
+    void streamNeeded(qint64 jobId);
+public:
+    void run();
+private:
+    QVector<qint64> jobIds;
+    QStringList infiles;
+};
+
+
 class TimeStamperRequestConfigurationFactory {
 public:
     virtual bool isTrusted(QSslCertificate const& request) = 0;
@@ -70,52 +123,162 @@ public:
 class TimeStamper : public QObject {
     Q_OBJECT
 public:
+    /// TSA_UNAVAILABLE - retries ran out on timeouts, 5xx or connection errors
+    enum TS_FINISH_DETAILS : int {OTHER, SSL_HANDSHAKE_ERROR, QUOTA_EXCEEDED, TSA_UNAVAILABLE};
+    static int const MAX_RETRIES = 3;
+    static qint64 const RETRY_DELAY_MS = 500;
+
+    /// Request hashed beforehand (spool, bundle); digest is the imprint of the input file
+    struct Prepared {
+        QByteArray digest;
+        QByteArray request;
+    };
+    /// Files with equal content share one time server request
+    struct DedupStats {
+        qint64 files = 0;
+        qint64 unique = 0;
+    };
+    /// Tokens kept for later duplicates, bytes
+    static int const TOKEN_CACHE_BYTES = 32 * 1024 * 1024;
+
     TimeStamper();
 
+    /// Replaces time server endpoints with url
     void setTimeserverUrl(QString const& url, TimeStamperRequestConfigurationFactory* configurator = NULL); // TODO xxx
-    void startTimestamping(QString const& tsUrl, QString const& infile, QString const& outfile);
-    bool getTimestampRequest(QByteArray& tsrequest, QString& error);
-    QByteArray getTimestampRequest4Sha256(QByteArray& sha256); // TODO redesign
-    void sendTSRequest(QByteArray const& timestampRequest, bool test = false, int retries = -1); // TODO redesign
+    /// Additional endpoint, requests are spread over endpoints by their health
+    void addTimeserverUrl(QString const& url, TimeStamperRequestConfigurationFactory* configurator = NULL);
+    /// First (primary) endpoint
+    QString getTimeserverUrl() const;
+    TsaEndpointPool& getEndpoints();
+    void setRequestTimeout(int msecs);
+    /// Hash algorithm for files hashed by startTimestamping
+    void setImprintAlgorithm(Imprint::Algorithm a);
+    Imprint::Algorithm imprintAlgorithm() const;
+    /// Hashes infile (unless prepared request is given) and sends request, result is reported by timestampingFinished(requestId, ...)
+    /// Empty outfile - no container is written, token is reported by tokenReceived
+    /// A file with the same digest as an earlier one of this run reuses its token
+    void startTimestamping(qint64 requestId, QString const& infile, QString const& outfile, Prepared const& prepared = Prepared(), qint64 fileId = -1);
+    /// Forget tokens and dedup counters of previous run
+    void resetDedup();
+    DedupStats dedupStats() const;
+    /// Aborts requests waiting for time server, their results are not reported
+    void abortAll();
+    /// Aborts file requests being hashed, on the network or waiting for retry, returns their ids.
+    /// Output files already being written are not affected.
+    QList<qint64> abortNetworkRequests();
+    int pendingCount() const;
 
-    enum TS_FINISH_DETAILS : int {OTHER, SSL_HANDSHAKE_ERROR};
+    QByteArray getTimestampRequest4Sha256(QByteArray& sha256); // TODO redesign
+    void sendTestRequest(QByteArray const& timestampRequest);
+    /// Time-stamps an empty digest to see if time server is up, reported by probeFinished
+    void sendProbe();
 public slots:
     void tsReplyFinished(QNetworkReply *reply);
     void createAsicsContainerFinished(qint64 jobId, bool, QString err);
+    void hashFinished(qint64 jobId, QByteArray digest, QString err);
+    void hashStreaming(qint64 jobId);
+    void startHashBatch();
 signals:
-    void timestampingFinished(bool success, QString errString, int details = TS_FINISH_DETAILS::OTHER);
+    void timestampingFinished(qint64 requestId, bool success, QString errString, int details = TS_FINISH_DETAILS::OTHER);
     void timestampingTestFinished(bool success, QByteArray resp, QString errString);
-    void signalAsicsContainerFinished(bool);
+    void probeFinished(bool success);
+    void tokenReceived(qint64 requestId, QByteArray token);
+    /// Every answered or timed out request to time server, retries included; outcome is TsaOutcome
+    void tsResponseReceived(qint64 latencyMs, int outcome);
 private:
-    void notifyClientOnTimestampingFinished(bool test, bool success, const QString &errString, TS_FINISH_DETAILS details = TS_FINISH_DETAILS::OTHER, const QByteArray &resp = QByteArray());
-
-    qint64 jobId;
-    QString inputFilePath;
-    QString timeserverUrl;
-    QString outputFilePath;
-
-    int retriesLeft = 0;
-    void* lastPostPtr = nullptr;
-    QByteArray lastRequest;
+    struct Request {
+        qint64 id = 0;
+        bool test = false;
+        bool probe = false;
+        QString inputFilePath;
+        QString outputFilePath;
+        QByteArray digest;
+        QByteArray request;
+        int retriesLeft = 0;
+        /// index in endpoint pool
+        int endpoint = -1;
+        QElapsedTimer sent;
+        /// input file in trace events
+        qint64 fileId = -1;
+        /// Trace::now() when sent, TLS handshake done and response headers received; -1 if not traced
+        qint64 traceSent = -1;
+        qint64 traceTls = -1;
+        qint64 traceFirstByte = -1;
+    };
+    void post(Request r);
+    /// Sends r unless the same digest is already in flight or answered
+    void postOrShare(Request r);
+    void deliver(Request const& r, QByteArray const& token);
+    void finishFailed(Request const& r, QString const& errString, TS_FINISH_DETAILS details = TS_FINISH_DETAILS::OTHER);
+    void scheduleRetry(Request r);
+    /// r waits in delayed, then it is posted
+    void postLater(Request const& r, qint64 delayMs);
+    void startHashJob(Request const& r);
+    /// Copies queue sizes to stageMetrics
+    void publishDepths();
+    TimeStamperRequestConfigurationFactory* configuratorFor(QNetworkReply* reply) const;
+    void notifyClientOnTimestampingFinished(Request const& r, bool success, const QString &errString, TS_FINISH_DETAILS details = TS_FINISH_DETAILS::OTHER, const QByteArray &resp = QByteArray());
 
-    TimeStamperRequestConfigurationFactory* sslConf;
+    TsaEndpointPool endpoints;
+    int requestTimeout;
+    Imprint::Algorithm imprint;
 
     QNetworkAccessManager nam;
 
-    QSet<QNetworkReply*> testReplies;
+    QHash<QNetworkReply*, Request> pending;
+    /// request id -> request waiting for backoff before retry
+    QHash<qint64, Request> delayed;
+    /// request id -> request whose input file is being hashed
+    QHash<qint64, Request> hashing;
+    /// SHA-256 requests collected for the next TeraHashBatchJob
+    QVector<qint64> hashBatch;
+    /// request id -> output file of container being written
+    QHash<qint64, QString> writing;
+    /// digest in flight -> requests for files with the same digest waiting for its token
+    QHash<QByteArray, QList<Request>> sharing;
+    /// digest -> token received during this run
+    QCache<QByteArray, QByteArray> tokens;
+    DedupStats dedup;
+    /// hashing and container jobs, queued per storage device; last member,
+    /// so it waits for running jobs before the rest is destroyed
+    IoScheduler io;
 };
 
+/// Hands out unique output file names. Each directory is listed once and
+/// names given out are reserved, so concurrent jobs never get the same name.
+/// TeraCreateAsicsJob still creates the file with ZIP_EXCL as the final guard.
 class OutputNameGenerator {
 public:
     OutputNameGenerator(QStringList const& inExts, QString const& outExt);
     QString getOutFile(QString const& filePath);
     void setFixedOutFile(QString const& in_file, QString const& file_out);
+    /// empty if output name for in_file is generated
+    QString getFixedOutFile(QString const& in_file);
     void setInExts(QStringList const& inExts);
     void setOutExt(QString const& oe);
+    /// Output of getOutFile is written or won't be; a directory's listing is dropped
+    /// when none of its names is outstanding, the written files are on disk then
+    void releaseOutFile(QString const& outPath);
+    /// Forget directory listings, next getOutFile re-reads the directories
+    void clearReservations();
 private:
+    struct DirReservations {
+        /// names existing on disk when listed + names handed out since
+        QSet<QString> taken;
+        /// next "(nr)" to try for a base name, avoids re-probing taken names
+        QHash<QString, int> nextNr;
+        /// names handed out and not released yet
+        QSet<QString> outstanding;
+    };
+    DirReservations& reservationsFor(QString const& dirPath);
+    static QString nameKey(QString const& name);
+
     QStringList inExtensions;
     QString outExtension;
     QMap<QString, QString> fixedConversion;
+
+    QMutex mutex;
+    QHash<QString, DirReservations> reservations;
 };
 
 class BatchStamper : public QObject {
@@ -126,6 +289,10 @@ public:
         bool success = false;
         bool userCancelled = false;
         QString errString;
+        /// not sent because time server quota is used up
+        QStringList deferred;
+        /// estimated time when quota allows sending deferred files
+        QDateTime deferredUntil;
         FinishingDetails(bool _success = false, QString _errStr = "internal error") : success(_success), errString(_errStr) {};
         static FinishingDetails error(QString const& errStr) {
             FinishingDetails d(false, errStr);
@@ -139,23 +306,62 @@ public:
     };
 
     BatchStamper(StampingMonitorCallback& mon, OutputNameGenerator& ng, bool end_on_first_fail);
-    void startTimestamping(QString const& tsUrl, QStringList const& inputFiles);
+    void startTimestamping(QStringList const& inputFiles);
+    /// Time-stamps files in the given order; store is implicitly shared, not deep-copied
+    void startTimestamping(PathStore const& store, QVector<PathStore::FileId> const& files);
     TimeStamper& getTimestamper();
+    TsaConcurrencyController& getConcurrency();
+    /// Quota limits of a time server url, used from next startTimestamping
+    void setQuotaLimits(QString const& url, TsaQuota::Limits const& limits);
+    TsaCircuitBreaker& getBreaker();
+    /// Time-stamp requests computed beforehand, input path -> digest and request DER; those files are not hashed again
+    void setPreparedRequests(QHash<QString, TimeStamper::Prepared> const& requests);
+    /// Only collect tokens (tokenReceived), no output files
+    void setTokenOnly(bool tokenOnly);
+    /// Number of requests allowed in flight at the moment
+    int currentWindow() const;
+    int inFlightCount() const;
 signals:
     void triggerNext();
     void timestampingFinished(FinishingDetails details);
+    void tokenReceived(QString in, QByteArray token);
 private slots:
     void processNext();
-    void timestampFinished(bool success, QString errString, int details);
+    void timestampFinished(qint64 requestId, bool success, QString errString, int details);
+    void tsResponseReceived(qint64 latencyMs, int outcome);
+    void tsTokenReceived(qint64 requestId, QByteArray token);
+    void quotaWaitDone();
+    void pauseForOutage();
+    void probeTsa();
+    void probeFinished(bool success);
 private:
+    struct InFile {
+        int nr;
+        QString in;
+        QString out;
+    };
+    void finish(FinishingDetails details);
+    void deferRemaining();
+
     StampingMonitorCallback& monitor;
     OutputNameGenerator& namegen;
     bool instaFail;
+    bool tokenOnly;
+    bool running;
     int pos;
-    QString curIn;
-    QString curOut;
-    QStringList input;
-    QString timeServerUrl;
+    int doneCnt;
+    qint64 nextRequestId;
+    PathStore paths;
+    QVector<PathStore::FileId> input;
+    QHash<QString, TimeStamper::Prepared> preparedRequests;
+    QHash<qint64, InFile> inFlight;
+    /// files taken back from time server during outage, sent before the rest
+    QList<InFile> requeued;
+    QStringList deferred;
+    bool quotaWait;
+    QHash<QString, TsaQuota::Limits> quotaLimits;
+    TsaConcurrencyController concurrency;
+    TsaCircuitBreaker breaker;
     TimeStamper ts;
 };
 
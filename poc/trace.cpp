@@ -0,0 +1,172 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "trace.h"
+
+#include <atomic>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QThread>
+
+namespace {
+
+struct Event {
+    char const* name;
+    char const* cat;
+    /// 'X' complete, 'b'/'e' async begin/end
+    char ph;
+    qint64 ts;
+    qint64 dur;
+    qint64 id;
+    qint64 fileId;
+};
+
+/// Events of one thread; the lock is only contended while close() copies them
+struct ThreadBuffer {
+    int tid;
+    QString name;
+    QMutex mutex;
+    std::vector<Event> events;
+};
+
+QMutex buffersMutex;
+/// all buffers since open(), owned here as threads may end before close()
+QList<ThreadBuffer*> buffers;
+QString tracePath;
+QElapsedTimer clock;
+/// buffers of an earlier trace are not used again
+std::atomic<int> generation(0);
+
+thread_local ThreadBuffer* threadBuffer = nullptr;
+thread_local int threadGeneration = -1;
+
+ThreadBuffer* currentBuffer() {
+    // generation is only changed while tracing is off
+    if (nullptr != threadBuffer && threadGeneration == generation) return threadBuffer;
+    QMutexLocker lock(&buffersMutex);
+    ThreadBuffer* b = new ThreadBuffer();
+    b->tid = buffers.size() + 1;
+    QThread* t = QThread::currentThread();
+    if (nullptr != QCoreApplication::instance() && QCoreApplication::instance()->thread() == t) {
+        b->name = "main";
+    } else {
+        b->name = (t->objectName().isEmpty() ? QString("worker %1").arg(b->tid) : t->objectName());
+    }
+    buffers.append(b);
+    threadBuffer = b;
+    threadGeneration = generation;
+    return b;
+}
+
+void record(Event const& e) {
+    ThreadBuffer* b = currentBuffer();
+    QMutexLocker lock(&b->mutex);
+    b->events.push_back(e);
+}
+
+QByteArray jsonString(QString const& s) {
+    QByteArray res("\"");
+    for (QChar c : s) {
+        if ('"' == c || '\\' == c) res.append('\\').append(c.toLatin1());
+        else if (c.unicode() < 0x20) res.append(QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0')).toLatin1());
+        else res.append(QString(c).toUtf8());
+    }
+    return res.append('"');
+}
+
+void writeEvent(QByteArray& out, Event const& e, int tid) {
+    out.append("{\"name\":\"").append(e.name).append("\",\"cat\":\"").append(e.cat)
+       .append("\",\"ph\":\"").append(e.ph).append("\",\"ts\":").append(QByteArray::number(e.ts))
+       .append(",\"pid\":1,\"tid\":").append(QByteArray::number(tid));
+    if ('X' == e.ph) out.append(",\"dur\":").append(QByteArray::number(e.dur));
+    if ('X' != e.ph) out.append(",\"id\":").append(QByteArray::number(e.id));
+    if (e.fileId >= 0) out.append(",\"args\":{\"file\":").append(QByteArray::number(e.fileId)).append('}');
+    out.append("},\n");
+}
+
+}
+
+namespace ria_tera {
+
+std::atomic<bool> Trace::active(false);
+
+bool Trace::open(QString const& path, QString& error) {
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        error = QString("Can't open trace file '%1': %2").arg(path, f.errorString());
+        return false;
+    }
+    f.close();
+    QMutexLocker lock(&buffersMutex);
+    tracePath = path;
+    clock.start();
+    active = true;
+    return true;
+}
+
+qint64 Trace::now() {
+    return clock.nsecsElapsed() / 1000;
+}
+
+void Trace::complete(char const* name, char const* cat, qint64 startUs, qint64 endUs, qint64 fileId) {
+    if (!enabled()) return;
+    record(Event{name, cat, 'X', startUs, endUs - startUs, 0, fileId});
+}
+
+void Trace::async(char const* name, char const* cat, qint64 id, qint64 startUs, qint64 endUs, qint64 fileId) {
+    if (!enabled()) return;
+    record(Event{name, cat, 'b', startUs, 0, id, fileId});
+    record(Event{name, cat, 'e', endUs, 0, id, -1});
+}
+
+bool Trace::close(QString& error) {
+    if (!enabled()) return true;
+    active = false;
+    // threads still holding a buffer pointer get a new buffer next time
+    ++generation;
+
+    QMutexLocker lock(&buffersMutex);
+    QByteArray out("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (ThreadBuffer* b : buffers) {
+        out.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":").append(QByteArray::number(b->tid))
+           .append(",\"args\":{\"name\":").append(jsonString(b->name)).append("}},\n");
+        QMutexLocker bufferLock(&b->mutex);
+        for (Event const& e : b->events) writeEvent(out, e, b->tid);
+    }
+    out.append("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"tera\"}}\n]}\n");
+    // writers still recording were waited for under the buffer locks above
+    qDeleteAll(buffers);
+    buffers.clear();
+
+    QSaveFile f(tracePath);
+    if (!f.open(QIODevice::WriteOnly) || f.write(out) != out.size() || !f.commit()) {
+        error = QString("Can't write trace file '%1': %2").arg(tracePath, f.errorString());
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,68 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <atomic>
+
+#include <QString>
+
+namespace ria_tera {
+
+///
+/// \brief Timing of processing stages in Chrome trace-event format.
+///
+/// Events are kept in per-thread buffers while tracing and written as JSON
+/// by close(); the file opens in chrome://tracing and Perfetto. When
+/// tracing is off a span costs one relaxed atomic load.
+///
+class Trace {
+public:
+    static bool open(QString const& path, QString& error);
+    /// Writes the events and stops tracing
+    static bool close(QString& error);
+    static bool enabled() { return active.load(std::memory_order_relaxed); };
+    /// Microseconds since open()
+    static qint64 now();
+
+    /// Span on the calling thread; fileId < 0 if not about a file
+    static void complete(char const* name, char const* cat, qint64 startUs, qint64 endUs, qint64 fileId = -1);
+    /// Span that isn't bound to a thread, ex. a network request; spans of one id nest
+    static void async(char const* name, char const* cat, qint64 id, qint64 startUs, qint64 endUs, qint64 fileId = -1);
+
+    /// Records a complete() span for its own lifetime
+    class Span {
+    public:
+        Span(char const* name, char const* cat, qint64 fileId = -1) :
+            name(name), cat(cat), fileId(fileId), start(enabled() ? now() : -1) {};
+        ~Span() { if (start >= 0) complete(name, cat, start, now(), fileId); };
+    private:
+        char const* name;
+        char const* cat;
+        qint64 fileId;
+        qint64 start;
+    };
+private:
+    static std::atomic<bool> active;
+};
+
+}
+
+#endif /* TRACE_H_ */
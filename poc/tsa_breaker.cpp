@@ -0,0 +1,117 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "tsa_breaker.h"
+
+#include <cstdlib>
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+#include <QRandomGenerator>
+#else
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QThread>
+#include <QThreadStorage>
+#endif
+
+namespace ria_tera {
+
+TsaCircuitBreaker::TsaCircuitBreaker() {
+    reset();
+}
+
+void TsaCircuitBreaker::setParameters(Parameters const& p) {
+    params = p;
+    params.failureThreshold = qMax(1, params.failureThreshold);
+    params.maxDelayMs = qMax(params.baseDelayMs, params.maxDelayMs);
+    params.jitter = qBound(0.0, params.jitter, 1.0);
+    reset();
+}
+
+void TsaCircuitBreaker::reset() {
+    st = CLOSED;
+    failures = 0;
+    opens = 0;
+    delayMs = 0;
+    outage.invalidate();
+}
+
+qint64 TsaCircuitBreaker::backoff(qint64 baseMs, int attempt, qint64 maxMs, double jitter) {
+    qint64 d = baseMs;
+    for (int i = 1; i < attempt && d < maxMs; ++i) d *= 2;
+    d = qMin(d, maxMs);
+    // spread clients and requests coming back at the same time
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    double r = QRandomGenerator::global()->generateDouble();
+#else
+    // qrand() is per thread and unseeded gives the same sequence in every client
+    static QThreadStorage<bool> seeded;
+    if (!seeded.hasLocalData()) {
+        qsrand(uint(QDateTime::currentMSecsSinceEpoch()) ^ uint(QCoreApplication::applicationPid()) ^
+               uint(quintptr(QThread::currentThreadId())));
+        seeded.setLocalData(true);
+    }
+    double r = (double)qrand() / RAND_MAX;
+#endif
+    return d - (qint64)(d * jitter * r);
+}
+
+bool TsaCircuitBreaker::onResponse(TsaOutcome outcome) {
+    if (TSA_SUCCESS == outcome || TSA_THROTTLED == outcome) {
+        // server is there, quota is handled elsewhere
+        failures = 0;
+        return false;
+    }
+    ++failures;
+    if (CLOSED == st && failures >= params.failureThreshold) {
+        outage.start();
+        open();
+        return true;
+    }
+    return false;
+}
+
+void TsaCircuitBreaker::open() {
+    st = OPEN;
+    ++opens;
+    delayMs = backoff(params.baseDelayMs, opens, params.maxDelayMs, params.jitter);
+}
+
+void TsaCircuitBreaker::probeStarted() {
+    if (OPEN == st) st = HALF_OPEN;
+}
+
+void TsaCircuitBreaker::probeFinished(bool success) {
+    if (HALF_OPEN != st) return;
+    if (success) {
+        reset();
+    } else {
+        open();
+    }
+}
+
+qint64 TsaCircuitBreaker::outageMs() const {
+    return (CLOSED == st || !outage.isValid()) ? 0 : outage.elapsed();
+}
+
+bool TsaCircuitBreaker::outageTooLong() const {
+    return params.maxOutageMs > 0 && outageMs() > params.maxOutageMs;
+}
+
+}
@@ -0,0 +1,87 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef TSA_BREAKER_H_
+#define TSA_BREAKER_H_
+
+#include <QElapsedTimer>
+#include <QtGlobal>
+
+#include "tsa_concurrency.h"
+
+namespace ria_tera {
+
+///
+/// \brief Circuit breaker that stops sending files while time server is down.
+///
+/// After failureThreshold network failures in a row (timeouts, 5xx, connection errors)
+/// the breaker opens. While open no files are sent; after a backoff delay a single cheap
+/// probe is sent (half-open). A successful probe closes the breaker, a failed one opens
+/// it again with doubled delay.
+///
+class TsaCircuitBreaker {
+public:
+    enum State {CLOSED, OPEN, HALF_OPEN};
+    class Parameters {
+    public:
+        int failureThreshold = 3;
+        qint64 baseDelayMs = 2000;
+        qint64 maxDelayMs = 5 * 60 * 1000;
+        /// part of the delay that is randomized
+        double jitter = 0.5;
+        /// give up when time server has been down that long, 0 - never
+        qint64 maxOutageMs = 60 * 60 * 1000;
+    };
+
+    TsaCircuitBreaker();
+
+    void setParameters(Parameters const& p);
+    Parameters const& parameters() const { return params; };
+    void reset();
+
+    State state() const { return st; };
+    bool allowsRequests() const { return CLOSED == st; };
+    int consecutiveFailures() const { return failures; };
+
+    /// Returns true if the breaker opened because of that response
+    bool onResponse(TsaOutcome outcome);
+    /// Delay before the next probe, valid when open
+    qint64 probeDelay() const { return delayMs; };
+    void probeStarted();
+    void probeFinished(bool success);
+    /// How long time server has been unavailable, 0 if closed
+    qint64 outageMs() const;
+    bool outageTooLong() const;
+
+    /// base * 2^(attempt-1), capped by max, with jitter part of it randomized
+    static qint64 backoff(qint64 baseMs, int attempt, qint64 maxMs, double jitter);
+private:
+    void open();
+
+    Parameters params;
+    State st;
+    int failures;
+    int opens;
+    qint64 delayMs;
+    QElapsedTimer outage;
+};
+
+}
+
+#endif /* TSA_BREAKER_H_ */
@@ -0,0 +1,102 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "tsa_concurrency.h"
+
+#include <algorithm>
+
+namespace ria_tera {
+
+TsaOutcome tsa_outcome(int httpStatus, bool timedOut, bool networkError) {
+    if (timedOut) return TSA_TIMEOUT;
+    if (403 == httpStatus || 429 == httpStatus) return TSA_THROTTLED;
+    if (httpStatus >= 500 && httpStatus < 600) return TSA_SERVER_ERROR;
+    if (networkError) return TSA_OTHER_ERROR;
+    return TSA_SUCCESS;
+}
+
+TsaConcurrencyController::TsaConcurrencyController() {
+    reset();
+}
+
+TsaConcurrencyController::TsaConcurrencyController(Parameters const& p) : params(p) {
+    reset();
+}
+
+void TsaConcurrencyController::setParameters(Parameters const& p) {
+    params = p;
+    params.minWindow = std::max(1, params.minWindow);
+    params.maxWindow = std::max(params.minWindow, params.maxWindow);
+    params.sampleSize = std::max(1, params.sampleSize);
+    reset();
+}
+
+void TsaConcurrencyController::reset() {
+    windowSize = qBound(params.minWindow, params.initialWindow, params.maxWindow);
+    samples.clear();
+    samplePos = 0;
+    baseline = -1;
+    sinceDecrease = 0;
+}
+
+int TsaConcurrencyController::window() const {
+    return qBound(params.minWindow, (int)windowSize, params.maxWindow);
+}
+
+void TsaConcurrencyController::onResponse(qint64 latencyMs, TsaOutcome outcome) {
+    ++sinceDecrease;
+
+    if (TSA_SUCCESS != outcome) {
+        if (TSA_OTHER_ERROR == outcome) return;
+        // responses to requests sent before the last cut don't cut again
+        if (sinceDecrease < window()) return;
+        windowSize = std::max<double>(params.minWindow, windowSize * params.decreaseFactor);
+        sinceDecrease = 0;
+        return;
+    }
+
+    addSample(latencyMs);
+    qint64 cur = p95();
+    if (cur < 0) return;
+    if (baseline < 0 || cur < baseline) baseline = cur;
+
+    if (cur <= baseline * (1.0 + params.latencyTolerance)) {
+        // +1 per window worth of successful responses
+        windowSize = std::min<double>(params.maxWindow, windowSize + 1.0 / windowSize);
+    }
+}
+
+void TsaConcurrencyController::addSample(qint64 latencyMs) {
+    if (samples.size() < params.sampleSize) {
+        samples.append(latencyMs);
+    } else {
+        samples[samplePos] = latencyMs;
+        samplePos = (samplePos + 1) % params.sampleSize;
+    }
+}
+
+qint64 TsaConcurrencyController::p95() const {
+    if (samples.size() < params.minSamples || samples.isEmpty()) return -1;
+    QVector<qint64> sorted(samples);
+    int idx = std::min(sorted.size() - 1, (int)(sorted.size() * 0.95));
+    std::nth_element(sorted.begin(), sorted.begin() + idx, sorted.end());
+    return sorted[idx];
+}
+
+}
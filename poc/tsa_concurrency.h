@@ -0,0 +1,84 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef TSA_CONCURRENCY_H_
+#define TSA_CONCURRENCY_H_
+
+#include <QVector>
+#include <QtGlobal>
+
+namespace ria_tera {
+
+/// Outcome of one request to time server as seen by the concurrency controller
+enum TsaOutcome : int {TSA_SUCCESS = 0, TSA_THROTTLED, TSA_SERVER_ERROR, TSA_TIMEOUT, TSA_OTHER_ERROR};
+
+TsaOutcome tsa_outcome(int httpStatus, bool timedOut, bool networkError);
+
+///
+/// \brief AIMD controller for the number of parallel time server requests.
+///
+/// Window grows by one per window worth of successful responses as long as
+/// p95 latency stays within tolerance of the best p95 seen. Throttling (403/429),
+/// server errors (5xx) and timeouts cut the window multiplicatively, at most once
+/// per window worth of responses. Has no network dependencies, so it can be fed
+/// with scripted latency/error profiles.
+///
+class TsaConcurrencyController {
+public:
+    class Parameters {
+    public:
+        int initialWindow = 1;
+        int minWindow = 1;
+        int maxWindow = 8;
+        double decreaseFactor = 0.5;
+        /// p95 may exceed baseline by that fraction and still count as flat
+        double latencyTolerance = 0.25;
+        /// number of latest latencies p95 is calculated from
+        int sampleSize = 32;
+        /// no p95 decisions before that many samples
+        int minSamples = 8;
+    };
+
+    TsaConcurrencyController();
+    explicit TsaConcurrencyController(Parameters const& p);
+
+    void setParameters(Parameters const& p);
+    Parameters const& parameters() const { return params; };
+    void reset();
+
+    int window() const;
+    void onResponse(qint64 latencyMs, TsaOutcome outcome);
+
+    /// p95 latency of the latest samples, -1 if not enough samples
+    qint64 p95() const;
+    qint64 baselineP95() const { return baseline; };
+private:
+    void addSample(qint64 latencyMs);
+
+    Parameters params;
+    double windowSize;
+    QVector<qint64> samples;
+    int samplePos;
+    qint64 baseline;
+    int sinceDecrease;
+};
+
+}
+
+#endif /* TSA_CONCURRENCY_H_ */
@@ -0,0 +1,230 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "tsa_pool.h"
+
+#include "logging.h"
+
+namespace ria_tera {
+
+TsaEndpointPool::TsaEndpointPool() {
+    clock.start();
+}
+
+void TsaEndpointPool::setParameters(Parameters const& p) {
+    params = p;
+    params.ejectAfterErrors = qMax(1, params.ejectAfterErrors);
+    params.maxEjectMs = qMax(params.ejectMs, params.maxEjectMs);
+}
+
+void TsaEndpointPool::clear() {
+    endpoints.clear();
+}
+
+int TsaEndpointPool::add(QString const& url, TimeStamperRequestConfigurationFactory* configurator) {
+    Endpoint e;
+    e.url = url;
+    e.configurator = configurator;
+    e.quota.reset(new TsaQuota());
+    endpoints.append(e);
+    return endpoints.size() - 1;
+}
+
+double TsaEndpointPool::cost(Endpoint const& e) const {
+    // unknown latency counts as fast, so new endpoints get tried
+    double latency = (e.samples > 0 ? e.latencyMs : 0) + 100.0;
+    return latency * (1 + e.inFlight) / qMax(0.05, 1.0 - e.errorRate);
+}
+
+void TsaEndpointPool::configureQuotas(QHash<QString, TsaQuota::Limits> const& limits) {
+    for (Endpoint& e : endpoints) {
+        e.quota->configure(e.url, limits.value(e.url));
+    }
+}
+
+TsaQuota::Grant TsaEndpointPool::quotaState(qint64& waitMs) const {
+    TsaQuota::Grant state = TsaQuota::EXHAUSTED;
+    waitMs = 0;
+    for (Endpoint const& e : endpoints) {
+        qint64 w = 0;
+        TsaQuota::Grant g = e.quota->check(w);
+        if (TsaQuota::GRANTED == g) return g;
+        if (TsaQuota::WAIT == g && (TsaQuota::EXHAUSTED == state || w < waitMs)) {
+            state = TsaQuota::WAIT;
+            waitMs = w;
+        }
+    }
+    return state;
+}
+
+int TsaEndpointPool::acquireQuota(TsaQuota::Grant& grant, qint64& waitMs) {
+    int idx = pick(true);
+    grant = (idx >= 0 ? endpoints.at(idx).quota->acquire(waitMs) : quotaState(waitMs));
+    return (TsaQuota::GRANTED == grant ? idx : -1);
+}
+
+bool TsaEndpointPool::isQuotaLimited() const {
+    for (Endpoint const& e : endpoints) {
+        if (e.quota->isLimited()) return true;
+    }
+    return false;
+}
+
+int TsaEndpointPool::quotaUsedToday() const {
+    int cnt = 0;
+    for (Endpoint const& e : endpoints) {
+        if (e.quota->isLimited()) cnt += e.quota->usedToday();
+    }
+    return cnt;
+}
+
+int TsaEndpointPool::quotaUsedThisMonth() const {
+    int cnt = 0;
+    for (Endpoint const& e : endpoints) {
+        if (e.quota->isLimited()) cnt += e.quota->usedThisMonth();
+    }
+    return cnt;
+}
+
+QDateTime TsaEndpointPool::estimateQuotaClearTime(int backlog) const {
+    QDateTime best;
+    for (Endpoint const& e : endpoints) {
+        QDateTime t = e.quota->estimateClearTime(backlog);
+        if (t.isValid() && (!best.isValid() || t < best)) best = t;
+    }
+    return best;
+}
+
+void TsaEndpointPool::flushQuotas() {
+    for (Endpoint& e : endpoints) {
+        e.quota->flush();
+    }
+}
+
+int TsaEndpointPool::pick() {
+    int best = pick(true);
+    // all are out of quota, server will answer that
+    return (best >= 0 ? best : pick(false));
+}
+
+int TsaEndpointPool::pick(bool withQuota) {
+    qint64 now = clock.elapsed();
+    int best = -1;
+    double bestCost = 0;
+    qint64 waitMs = 0;
+    for (int i = 0; i < endpoints.size(); ++i) {
+        Endpoint const& e = endpoints.at(i);
+        if (withQuota && TsaQuota::GRANTED != e.quota->check(waitMs)) continue;
+        if (e.ejectedUntil > now) continue;
+        // one probe at a time to an endpoint that just came back
+        if (e.ejectMs > 0 && e.inFlight > 0) continue;
+        double c = cost(e);
+        if (best < 0 || c < bestCost) {
+            best = i;
+            bestCost = c;
+        }
+    }
+    if (best >= 0) return best;
+
+    // everything is ejected, use the one coming back first
+    for (int i = 0; i < endpoints.size(); ++i) {
+        if (withQuota && TsaQuota::GRANTED != endpoints.at(i).quota->check(waitMs)) continue;
+        if (best < 0 || endpoints.at(i).ejectedUntil < endpoints.at(best).ejectedUntil) best = i;
+    }
+    return best;
+}
+
+void TsaEndpointPool::onSent(int idx, bool charge) {
+    if (idx < 0 || idx >= endpoints.size()) return;
+    Endpoint& e = endpoints[idx];
+    ++e.inFlight;
+    ++e.sent;
+    if (charge) e.quota->recordSent();
+}
+
+void TsaEndpointPool::onResponse(int idx, qint64 latencyMs, TsaOutcome outcome) {
+    if (idx < 0 || idx >= endpoints.size()) return;
+    Endpoint& e = endpoints[idx];
+    e.inFlight = qMax(0, e.inFlight - 1);
+
+    double a = params.ewmaAlpha;
+    if (TSA_SUCCESS == outcome) {
+        e.latencyMs = (0 == e.samples ? latencyMs : (1 - a) * e.latencyMs + a * latencyMs);
+        ++e.samples;
+        e.errorRate = (1 - a) * e.errorRate;
+        e.consecutiveErrors = 0;
+        if (e.ejectMs > 0) {
+            TERA_LOG(info) << "Time server " << e.url << " is back in use";
+            e.ejectMs = 0;
+        }
+        return;
+    }
+
+    ++e.samples;
+    ++e.failed;
+    ++e.consecutiveErrors;
+    e.errorRate = (1 - a) * e.errorRate + a;
+
+    if (e.ejectMs > 0) {
+        // failed right after coming back
+        eject(e, qMin(params.maxEjectMs, e.ejectMs * 2));
+    } else if (e.consecutiveErrors >= params.ejectAfterErrors ||
+            (e.samples >= params.ejectMinSamples && e.errorRate >= params.ejectErrorRate)) {
+        eject(e, params.ejectMs);
+    }
+}
+
+void TsaEndpointPool::eject(Endpoint& e, qint64 ms) {
+    e.ejectMs = ms;
+    e.ejectedUntil = clock.elapsed() + ms;
+    e.consecutiveErrors = 0;
+    ++e.ejections;
+    if (endpoints.size() > 1) {
+        TERA_LOG(warn) << "Time server " << e.url << " is not used for " << (ms / 1000) << "s, error rate " <<
+                QString::number(e.errorRate, 'f', 2);
+    }
+}
+
+bool TsaEndpointPool::quotaExhausted(int idx) {
+    if (idx < 0 || idx >= endpoints.size()) return false;
+    endpoints[idx].quota->markExhausted();
+    qint64 waitMs = 0;
+    return TsaQuota::EXHAUSTED != quotaState(waitMs);
+}
+
+bool TsaEndpointPool::isEjected(int idx) const {
+    return endpoints.at(idx).ejectedUntil > clock.elapsed();
+}
+
+int TsaEndpointPool::healthyCount() const {
+    int cnt = 0;
+    for (int i = 0; i < endpoints.size(); ++i) {
+        if (!isEjected(i)) ++cnt;
+    }
+    return cnt;
+}
+
+void TsaEndpointPool::logStats() const {
+    for (Endpoint const& e : endpoints) {
+        TERA_LOG(info) << "Time server " << e.url << ": requests " << e.sent << ", failed " << e.failed <<
+                ", avg latency " << (qint64)e.latencyMs << "ms, ejected " << e.ejections << " times";
+    }
+}
+
+}
@@ -0,0 +1,126 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef TSA_POOL_H_
+#define TSA_POOL_H_
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include "tsa_concurrency.h"
+#include "tsa_quota.h"
+
+namespace ria_tera {
+
+class TimeStamperRequestConfigurationFactory;
+
+///
+/// \brief Set of time server endpoints requests are spread over.
+///
+/// Each endpoint keeps EWMA of latency and error rate. The next request goes to
+/// the endpoint with the lowest expected cost (latency scaled by in-flight requests
+/// and errors). An endpoint with repeated failures is ejected for a while, the
+/// ejection time doubles every time it fails again right after coming back.
+/// Every endpoint has its own quota ledger, endpoints out of quota are skipped.
+///
+class TsaEndpointPool {
+public:
+    class Parameters {
+    public:
+        /// weight of the newest sample in EWMA
+        double ewmaAlpha = 0.2;
+        /// eject after that many failures in a row
+        int ejectAfterErrors = 5;
+        /// or when error rate gets over that
+        double ejectErrorRate = 0.5;
+        int ejectMinSamples = 10;
+        qint64 ejectMs = 30 * 1000;
+        qint64 maxEjectMs = 10 * 60 * 1000;
+    };
+    class Endpoint {
+    public:
+        QString url;
+        /// authentication and trust settings, nullptr - defaults
+        TimeStamperRequestConfigurationFactory* configurator = nullptr;
+
+        double latencyMs = 0;
+        double errorRate = 0;
+        int samples = 0;
+        int inFlight = 0;
+        int consecutiveErrors = 0;
+        int ejections = 0;
+        qint64 ejectMs = 0;
+        /// pool clock, 0 - not ejected
+        qint64 ejectedUntil = 0;
+        qint64 sent = 0;
+        qint64 failed = 0;
+        /// never null, unlimited unless configureQuotas has limits for url
+        QSharedPointer<TsaQuota> quota;
+    };
+
+    TsaEndpointPool();
+
+    void setParameters(Parameters const& p);
+    void clear();
+    int add(QString const& url, TimeStamperRequestConfigurationFactory* configurator);
+    int size() const { return endpoints.size(); };
+    Endpoint const& at(int idx) const { return endpoints.at(idx); };
+
+    /// Quota limits by url, endpoints not listed are unlimited; ledgers are read again
+    void configureQuotas(QHash<QString, TsaQuota::Limits> const& limits);
+    /// GRANTED if some endpoint's quota allows a request now, WAIT with waitMs if one
+    /// allows it later, EXHAUSTED if all are used up
+    TsaQuota::Grant quotaState(qint64& waitMs) const;
+    /// Endpoint for the next file request, a rate token is taken from its quota.
+    /// -1 if no endpoint's quota allows a request now, grant and waitMs as in quotaState
+    int acquireQuota(TsaQuota::Grant& grant, qint64& waitMs);
+    bool isQuotaLimited() const;
+    int quotaUsedToday() const;
+    int quotaUsedThisMonth() const;
+    /// Estimated time when some endpoint's quota allows backlog requests
+    QDateTime estimateQuotaClearTime(int backlog) const;
+    void flushQuotas();
+
+    /// Endpoint for the next request, -1 if pool is empty
+    int pick();
+    /// charge - count the request against the endpoint's quota
+    void onSent(int idx, bool charge);
+    void onResponse(int idx, qint64 latencyMs, TsaOutcome outcome);
+    /// Endpoint refused because of its quota, it is not used until the quota is renewed.
+    /// Returns true if some other endpoint can take the request.
+    bool quotaExhausted(int idx);
+    bool isEjected(int idx) const;
+    int healthyCount() const;
+    void logStats() const;
+private:
+    double cost(Endpoint const& e) const;
+    int pick(bool withQuota);
+    void eject(Endpoint& e, qint64 ms);
+
+    Parameters params;
+    QVector<Endpoint> endpoints;
+    QElapsedTimer clock;
+};
+
+}
+
+#endif /* TSA_POOL_H_ */
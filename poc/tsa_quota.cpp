@@ -0,0 +1,217 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "tsa_quota.h"
+
+#include <QStandardPaths>
+#include <QStringList>
+#include <QUrl>
+
+#include "logging.h"
+
+namespace {
+
+QString const DAY_FORMAT("yyyyMMdd");
+QString const MONTH_FORMAT("yyyyMM");
+
+QDateTime startOfDay(QDate const& d) {
+    return QDateTime(d, QTime(0, 0));
+}
+
+}
+
+namespace ria_tera {
+
+TsaQuota::Limits TsaQuota::Limits::parse(QString const& spec, bool* ok) {
+    Limits l;
+    bool res = true;
+    for (QString const& item : spec.split(' ', QString::SkipEmptyParts)) {
+        int eq = item.indexOf('=');
+        QString key = item.left(eq).trimmed();
+        QString val = (eq >= 0 ? item.mid(eq + 1).trimmed() : QString());
+        bool valOk = false;
+        if ("per_day" == key) l.perDay = val.toInt(&valOk);
+        else if ("per_month" == key) l.perMonth = val.toInt(&valOk);
+        else if ("rate" == key) l.rate = val.toDouble(&valOk);
+        else if ("burst" == key) l.burst = val.toInt(&valOk);
+        if (!valOk) res = false;
+    }
+    l.burst = qMax(1, l.burst);
+    if (ok) *ok = res;
+    return l;
+}
+
+TsaQuota::TsaQuota() : dayCount(0), monthCount(0), unsaved(0), tokens(0) {}
+
+TsaQuota::~TsaQuota() {
+    flush();
+}
+
+QString TsaQuota::defaultLedgerPath() {
+#if QT_VERSION < QT_VERSION_CHECK(5, 4, 0)
+    return QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/tera_quota.ini";
+#else
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/tera_quota.ini";
+#endif
+}
+
+void TsaQuota::configure(QString const& url, Limits const& l, QString const& ledgerPath) {
+    flush();
+    tsUrl = url;
+    limits = l;
+    tokens = limits.burst;
+    refillTimer.start();
+    exhaustedUntil = QDateTime();
+
+    ledger.reset(new QSettings(ledgerPath, QSettings::IniFormat));
+    ledger->beginGroup(QString::fromLatin1(QUrl::toPercentEncoding(url)));
+    day = ledger->value("day").toString();
+    month = ledger->value("month").toString();
+    dayCount = ledger->value("day_count", 0).toInt();
+    monthCount = ledger->value("month_count", 0).toInt();
+    exhaustedUntil = QDateTime::fromString(ledger->value("exhausted_until").toString(), Qt::ISODate);
+    rollOver();
+}
+
+void TsaQuota::rollOver() {
+    QDate today = QDate::currentDate();
+    QString curDay = today.toString(DAY_FORMAT);
+    QString curMonth = today.toString(MONTH_FORMAT);
+    if (curMonth != month) {
+        month = curMonth;
+        monthCount = 0;
+    }
+    if (curDay != day) {
+        day = curDay;
+        dayCount = 0;
+    }
+    if (exhaustedUntil.isValid() && exhaustedUntil <= QDateTime::currentDateTime()) {
+        exhaustedUntil = QDateTime();
+    }
+}
+
+void TsaQuota::refill() {
+    if (limits.rate <= 0) return;
+    qint64 ms = refillTimer.restart();
+    tokens = qMin<double>(limits.burst, tokens + ms * limits.rate / 1000.0);
+}
+
+TsaQuota::Grant TsaQuota::check(qint64& waitMs) {
+    waitMs = 0;
+    rollOver();
+    if (exhaustedUntil.isValid()) return EXHAUSTED;
+    if (limits.perDay > 0 && dayCount >= limits.perDay) return EXHAUSTED;
+    if (limits.perMonth > 0 && monthCount >= limits.perMonth) return EXHAUSTED;
+
+    refill();
+    if (limits.rate > 0 && tokens < 1.0) {
+        waitMs = qMax<qint64>(1, (qint64)((1.0 - tokens) * 1000.0 / limits.rate) + 1);
+        return WAIT;
+    }
+    return GRANTED;
+}
+
+TsaQuota::Grant TsaQuota::acquire(qint64& waitMs) {
+    Grant grant = check(waitMs);
+    if (GRANTED == grant && limits.rate > 0) tokens -= 1.0;
+    return grant;
+}
+
+void TsaQuota::recordSent() {
+    if (ledger.isNull()) return;
+    rollOver();
+    ++dayCount;
+    ++monthCount;
+    // don't write the file on every request
+    if (++unsaved >= 20) save();
+}
+
+void TsaQuota::markExhausted() {
+    rollOver();
+    QDate today = QDate::currentDate();
+    if (limits.perMonth > 0 && monthCount >= limits.perMonth) {
+        exhaustedUntil = startOfDay(QDate(today.year(), today.month(), 1).addMonths(1));
+    } else {
+        exhaustedUntil = startOfDay(today.addDays(1));
+    }
+    TERA_LOG(warn) << "Time server quota exhausted for " << tsUrl << " until " << exhaustedUntil.toString(Qt::ISODate);
+    save();
+}
+
+void TsaQuota::flush() {
+    if (unsaved > 0 || exhaustedUntil.isValid()) save();
+}
+
+void TsaQuota::save() {
+    if (ledger.isNull()) return;
+    ledger->setValue("day", day);
+    ledger->setValue("month", month);
+    ledger->setValue("day_count", dayCount);
+    ledger->setValue("month_count", monthCount);
+    if (exhaustedUntil.isValid()) ledger->setValue("exhausted_until", exhaustedUntil.toString(Qt::ISODate));
+    else ledger->remove("exhausted_until");
+    ledger->sync();
+    unsaved = 0;
+}
+
+QDateTime TsaQuota::estimateClearTime(int backlog) const {
+    QDateTime now = QDateTime::currentDateTime();
+    if (backlog <= 0) return now;
+    if (!limits.isLimited()) return (exhaustedUntil > now ? exhaustedUntil : now);
+
+    QDate d = now.date();
+    int usedDay = (d.toString(DAY_FORMAT) == day ? dayCount : 0);
+    int usedMonth = (d.toString(MONTH_FORMAT) == month ? monthCount : 0);
+    QDateTime from = now;
+    if (exhaustedUntil.isValid() && exhaustedUntil > now) {
+        from = exhaustedUntil;
+        d = from.date();
+        usedDay = 0;
+        if (d.month() != now.date().month()) usedMonth = 0;
+    }
+
+    int left = backlog;
+    for (int i = 0; i < 3660; ++i) {
+        if (i > 0) {
+            QDate next = d.addDays(1);
+            if (next.month() != d.month()) usedMonth = 0;
+            d = next;
+            usedDay = 0;
+            from = startOfDay(d);
+        }
+
+        qint64 cap = left;
+        if (limits.perDay > 0) cap = qMin<qint64>(cap, qMax(0, limits.perDay - usedDay));
+        if (limits.perMonth > 0) cap = qMin<qint64>(cap, qMax(0, limits.perMonth - usedMonth));
+        if (limits.rate > 0) {
+            qint64 secondsLeft = from.secsTo(startOfDay(d.addDays(1)));
+            cap = qMin<qint64>(cap, (qint64)(secondsLeft * limits.rate) + limits.burst);
+        }
+
+        if (cap >= left) {
+            qint64 secs = (limits.rate > 0 ? (qint64)(left / limits.rate) : 0);
+            return from.addSecs(secs);
+        }
+        left -= cap;
+        usedMonth += cap;
+    }
+    return QDateTime();
+}
+
+}
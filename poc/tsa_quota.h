@@ -0,0 +1,94 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef TSA_QUOTA_H_
+#define TSA_QUOTA_H_
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QSettings>
+#include <QString>
+
+namespace ria_tera {
+
+///
+/// \brief Daily/monthly request budget of one time server plus token bucket for request rate.
+///
+/// Used requests are kept in a ledger file, so the budget is shared by consecutive runs.
+///
+class TsaQuota {
+public:
+    class Limits {
+    public:
+        /// 0 - no limit
+        int perDay = 0;
+        int perMonth = 0;
+        /// token bucket, requests per second; 0 - no limit
+        double rate = 0;
+        int burst = 1;
+        bool isLimited() const { return perDay > 0 || perMonth > 0 || rate > 0; };
+        /// "per_day=5000 per_month=25000 rate=2 burst=10"
+        static Limits parse(QString const& spec, bool* ok = nullptr);
+    };
+    enum Grant {GRANTED, WAIT, EXHAUSTED};
+
+    TsaQuota();
+    ~TsaQuota();
+
+    static QString defaultLedgerPath();
+    void configure(QString const& url, Limits const& limits, QString const& ledgerPath = defaultLedgerPath());
+    bool isLimited() const { return limits.isLimited(); };
+    QString url() const { return tsUrl; };
+
+    /// May one more request be sent now, nothing is taken
+    Grant check(qint64& waitMs);
+    /// check() and take a rate token, requests are counted as used when posted
+    Grant acquire(qint64& waitMs);
+    /// A request was posted to time server
+    void recordSent();
+    /// Time server said quota is exhausted
+    void markExhausted();
+    void flush();
+
+    int usedToday() const { return dayCount; };
+    int usedThisMonth() const { return monthCount; };
+    /// Estimated time when backlog requests can be sent
+    QDateTime estimateClearTime(int backlog) const;
+private:
+    void rollOver();
+    void refill();
+    void save();
+
+    QString tsUrl;
+    Limits limits;
+    QScopedPointer<QSettings> ledger;
+    QString day;
+    QString month;
+    int dayCount;
+    int monthCount;
+    int unsaved;
+    QDateTime exhaustedUntil;
+    double tokens;
+    QElapsedTimer refillTimer;
+};
+
+}
+
+#endif /* TSA_QUOTA_H_ */
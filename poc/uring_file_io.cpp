@@ -0,0 +1,270 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "uring_file_io.h"
+
+#ifdef TERA_USE_IO_URING
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+int sysSetup(unsigned entries, io_uring_params* p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0));
+}
+
+int sysRegister(int fd, unsigned opcode, void const* arg, unsigned nrArgs) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+enum Step : uint64_t {OPEN, IO, ADVISE, CLOSE};
+
+uint64_t userData(size_t file, Step step) {
+    return (static_cast<uint64_t>(file) << 2) | step;
+}
+
+}
+
+namespace ria_tera {
+
+UringFileIo::UringFileIo(unsigned depth) : ringFd(-1), entries(0), slots(0), canFadvise(false),
+    sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED), cqRingSize(0), sqes(nullptr), sqesSize(0),
+    sqHead(nullptr), sqTail(nullptr), sqMask(0), sqArray(nullptr), sqLocalTail(0),
+    cqHead(nullptr), cqTail(nullptr), cqMask(0), cqes(nullptr)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ringFd = sysSetup(depth, &p);
+    if (ringFd < 0) return;
+    entries = p.sq_entries;
+
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) sqRingSize = cqRingSize = (sqRingSize > cqRingSize ? sqRingSize : cqRingSize);
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == sqRing) {
+        teardown();
+        return;
+    }
+    cqRing = single ? sqRing : mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* s = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (MAP_FAILED == cqRing || MAP_FAILED == s) {
+        if (MAP_FAILED != s) munmap(s, sqesSize);
+        teardown();
+        return;
+    }
+    sqes = static_cast<io_uring_sqe*>(s);
+
+    char* sq = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sqLocalTail = *sqTail;
+    char* cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes = cq + p.cq_off.cqes;
+
+    // direct descriptor table, empty slots
+    slots = entries / 4;
+    std::vector<int> fds(slots, -1);
+    if (0 == slots || sysRegister(ringFd, IORING_REGISTER_FILES, fds.data(), slots) < 0) {
+        teardown();
+        return;
+    }
+    // all ops of the chains have to be known to the kernel
+    std::vector<char> probeBuf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probeBuf.data());
+    if (sysRegister(ringFd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        teardown();
+        return;
+    }
+    for (unsigned op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            teardown();
+            return;
+        }
+    }
+    canFadvise = (IORING_OP_FADVISE <= probe->last_op && (probe->ops[IORING_OP_FADVISE].flags & IO_URING_OP_SUPPORTED));
+    // the ops are there since 5.6, file_index only since 5.15
+    if (ok() && !directDescriptorsWork()) teardown();
+}
+
+UringFileIo::~UringFileIo() {
+    teardown();
+}
+
+void UringFileIo::teardown() {
+    if (nullptr != sqes) munmap(sqes, sqesSize);
+    if (MAP_FAILED != cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if (MAP_FAILED != sqRing) munmap(sqRing, sqRingSize);
+    sqes = nullptr;
+    sqRing = cqRing = MAP_FAILED;
+    if (ringFd >= 0) close(ringFd);
+    ringFd = -1;
+}
+
+io_uring_sqe* UringFileIo::nextSqe() {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqLocalTail - head >= entries) return nullptr;
+    unsigned idx = sqLocalTail & sqMask;
+    io_uring_sqe* sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[idx] = idx;
+    ++sqLocalTail;
+    return sqe;
+}
+
+template <class F>
+bool UringFileIo::submitAndReap(unsigned cnt, F onCqe) {
+    unsigned toSubmit = sqLocalTail - *sqTail;
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    io_uring_cqe* ring = static_cast<io_uring_cqe*>(cqes);
+    unsigned reaped = 0;
+    while (reaped < cnt) {
+        int r = sysEnter(ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+        if (r < 0 && EINTR != errno) {
+            // ring state is unknown now, closing it cancels what the kernel still holds
+            teardown();
+            return false;
+        }
+        if (r > 0) toSubmit -= (static_cast<unsigned>(r) < toSubmit ? static_cast<unsigned>(r) : toSubmit);
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head, ++reaped) {
+            io_uring_cqe const& cqe = ring[head & cqMask];
+            onCqe(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+bool UringFileIo::directDescriptorsWork() {
+    // older kernels reject file_index or ignore it and return a regular descriptor,
+    // that one may be 0 when stdin is closed
+    bool stdinOpen = (fcntl(0, F_GETFD) >= 0);
+    int openRes = -1;
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>("/");
+    sqe->open_flags = O_RDONLY;
+    sqe->file_index = 1;
+    sqe->user_data = userData(0, OPEN);
+    if (!submitAndReap(1, [&](uint64_t, int res) { openRes = res; })) return false;
+    if (openRes > 0 || (0 == openRes && !stdinOpen && fcntl(0, F_GETFD) >= 0)) {
+        close(openRes);
+        return false;
+    }
+    if (0 != openRes) return false;
+
+    int closeRes = -1;
+    sqe = nextSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = 1;
+    sqe->user_data = userData(0, CLOSE);
+    if (!submitAndReap(1, [&](uint64_t, int res) { closeRes = res; })) return false;
+    return 0 == closeRes;
+}
+
+void UringFileIo::readFiles(char const* const* paths, char* const* bufs, uint32_t const* caps, int64_t* result, size_t n,
+                            bool dropCache) {
+    if (!ok()) {
+        for (size_t i = 0; i < n; ++i) result[i] = -EIO;
+        return;
+    }
+    bool advise = (dropCache && canFadvise);
+    for (size_t first = 0; first < n; first += slots) {
+        size_t cnt = (n - first < slots ? n - first : slots);
+        for (size_t j = 0; j < cnt; ++j) {
+            size_t i = first + j;
+            result[i] = -ECANCELED;
+            io_uring_sqe* sqe = nextSqe();
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uint64_t>(paths[i]);
+            sqe->open_flags = O_RDONLY; // O_CLOEXEC is not allowed with direct descriptors
+            sqe->file_index = static_cast<uint32_t>(j + 1);
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = userData(i, OPEN);
+
+            // hard link: close must run even though read is short (file smaller than buffer)
+            sqe = nextSqe();
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = static_cast<int>(j);
+            sqe->addr = reinterpret_cast<uint64_t>(bufs[i]);
+            sqe->len = caps[i];
+            sqe->off = 0;
+            sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+            sqe->user_data = userData(i, IO);
+
+            if (advise) {
+                sqe = nextSqe();
+                sqe->opcode = IORING_OP_FADVISE;
+                sqe->fd = static_cast<int>(j);
+                sqe->off = 0;
+                sqe->len = 0;
+                sqe->fadvise_advice = POSIX_FADV_DONTNEED;
+                sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+                sqe->user_data = userData(i, ADVISE);
+            }
+
+            sqe = nextSqe();
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->file_index = static_cast<uint32_t>(j + 1);
+            sqe->user_data = userData(i, CLOSE);
+        }
+        unsigned perFile = (advise ? 4 : 3);
+        bool done = submitAndReap(static_cast<unsigned>(perFile * cnt), [&](uint64_t ud, int res) {
+            size_t i = static_cast<size_t>(ud >> 2);
+            Step step = static_cast<Step>(ud & 3);
+            if (OPEN == step && res < 0) {
+                result[i] = res;
+            } else if (IO == step && -ECANCELED != res) {
+                result[i] = res;
+            }
+        });
+        if (!done) {
+            for (size_t i = first; i < n; ++i) result[i] = -EIO;
+            return;
+        }
+    }
+}
+
+}
+
+#endif
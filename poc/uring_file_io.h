@@ -0,0 +1,94 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef URING_FILE_IO_H_
+#define URING_FILE_IO_H_
+
+#ifdef TERA_USE_IO_URING
+
+#include <cstddef>
+#include <cstdint>
+
+struct io_uring_sqe;
+
+namespace ria_tera {
+
+///
+/// \brief Whole-file reads through a Linux io_uring.
+///
+/// Each file is one linked open -> read -> close chain on a direct
+/// descriptor, so a batch of files costs one io_uring_enter instead of three
+/// syscalls per file. Talks to the kernel directly (no liburing); needs
+/// Linux 5.15+ for direct descriptors, ok() is false on older kernels or when
+/// io_uring is blocked (seccomp, sysctl) and callers fall back to plain I/O.
+/// One instance per thread.
+///
+class UringFileIo {
+public:
+    explicit UringFileIo(unsigned depth = 96);
+    ~UringFileIo();
+    /// false also after io_uring_enter failed, the ring is closed then
+    bool ok() const { return ringFd >= 0; };
+
+    /// Reads files i < n into bufs[i] of caps[i] bytes; result[i] is bytes read
+    /// or -errno. A file filling its whole buffer may have been cut short.
+    /// dropCache adds POSIX_FADV_DONTNEED to each chain (if the kernel has it).
+    void readFiles(char const* const* paths, char* const* bufs, uint32_t const* caps, int64_t* result, size_t n,
+                   bool dropCache = false);
+private:
+    UringFileIo(UringFileIo const&) = delete;
+    UringFileIo& operator=(UringFileIo const&) = delete;
+
+    io_uring_sqe* nextSqe();
+    /// submits queued entries and waits until cnt completions are reaped to onCqe
+    template <class F> bool submitAndReap(unsigned cnt, F onCqe);
+    /// opens and closes a file in a direct descriptor slot
+    bool directDescriptorsWork();
+    void teardown();
+
+    int ringFd;
+    unsigned entries;
+    /// files at once, up to four entries each
+    unsigned slots;
+    bool canFadvise;
+
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    io_uring_sqe* sqes;
+    size_t sqesSize;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    unsigned sqLocalTail;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    void* cqes;
+};
+
+}
+
+#endif
+
+#endif /* URING_FILE_IO_H_ */
@@ -13,7 +13,58 @@ qdigidoc-tera [OPTIONS]
   -R                               if set then input directories are searched
                                    recursively
   --ts_url <ts_url>                time server url (default
-                                   https://puhver.ria.ee/tsa)
+                                   https://puhver.ria.ee/tsa); can be repeated,
+                                   requests are spread over healthy time
+                                   servers
+  --ts_max_requests <ts_max_requests>
+                                   maximum number of parallel time server
+                                   requests, actual number is adapted to time
+                                   server's latency and errors
+  --hash_algorithm <hash_algorithm>
+                                   hash algorithm of time-stamp requests:
+                                   sha256, sha384, sha512 or auto for the
+                                   fastest one on this machine that the
+                                   time server accepts (sha256 otherwise)
+  --page_cache <page_cache>        how input files use the OS page cache:
+                                   cached, dontneed or direct; dontneed and
+                                   direct keep large runs from evicting other
+                                   programs' data
+  --io_order <io_order>            order of files on spinning disks: none,
+                                   inode or extent (physical location); the
+                                   latter two turn random seeks into near
+                                   sequential reads
+  --resume                         time-stamp files left over by a previous run
+                                   that ran out of time server quota; can't be
+                                   used with --file_in or --dir_in
+  --journal <journal>              resume journal file
+  --spool                          hash input files into spool first and send
+                                   time-stamp requests from there; requests
+                                   not sent stay in spool
+  --flush_spool, --flush-spool     send time-stamp requests left in spool and
+                                   create their containers; can't be used with
+                                   --file_in or --dir_in
+  --spool_dir <spool_dir>          spool directory
+  --export_requests <export_requests>
+                                   hash input files and write time-stamp
+                                   requests to a bundle file, no network is
+                                   used
+  --submit_requests <submit_requests>
+                                   send time-stamp requests from a bundle file
+                                   and write time-stamps to --responses
+  --responses <responses>          responses bundle file written by
+                                   --submit_requests
+  --import_responses <import_responses>
+                                   create containers from a responses bundle
+                                   file, files are not hashed again
+  --trace_file <trace_file>        write timing of processing stages of every
+                                   file to a Chrome trace-event file (open in
+                                   chrome://tracing or Perfetto)
+  --report <report>                write latency histograms and throughput of
+                                   the run to a JSON file
+  --metrics_listen <metrics_listen>
+                                   serve Prometheus metrics of the run over
+                                   HTTP on a localhost port, host:port or UNIX
+                                   socket path
   --ext_out <ext_out>              extension for output file (default 'asics')
   --file_out <file_out>            output file, can only be used with --file_in
                                    (default <file_in>.<ext_out>)
@@ -28,5 +79,8 @@ qdigidoc-tera [OPTIONS]
                                    trace)
   --logfile_dir <logfile_dir>      logfile directory (default is current
                                    directory)
+.SH EXIT STATUS
+0 all files time-stamped, 1 errors, 2 wrong arguments, 5 time server quota
+used up and remaining files written to resume journal
 .SH SEE ALSO
 qdigidoc-tera-gui(1), digidoc-tool(1), qdigidocclient(1), qdigidoccrypto(1)
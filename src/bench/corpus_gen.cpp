@@ -0,0 +1,333 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/**
+ * Writes a synthetic input corpus for DiskCrawler and pipeline benchmarks.
+ * The same seed and options give the same tree, names and contents.
+ *
+ * The corpus mixes DDOC files, BDOC 1.0 and 2.1 containers (only 1.0 is
+ * time-stamped), files of other types, identical copies for deduplication,
+ * excluded directories (printed as --excl_dir options) and symlinks to
+ * ancestor directories that make loops for a naive crawler.
+ *
+ * Usage: tera-corpus-gen <empty or new dir> [--files 100000] [options]
+ */
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+#include <QByteArray>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QVector>
+
+#include <zlib.h>
+
+#ifndef Q_OS_WIN
+#include <unistd.h>
+#endif
+
+namespace {
+
+enum Kind {DDOC, BDOC10, BDOC21, OTHER, KIND_COUNT};
+char const* const KIND_NAMES[] = {"ddoc", "bdoc10", "bdoc21", "other"};
+char const* const OTHER_EXTENSIONS[] = {".pdf", ".txt", ".asics", ".docx", ".ddoc.bak"};
+/// names of some files and dirs get these, like real Estonian ones
+char const* const NAME_WORDS[] = {"leping", "arve", "otsus", "käskkiri", "õiend", "lisa", "Ülevaade", "protokoll"};
+
+struct Dir {
+    QString path;
+    int depth;
+};
+
+/// File size in bytes, sampled per file
+class SizeDistribution {
+public:
+    bool parse(QString const& spec) {
+        QStringList p = spec.split(':');
+        kind = p.value(0);
+        QVector<double> a;
+        for (int i = 1; i < p.size(); ++i) {
+            bool ok = false;
+            a.append(p[i].toDouble(&ok));
+            if (!ok || a.last() < 0) return false;
+        }
+        int const args = ("fixed" == kind) ? 1 : 2;
+        if (a.size() != args || !QStringList({"fixed", "uniform", "lognormal"}).contains(kind)) return false;
+        x = a[0];
+        y = a.value(1);
+        return "uniform" != kind || x <= y;
+    }
+    /// spec values are in KB
+    qint64 sample(std::mt19937_64& rng, qint64 maxBytes) const {
+        double kb = x;
+        if ("uniform" == kind) kb = std::uniform_real_distribution<double>(x, y)(rng);
+        else if ("lognormal" == kind) kb = std::lognormal_distribution<double>(std::log(qMax(x, 0.001)), y)(rng);
+        return qBound<qint64>(0, qint64(kb * 1024), maxBytes);
+    }
+private:
+    QString kind;
+    double x = 0;
+    double y = 0;
+};
+
+void put16(QByteArray& b, quint16 v) {
+    b.append(char(v & 0xff)).append(char(v >> 8));
+}
+
+void put32(QByteArray& b, quint32 v) {
+    put16(b, quint16(v & 0xffff));
+    put16(b, quint16(v >> 16));
+}
+
+/// ZIP with stored entries; mimetype goes first, as in real containers
+QByteArray storedZip(QVector<QPair<QByteArray, QByteArray>> const& entries) {
+    QByteArray zip;
+    QByteArray central;
+    for (auto const& e : entries) {
+        quint32 crc = quint32(crc32(crc32(0, nullptr, 0), reinterpret_cast<Bytef const*>(e.second.constData()), uInt(e.second.size())));
+        quint32 offset = quint32(zip.size());
+        QByteArray common;
+        put16(common, 20);         // version needed
+        put16(common, 0);          // flags
+        put16(common, 0);          // stored
+        put16(common, 0);          // time
+        put16(common, 0x21);       // date, 1980-01-01
+        put32(common, crc);
+        put32(common, quint32(e.second.size()));
+        put32(common, quint32(e.second.size()));
+        put16(common, quint16(e.first.size()));
+        put16(common, 0);          // extra field length
+
+        put32(zip, 0x04034b50);
+        zip.append(common).append(e.first).append(e.second);
+
+        put32(central, 0x02014b50);
+        put16(central, 20);        // version made by
+        central.append(common);
+        put16(central, 0);         // comment length
+        put16(central, 0);         // disk
+        put16(central, 0);         // internal attributes
+        put32(central, 0);         // external attributes
+        put32(central, offset);
+        central.append(e.first);
+    }
+    quint32 centralOffset = quint32(zip.size());
+    zip.append(central);
+    put32(zip, 0x06054b50);
+    put16(zip, 0);
+    put16(zip, 0);
+    put16(zip, quint16(entries.size()));
+    put16(zip, quint16(entries.size()));
+    put32(zip, quint32(central.size()));
+    put32(zip, centralOffset);
+    put16(zip, 0);
+    return zip;
+}
+
+/// Incompressible bytes, so containers have the size asked for
+QByteArray payload(std::mt19937_64& rng, qint64 size) {
+    QByteArray b(int(size), 0);
+    for (int i = 0; i + 8 <= b.size(); i += 8) {
+        quint64 v = rng();
+        memcpy(b.data() + i, &v, 8);
+    }
+    for (int i = b.size() & ~7; i < b.size(); ++i) b[i] = char(rng());
+    return b;
+}
+
+QByteArray ddoc(std::mt19937_64& rng, qint64 size) {
+    QByteArray data = payload(rng, size * 3 / 4).toBase64();
+    return "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+           "<SignedDoc format=\"DIGIDOC-XML\" version=\"1.3\" xmlns=\"http://www.sk.ee/DigiDoc/v1.3.0#\">\n"
+           "<DataFile ContentType=\"EMBEDDED_BASE64\" Filename=\"dokument.bin\" Id=\"D0\" MimeType=\"application/octet-stream\" Size=\"" +
+           QByteArray::number(size * 3 / 4) + "\">" + data + "</DataFile>\n</SignedDoc>\n";
+}
+
+QByteArray bdoc(std::mt19937_64& rng, qint64 size, bool version10) {
+    QByteArray mimetype(version10 ? "application/vnd.bdoc-1.0" : "application/vnd.etsi.asic-e+zip");
+    QByteArray manifest =
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<manifest:manifest xmlns:manifest=\"urn:oasis:names:tc:opendocument:xmlns:manifest:1.0\">\n"
+            "<manifest:file-entry manifest:full-path=\"/\" manifest:media-type=\"" + mimetype + "\"/>\n"
+            "<manifest:file-entry manifest:full-path=\"dokument.bin\" manifest:media-type=\"application/octet-stream\"/>\n"
+            "</manifest:manifest>\n";
+    return storedZip({{"mimetype", mimetype}, {"META-INF/manifest.xml", manifest}, {"dokument.bin", payload(rng, size)}});
+}
+
+QString name(std::mt19937_64& rng, int nr) {
+    int const words = int(sizeof(NAME_WORDS) / sizeof(NAME_WORDS[0]));
+    return QString::fromUtf8(NAME_WORDS[rng() % words]) + "_" + QString::number(nr);
+}
+
+bool writeFile(QString const& path, QByteArray const& data) {
+    QFile f(path);
+    return f.open(QIODevice::WriteOnly) && f.write(data) == data.size();
+}
+
+bool parseMix(QString const& spec, QVector<double>& shares) {
+    shares.fill(0, KIND_COUNT);
+    double sum = 0;
+    for (QString const& item : spec.split(',', QString::SkipEmptyParts)) {
+        bool ok = false;
+        double share = item.section('=', 1).toDouble(&ok);
+        int k = 0;
+        while (k < KIND_COUNT && item.section('=', 0, 0).trimmed() != KIND_NAMES[k]) ++k;
+        if (!ok || share < 0 || k == KIND_COUNT) return false;
+        shares[k] = share;
+        sum += share;
+    }
+    if (sum <= 0) return false;
+    for (double& s : shares) s /= sum;
+    return true;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Writes a reproducible synthetic DDOC/BDOC corpus for benchmarks");
+    parser.addHelpOption();
+    parser.addPositionalArgument("dir", "output directory, must be empty or not exist");
+    parser.addOption(QCommandLineOption("files", "number of files (default 100000)", "files", "100000"));
+    parser.addOption(QCommandLineOption("files_per_dir", "average files per directory (default 50)", "files_per_dir", "50"));
+    parser.addOption(QCommandLineOption("depth", "maximum directory depth, at least 1 (default 8)", "depth", "8"));
+    parser.addOption(QCommandLineOption("mix", "shares of file kinds (default ddoc=0.4,bdoc10=0.2,bdoc21=0.2,other=0.2)",
+            "mix", "ddoc=0.4,bdoc10=0.2,bdoc21=0.2,other=0.2"));
+    parser.addOption(QCommandLineOption("sizes", "file sizes in KB: fixed:KB, uniform:MIN:MAX or lognormal:MEDIAN:SIGMA "
+            "(default lognormal:16:1.5)", "sizes", "lognormal:16:1.5"));
+    parser.addOption(QCommandLineOption("max_size", "largest file in KB (default 65536)", "max_size", "65536"));
+    parser.addOption(QCommandLineOption("duplicates", "share of files that copy an earlier file of the same kind (default 0.05)",
+            "duplicates", "0.05"));
+    parser.addOption(QCommandLineOption("excluded_dirs", "directories to be excluded from the search (default 3)",
+            "excluded_dirs", "3"));
+    parser.addOption(QCommandLineOption("symlink_loops", "symlinks to ancestor directories (default 3, not on Windows)",
+            "symlink_loops", "3"));
+    parser.addOption(QCommandLineOption("seed", "random seed (default 1)", "seed", "1"));
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1) parser.showHelp(2);
+    QDir root(parser.positionalArguments().first());
+    if (root.exists() && !root.entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System).isEmpty()) {
+        std::cerr << root.path().toStdString() << " is not empty" << std::endl;
+        return 2;
+    }
+    qint64 const files = parser.value("files").toLongLong();
+    int const filesPerDir = qMax(1, parser.value("files_per_dir").toInt());
+    int const maxDepth = parser.value("depth").toInt();
+    qint64 const maxSize = parser.value("max_size").toLongLong() * 1024;
+    double const duplicates = parser.value("duplicates").toDouble();
+    int const excludedDirs = parser.value("excluded_dirs").toInt();
+    int const symlinkLoops = parser.value("symlink_loops").toInt();
+    QVector<double> mix;
+    SizeDistribution sizes;
+    // with depth 0 no directory could be added below the root
+    if (files < 0 || maxDepth < 1 || !parseMix(parser.value("mix"), mix) || !sizes.parse(parser.value("sizes")) ||
+            duplicates < 0 || duplicates > 1) {
+        std::cerr << "Illegal option value" << std::endl;
+        return 2;
+    }
+    std::mt19937_64 rng(parser.value("seed").toULongLong());
+    if (!root.mkpath(".")) {
+        std::cerr << "Can't create " << root.path().toStdString() << std::endl;
+        return 1;
+    }
+
+    // random tree: every directory hangs under a random earlier one that is not too deep
+    QVector<Dir> dirs = {{root.absolutePath(), 0}};
+    qint64 const dirCount = qMax<qint64>(1, files / filesPerDir);
+    while (dirs.size() < dirCount) {
+        Dir const& parent = dirs[int(rng() % quint64(dirs.size()))];
+        if (parent.depth >= maxDepth) continue;
+        Dir d = {parent.path + "/" + name(rng, dirs.size()), parent.depth + 1};
+        if (!QDir().mkpath(d.path)) {
+            std::cerr << "Can't create " << d.path.toStdString() << std::endl;
+            return 1;
+        }
+        dirs.append(d);
+    }
+    QStringList excluded;
+    for (int i = 0; i < excludedDirs && !dirs.isEmpty(); ++i) {
+        Dir const& d = dirs[int(rng() % quint64(dirs.size()))];
+        Dir e = {d.path + "/excluded_" + QString::number(i), d.depth + 1};
+        if (!QDir().mkpath(e.path)) return 1;
+        excluded << e.path;
+        // files go there as well, only the search skips them
+        dirs.append(e);
+    }
+
+    qint64 counts[KIND_COUNT] = {0};
+    qint64 bytes = 0;
+    qint64 dupCount = 0;
+    QVector<QByteArray> lastOfKind(KIND_COUNT);
+    std::discrete_distribution<int> kinds(mix.begin(), mix.end());
+    for (qint64 i = 0; i < files; ++i) {
+        Kind kind = Kind(kinds(rng));
+        QString const dir = dirs[int(rng() % quint64(dirs.size()))].path;
+        QByteArray data;
+        if (!lastOfKind[kind].isEmpty() && std::uniform_real_distribution<double>(0, 1)(rng) < duplicates) {
+            data = lastOfKind[kind];
+            ++dupCount;
+        } else {
+            qint64 size = sizes.sample(rng, maxSize);
+            if (DDOC == kind) data = ddoc(rng, size);
+            else if (BDOC10 == kind || BDOC21 == kind) data = bdoc(rng, size, BDOC10 == kind);
+            else data = payload(rng, size);
+            lastOfKind[kind] = data;
+        }
+        QString ext = (DDOC == kind ? ".ddoc" : (OTHER == kind ? OTHER_EXTENSIONS[rng() % 5] : ".bdoc"));
+        QString path = dir + "/" + name(rng, int(i)) + ext;
+        if (!writeFile(path, data)) {
+            std::cerr << "Can't write " << path.toStdString() << std::endl;
+            return 1;
+        }
+        ++counts[kind];
+        bytes += data.size();
+        if (0 == (i + 1) % 100000) std::cout << (i + 1) << " files" << std::endl;
+    }
+
+    int loops = 0;
+#ifndef Q_OS_WIN
+    for (int i = 0; i < symlinkLoops && dirs.size() > 1; ++i) {
+        Dir const& d = dirs[1 + int(rng() % quint64(dirs.size() - 1))];
+        // points to the parent, so following it descends forever
+        QByteArray link = QFile::encodeName(d.path + "/loop_" + QString::number(i));
+        if (0 == ::symlink("..", link.constData())) ++loops;
+    }
+#else
+    Q_UNUSED(symlinkLoops);
+#endif
+
+    std::cout << "Wrote " << files << " files (" << bytes / 1024 / 1024 << " MB) in " << dirs.size() << " directories:";
+    for (int k = 0; k < KIND_COUNT; ++k) std::cout << " " << KIND_NAMES[k] << " " << counts[k];
+    std::cout << ", " << dupCount << " duplicates, " << loops << " symlink loops" << std::endl;
+    if (!excluded.isEmpty()) {
+        std::cout << "Excluded directories:";
+        for (QString const& e : excluded) std::cout << " --excl_dir " << e.toStdString();
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/**
+ * Compares SHA-256 throughput on a small-file corpus: OpenSSL single-stream EVP,
+ * QCryptographicHash and the multi-buffer kernels supported by this CPU.
+ * Files are read into memory first, so only hashing is measured.
+ *
+ * Usage: tera-hash-bench <corpus dir> [max file size in KB, default 256]
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QVector>
+
+#include <openssl/evp.h>
+
+#include "poc/sha256_mb.h"
+
+using ria_tera::Sha256MultiBuffer;
+
+namespace {
+
+int const ROUNDS = 3;
+
+void report(char const* name, qint64 bytes, int files, qint64 ns) {
+    double sec = ns / 1e9;
+    std::cout << "  " << name << ": " << int(bytes / 1024.0 / 1024.0 / sec) << " MB/s, "
+              << int(files / sec) << " files/s" << std::endl;
+}
+
+/// best of ROUNDS in ns
+template <class F>
+qint64 measure(F f) {
+    qint64 best = -1;
+    for (int r = 0; r < ROUNDS; ++r) {
+        QElapsedTimer t;
+        t.start();
+        f();
+        qint64 ns = t.nsecsElapsed();
+        if (best < 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " <corpus dir> [max file size in KB, default 256]" << std::endl;
+        return 2;
+    }
+    qint64 maxSize = (argc > 2 ? QByteArray(argv[2]).toLongLong() : 256) * 1024;
+
+    QVector<QByteArray> contents;
+    qint64 bytes = 0;
+    QDirIterator it(QString::fromLocal8Bit(argv[1]), QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QFile f(it.next());
+        if (f.size() > maxSize || !f.open(QIODevice::ReadOnly)) continue;
+        contents.append(f.readAll());
+        bytes += contents.last().size();
+    }
+    if (contents.isEmpty()) {
+        std::cout << "No files up to " << maxSize / 1024 << " KB found" << std::endl;
+        return 1;
+    }
+    int const n = contents.size();
+    std::cout << n << " files, " << bytes / 1024 << " KB, best of " << ROUNDS << " rounds" << std::endl;
+
+    std::vector<unsigned char> reference(n * Sha256MultiBuffer::DIGEST_SIZE);
+    qint64 ns = measure([&]{
+        for (int i = 0; i < n; ++i) {
+            unsigned int len = 0;
+            EVP_Digest(contents[i].constData(), contents[i].size(),
+                       &reference[i * Sha256MultiBuffer::DIGEST_SIZE], &len, EVP_sha256(), NULL);
+        }
+    });
+    report("OpenSSL EVP", bytes, n, ns);
+
+    ns = measure([&]{
+        for (int i = 0; i < n; ++i) {
+            QCryptographicHash::hash(contents[i], QCryptographicHash::Sha256);
+        }
+    });
+    report("QCryptographicHash", bytes, n, ns);
+
+    int failed = 0;
+    for (Sha256MultiBuffer::Kernel k : {Sha256MultiBuffer::SCALAR, Sha256MultiBuffer::AVX2, Sha256MultiBuffer::AVX512}) {
+        if (!Sha256MultiBuffer::supported(k)) {
+            std::cout << "  " << Sha256MultiBuffer::name(k) << ": not supported by this CPU" << std::endl;
+            continue;
+        }
+        std::vector<unsigned char> digests(n * Sha256MultiBuffer::DIGEST_SIZE);
+        std::vector<Sha256MultiBuffer::Message> msgs(n);
+        for (int i = 0; i < n; ++i) {
+            msgs[i].data = reinterpret_cast<unsigned char const*>(contents[i].constData());
+            msgs[i].len = static_cast<quint64>(contents[i].size());
+            msgs[i].digest = &digests[i * Sha256MultiBuffer::DIGEST_SIZE];
+        }
+        ns = measure([&]{ Sha256MultiBuffer::hash(msgs.data(), n, k); });
+        report(Sha256MultiBuffer::name(k), bytes, n, ns);
+        if (digests != reference) {
+            std::cout << "  " << Sha256MultiBuffer::name(k) << ": DIGESTS DIFFER FROM OPENSSL" << std::endl;
+            ++failed;
+        }
+    }
+    std::cout << "Kernel used for hashing: " << Sha256MultiBuffer::name(Sha256MultiBuffer::best()) << std::endl;
+    return failed ? 1 : 0;
+}
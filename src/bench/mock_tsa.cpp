@@ -0,0 +1,433 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/**
+ * RFC 3161 time server for throughput benchmarks, so that runs don't use up
+ * the quota of real time servers. Tokens are signed by a TSA certificate of
+ * a throwaway CA created at start, with OpenSSL's TS responder.
+ *
+ * Latency and errors are injected per request:
+ *   --latency fixed:MS | uniform:MIN:MAX | normal:MEAN:SD | lognormal:MEDIAN:SIGMA | exp:MEAN
+ *   --errors 403=0.01,500=0.02,timeout=0.01,garbage=0.01
+ * --tls serves HTTPS with a certificate of the same CA (--ca_out writes the CA
+ * certificate for the client's trust store), --client_ca additionally requires
+ * client certificates issued by the given CAs.
+ *
+ * Usage: tera-mock-tsa [--port 8080] [options]
+ */
+
+#include <cmath>
+#include <iostream>
+#include <random>
+
+#include <QByteArray>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QHostAddress>
+#include <QScopedPointer>
+#include <QSslCertificate>
+#include <QSslConfiguration>
+#include <QSslKey>
+#include <QSslSocket>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTimer>
+#include <QVector>
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ts.h>
+#include <openssl/x509v3.h>
+
+namespace {
+
+/// Throwaway CA with a TSA and a TLS server certificate, all EC P-256 for fast signing
+class TokenSigner {
+public:
+    TokenSigner() : ctx(nullptr), serial(0) {}
+    ~TokenSigner() {
+        TS_RESP_CTX_free(ctx);
+        for (X509* c : {caCert, tsaCert, tlsCert}) X509_free(c);
+        for (EVP_PKEY* k : {caKey, tsaKey, tlsKey}) EVP_PKEY_free(k);
+    }
+
+    bool init() {
+        caKey = newKey();
+        tsaKey = newKey();
+        tlsKey = newKey();
+        if (!caKey || !tsaKey || !tlsKey) return false;
+        caCert = newCert("TeRa mock TSA CA", caKey, nullptr, caKey,
+                         {{NID_basic_constraints, "critical,CA:TRUE"}, {NID_key_usage, "critical,keyCertSign,cRLSign"}});
+        tsaCert = newCert("TeRa mock TSA", tsaKey, caCert, caKey,
+                          {{NID_basic_constraints, "critical,CA:FALSE"}, {NID_key_usage, "critical,digitalSignature"},
+                           {NID_ext_key_usage, "critical,timeStamping"}});
+        tlsCert = newCert("localhost", tlsKey, caCert, caKey,
+                          {{NID_basic_constraints, "critical,CA:FALSE"}, {NID_ext_key_usage, "serverAuth"},
+                           {NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1"}});
+        if (!caCert || !tsaCert || !tlsCert) return false;
+
+        ctx = TS_RESP_CTX_new();
+        if (!ctx || !TS_RESP_CTX_set_signer_cert(ctx, tsaCert) || !TS_RESP_CTX_set_signer_key(ctx, tsaKey)) return false;
+        STACK_OF(X509)* chain = sk_X509_new_null();
+        sk_X509_push(chain, caCert);
+        int ok = TS_RESP_CTX_set_certs(ctx, chain);
+        sk_X509_free(chain);
+        ASN1_OBJECT* policy = OBJ_txt2obj("1.3.6.1.4.1.51361.1.1", 1);
+        ok = ok && TS_RESP_CTX_set_def_policy(ctx, policy);
+        ASN1_OBJECT_free(policy);
+        for (EVP_MD const* md : {EVP_sha1(), EVP_sha224(), EVP_sha256(), EVP_sha384(), EVP_sha512()}) {
+            ok = ok && TS_RESP_CTX_add_md(ctx, md);
+        }
+        ok = ok && TS_RESP_CTX_set_signer_digest(ctx, EVP_sha256());
+        ok = ok && TS_RESP_CTX_set_accuracy(ctx, 1, 0, 0);
+        TS_RESP_CTX_set_serial_cb(ctx, &TokenSigner::nextSerial, this);
+        return ok;
+    }
+
+    /// DER time-stamp response to a DER request; responses with an error status for bad requests
+    QByteArray respond(QByteArray const& request) {
+        BIO* in = BIO_new_mem_buf(request.constData(), request.size());
+        TS_RESP* resp = TS_RESP_create_response(ctx, in);
+        BIO_free(in);
+        if (!resp) return QByteArray();
+        QByteArray der(i2d_TS_RESP(resp, nullptr), 0);
+        unsigned char* p = reinterpret_cast<unsigned char*>(der.data());
+        i2d_TS_RESP(resp, &p);
+        TS_RESP_free(resp);
+        return der;
+    }
+
+    QByteArray caPem() const { return pem(caCert); }
+    QByteArray tlsCertPem() const { return pem(tlsCert); }
+    QByteArray tlsKeyPem() const {
+        BIO* b = BIO_new(BIO_s_mem());
+        PEM_write_bio_PrivateKey(b, tlsKey, nullptr, nullptr, 0, nullptr, nullptr);
+        return readBio(b);
+    }
+private:
+    struct Ext {
+        int nid;
+        char const* value;
+    };
+
+    static EVP_PKEY* newKey() {
+        EVP_PKEY* key = nullptr;
+        EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        if (kctx && EVP_PKEY_keygen_init(kctx) > 0 &&
+                EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) > 0) {
+            EVP_PKEY_keygen(kctx, &key);
+        }
+        EVP_PKEY_CTX_free(kctx);
+        return key;
+    }
+
+    X509* newCert(char const* cn, EVP_PKEY* key, X509* issuer, EVP_PKEY* issuerKey, std::initializer_list<Ext> exts) {
+        X509* cert = X509_new();
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), ++certSerial);
+        X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 30L * 24 * 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_UTF8, reinterpret_cast<unsigned char const*>(cn), -1, -1, 0);
+        X509_set_issuer_name(cert, issuer ? X509_get_subject_name(issuer) : name);
+        X509V3_CTX v3;
+        X509V3_set_ctx(&v3, issuer ? issuer : cert, cert, nullptr, nullptr, 0);
+        for (Ext const& e : exts) {
+            X509_EXTENSION* ext = X509V3_EXT_conf_nid(nullptr, &v3, e.nid, const_cast<char*>(e.value));
+            if (!ext || !X509_add_ext(cert, ext, -1)) {
+                X509_EXTENSION_free(ext);
+                X509_free(cert);
+                return nullptr;
+            }
+            X509_EXTENSION_free(ext);
+        }
+        if (!X509_sign(cert, issuerKey, EVP_sha256())) {
+            X509_free(cert);
+            return nullptr;
+        }
+        return cert;
+    }
+
+    static ASN1_INTEGER* nextSerial(TS_RESP_CTX* ctx, void* data) {
+        TokenSigner* self = static_cast<TokenSigner*>(data);
+        ASN1_INTEGER* serial = ASN1_INTEGER_new();
+        if (!serial || !ASN1_INTEGER_set_int64(serial, ++self->serial)) {
+            ASN1_INTEGER_free(serial);
+            TS_RESP_CTX_set_status_info(ctx, TS_STATUS_REJECTION, "Error during serial number generation.");
+            TS_RESP_CTX_add_failure_info(ctx, TS_INFO_ADD_INFO_NOT_AVAILABLE);
+            return nullptr;
+        }
+        return serial;
+    }
+
+    static QByteArray pem(X509* cert) {
+        BIO* b = BIO_new(BIO_s_mem());
+        PEM_write_bio_X509(b, cert);
+        return readBio(b);
+    }
+
+    static QByteArray readBio(BIO* b) {
+        char* data = nullptr;
+        long len = BIO_get_mem_data(b, &data);
+        QByteArray res(data, int(len));
+        BIO_free(b);
+        return res;
+    }
+
+    EVP_PKEY* caKey = nullptr;
+    EVP_PKEY* tsaKey = nullptr;
+    EVP_PKEY* tlsKey = nullptr;
+    X509* caCert = nullptr;
+    X509* tsaCert = nullptr;
+    X509* tlsCert = nullptr;
+    long certSerial = 0;
+    TS_RESP_CTX* ctx;
+    int64_t serial;
+};
+
+/// Response delay in ms, sampled per request
+class Latency {
+public:
+    bool parse(QString const& spec) {
+        QStringList p = spec.split(':');
+        kind = p.value(0);
+        QVector<double> a;
+        for (int i = 1; i < p.size(); ++i) {
+            bool ok = false;
+            a.append(p[i].toDouble(&ok));
+            if (!ok || a.last() < 0) return false;
+        }
+        int const args = ("fixed" == kind || "exp" == kind) ? 1 : 2;
+        if (a.size() != args || !QStringList({"fixed", "uniform", "normal", "lognormal", "exp"}).contains(kind)) return false;
+        x = a[0];
+        y = a.value(1);
+        return "uniform" != kind || x <= y;
+    }
+    int sample(std::mt19937_64& rng) const {
+        double ms = x;
+        if ("uniform" == kind) ms = std::uniform_real_distribution<double>(x, y)(rng);
+        else if ("normal" == kind) ms = std::normal_distribution<double>(x, y)(rng);
+        else if ("lognormal" == kind) ms = std::lognormal_distribution<double>(std::log(qMax(x, 0.001)), y)(rng);
+        else if ("exp" == kind) ms = std::exponential_distribution<double>(1.0 / qMax(x, 0.001))(rng);
+        return int(qBound(0.0, ms, 600000.0));
+    }
+private:
+    QString kind = "fixed";
+    double x = 0;
+    double y = 0;
+};
+
+enum Outcome {OK, FORBIDDEN, SERVER_ERROR, TIMEOUT, GARBAGE, OUTCOME_COUNT};
+char const* const OUTCOME_NAMES[] = {"ok", "403", "500", "timeout", "garbage"};
+
+class MockTsa : public QTcpServer {
+public:
+    MockTsa(TokenSigner& s, Latency const& l, QVector<double> const& errorRates, quint64 seed)
+        : signer(s), latency(l), errors(errorRates), rng(seed), counts(OUTCOME_COUNT, 0) {}
+
+    void enableTls(QList<QSslCertificate> const& clientCas) {
+        tls.reset(new QSslConfiguration(QSslConfiguration::defaultConfiguration()));
+        tls->setLocalCertificate(QSslCertificate(signer.tlsCertPem()));
+        tls->setPrivateKey(QSslKey(signer.tlsKeyPem(), QSsl::Ec));
+        if (!clientCas.isEmpty()) {
+            tls->setCaCertificates(clientCas);
+            tls->setPeerVerifyMode(QSslSocket::VerifyPeer);
+        } else {
+            tls->setPeerVerifyMode(QSslSocket::VerifyNone);
+        }
+    }
+
+    void printStats() {
+        qint64 total = 0;
+        for (qint64 c : counts) total += c;
+        if (total == lastTotal) return;
+        std::cout << total << " requests";
+        for (int i = 0; i < OUTCOME_COUNT; ++i) std::cout << ", " << OUTCOME_NAMES[i] << " " << counts[i];
+        std::cout << std::endl;
+        lastTotal = total;
+    }
+protected:
+    void incomingConnection(qintptr fd) override {
+        QTcpSocket* s;
+        if (tls.isNull()) {
+            s = new QTcpSocket(this);
+            s->setSocketDescriptor(fd);
+        } else {
+            QSslSocket* ssl = new QSslSocket(this);
+            ssl->setSocketDescriptor(fd);
+            ssl->setSslConfiguration(*tls);
+            QObject::connect(ssl, static_cast<void (QSslSocket::*)(QList<QSslError> const&)>(&QSslSocket::sslErrors), ssl, [ssl](QList<QSslError> const& e){
+                std::cout << "TLS error: " << e.value(0).errorString().toStdString() << std::endl;
+                ssl->abort();
+            });
+            ssl->startServerEncryption();
+            s = ssl;
+        }
+        QObject::connect(s, &QTcpSocket::readyRead, s, [this, s]{ readRequest(s); });
+        QObject::connect(s, &QTcpSocket::disconnected, s, &QObject::deleteLater);
+    }
+private:
+    /// Handles one request at a time per connection, the next one after the answer
+    void readRequest(QTcpSocket* s) {
+        if (s->property("busy").toBool()) return;
+        QByteArray buf = s->peek(s->bytesAvailable());
+        int headerEnd = buf.indexOf("\r\n\r\n");
+        if (headerEnd < 0) return;
+        int length = 0;
+        for (QByteArray const& line : buf.left(headerEnd).split('\n')) {
+            if (line.toLower().startsWith("content-length:")) length = line.mid(15).trimmed().toInt();
+        }
+        if (buf.size() < headerEnd + 4 + length) return;
+        s->read(headerEnd + 4);
+        QByteArray body = s->read(length);
+
+        Outcome outcome = pickOutcome();
+        ++counts[outcome];
+        if (TIMEOUT == outcome) {
+            // keep the connection busy without answering, the client gives up
+            s->setProperty("busy", true);
+            return;
+        }
+        QByteArray status("200 OK");
+        QByteArray reply;
+        if (FORBIDDEN == outcome) {
+            status = "403 Forbidden";
+        } else if (SERVER_ERROR == outcome) {
+            status = "500 Internal Server Error";
+        } else if (GARBAGE == outcome) {
+            reply.resize(64 + int(rng() % 512));
+            for (char& c : reply) c = char(rng());
+        } else {
+            reply = signer.respond(body);
+            if (reply.isEmpty()) status = "400 Bad Request";
+        }
+        QByteArray answer = "HTTP/1.1 " + status + "\r\nContent-Type: application/timestamp-reply\r\nContent-Length: " +
+                QByteArray::number(reply.size()) + "\r\n\r\n" + reply;
+        s->setProperty("busy", true);
+        QTimer::singleShot(latency.sample(rng), s, [this, s, answer]{
+            s->write(answer);
+            s->setProperty("busy", false);
+            readRequest(s);
+        });
+    }
+
+    Outcome pickOutcome() {
+        double r = std::uniform_real_distribution<double>(0, 1)(rng);
+        for (int i = FORBIDDEN; i < OUTCOME_COUNT; ++i) {
+            if (r < errors[i]) return Outcome(i);
+            r -= errors[i];
+        }
+        return OK;
+    }
+
+    TokenSigner& signer;
+    Latency latency;
+    QVector<double> errors;
+    std::mt19937_64 rng;
+    QVector<qint64> counts;
+    qint64 lastTotal = 0;
+    QScopedPointer<QSslConfiguration> tls;
+};
+
+bool parseErrors(QString const& spec, QVector<double>& rates) {
+    rates.fill(0, OUTCOME_COUNT);
+    double sum = 0;
+    for (QString const& item : spec.split(',', QString::SkipEmptyParts)) {
+        bool ok = false;
+        double rate = item.section('=', 1).toDouble(&ok);
+        int i = FORBIDDEN;
+        while (i < OUTCOME_COUNT && item.section('=', 0, 0).trimmed() != OUTCOME_NAMES[i]) ++i;
+        if (!ok || rate < 0 || i == OUTCOME_COUNT) return false;
+        rates[i] = rate;
+        sum += rate;
+    }
+    return sum <= 1;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("RFC 3161 time server with a throwaway CA for benchmarks");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("port", "port on localhost (default 8080, 0 - any free port)", "port", "8080"));
+    parser.addOption(QCommandLineOption("latency",
+            "response delay in ms: fixed:MS, uniform:MIN:MAX, normal:MEAN:SD, lognormal:MEDIAN:SIGMA or exp:MEAN (default fixed:0)",
+            "latency", "fixed:0"));
+    parser.addOption(QCommandLineOption("errors",
+            "share of requests answered with an error, ex. 403=0.01,500=0.02,timeout=0.01,garbage=0.01", "errors"));
+    parser.addOption(QCommandLineOption("seed", "random seed for latency and errors (default 1)", "seed", "1"));
+    parser.addOption(QCommandLineOption("tls", "serve HTTPS with a certificate for localhost issued by the throwaway CA"));
+    parser.addOption(QCommandLineOption("client_ca", "require TLS client certificates issued by CAs in this PEM file", "client_ca"));
+    parser.addOption(QCommandLineOption("ca_out", "write the throwaway CA certificate to this PEM file", "ca_out"));
+    parser.process(app);
+
+    Latency latency;
+    if (!latency.parse(parser.value("latency"))) {
+        std::cerr << "Illegal latency '" << parser.value("latency").toStdString() << "'" << std::endl;
+        return 2;
+    }
+    QVector<double> errors;
+    if (!parseErrors(parser.value("errors"), errors)) {
+        std::cerr << "Illegal errors '" << parser.value("errors").toStdString() << "'" << std::endl;
+        return 2;
+    }
+    TokenSigner signer;
+    if (!signer.init()) {
+        std::cerr << "Can't create the throwaway CA" << std::endl;
+        return 1;
+    }
+    if (parser.isSet("ca_out")) {
+        QFile ca(parser.value("ca_out"));
+        if (!ca.open(QIODevice::WriteOnly | QIODevice::Truncate) || ca.write(signer.caPem()) < 0) {
+            std::cerr << "Can't write " << parser.value("ca_out").toStdString() << std::endl;
+            return 1;
+        }
+    }
+
+    MockTsa tsa(signer, latency, errors, parser.value("seed").toULongLong());
+    if (parser.isSet("tls") || parser.isSet("client_ca")) {
+        QList<QSslCertificate> clientCas;
+        if (parser.isSet("client_ca")) {
+            clientCas = QSslCertificate::fromPath(parser.value("client_ca"));
+            if (clientCas.isEmpty()) {
+                std::cerr << "No certificates in " << parser.value("client_ca").toStdString() << std::endl;
+                return 2;
+            }
+        }
+        tsa.enableTls(clientCas);
+    }
+    if (!tsa.listen(QHostAddress::LocalHost, parser.value("port").toUShort())) {
+        std::cerr << "Can't listen: " << tsa.errorString().toStdString() << std::endl;
+        return 1;
+    }
+    // tera-bench waits for this line
+    std::cout << "Listening on " << (parser.isSet("tls") || parser.isSet("client_ca") ? "https" : "http")
+              << "://127.0.0.1:" << tsa.serverPort() << "/" << std::endl;
+
+    QTimer stats;
+    QObject::connect(&stats, &QTimer::timeout, &tsa, [&tsa]{ tsa.printStats(); });
+    stats.start(10 * 1000);
+    return app.exec();
+}
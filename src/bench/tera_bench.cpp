@@ -0,0 +1,149 @@
+/*
+ * TeRa
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/**
+ * Runs the command line tool against tera-mock-tsa on a corpus and reports
+ * files/s. Containers get the extension .teraBenchOut and are removed after
+ * every run, so the corpus stays the same between runs.
+ *
+ * Usage: tera-bench <corpus dir> [options] [-- options for the command line tool]
+ */
+
+#include <algorithm>
+#include <iostream>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QVector>
+
+namespace {
+
+QString const OUT_EXTENSION("teraBenchOut");
+
+/// Starts the mock and returns its URL, empty on failure
+QString startMock(QProcess& mock, QString const& path, QStringList const& args) {
+    mock.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    mock.start(path, args);
+    if (!mock.waitForStarted()) return QString();
+    while (mock.waitForReadyRead(10 * 1000)) {
+        while (mock.canReadLine()) {
+            QString line = QString::fromUtf8(mock.readLine()).trimmed();
+            if (line.startsWith("Listening on ")) return line.mid(13);
+        }
+    }
+    return QString();
+}
+
+int removeOutputs(QString const& corpus) {
+    int removed = 0;
+    QDirIterator it(corpus, QStringList("*." + OUT_EXTENSION), QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        if (QFile::remove(it.next())) ++removed;
+    }
+    return removed;
+}
+
+QJsonObject readReport(QString const& path) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) return QJsonObject();
+    return QJsonDocument::fromJson(f.readAll()).object();
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QString const binDir = QCoreApplication::applicationDirPath();
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Time-stamping throughput of the command line tool against tera-mock-tsa");
+    parser.addHelpOption();
+    parser.addPositionalArgument("corpus", "directory with input files, searched recursively");
+    parser.addOption(QCommandLineOption("runs", "number of runs (default 3)", "runs", "3"));
+    parser.addOption(QCommandLineOption("latency", "tera-mock-tsa --latency (default fixed:0)", "latency", "fixed:0"));
+    parser.addOption(QCommandLineOption("errors", "tera-mock-tsa --errors", "errors"));
+    parser.addOption(QCommandLineOption("cli", "command line tool (default " TERA_CMD_NAME " next to tera-bench)", "cli",
+            binDir + "/" TERA_CMD_NAME));
+    parser.addOption(QCommandLineOption("mock", "mock time server (default tera-mock-tsa next to tera-bench)", "mock",
+            binDir + "/tera-mock-tsa"));
+    parser.process(app);
+    if (parser.positionalArguments().isEmpty()) parser.showHelp(2);
+    QString const corpus = parser.positionalArguments().first();
+    QStringList const extraArgs = parser.positionalArguments().mid(1);
+    int const runs = qMax(1, parser.value("runs").toInt());
+
+    if (int left = removeOutputs(corpus)) {
+        std::cout << "Removed " << left << " outputs of an earlier run" << std::endl;
+    }
+
+    QProcess mock;
+    QStringList mockArgs = {"--port", "0", "--latency", parser.value("latency")};
+    if (parser.isSet("errors")) mockArgs << "--errors" << parser.value("errors");
+    QString const url = startMock(mock, parser.value("mock"), mockArgs);
+    if (url.isEmpty()) {
+        std::cerr << "Can't start " << parser.value("mock").toStdString() << std::endl;
+        return 1;
+    }
+
+    QTemporaryDir tmp;
+    QVector<double> rates;
+    int failed = 0;
+    for (int run = 1; run <= runs; ++run) {
+        QString const report = tmp.filePath(QString("report%1.json").arg(run));
+        QStringList args = {"--dir_in", corpus, "-R", "--ts_url", url, "--ext_out", OUT_EXTENSION,
+                            "--report", report, "--logfile_dir", tmp.path(), "--log_level", "warn"};
+        QProcess cli;
+        cli.setProcessChannelMode(QProcess::ForwardedChannels);
+        QElapsedTimer timer;
+        timer.start();
+        cli.start(parser.value("cli"), args + extraArgs);
+        if (!cli.waitForStarted() || !cli.waitForFinished(-1)) {
+            std::cerr << "Can't run " << parser.value("cli").toStdString() << std::endl;
+            return 1;
+        }
+        qint64 ms = timer.elapsed();
+        removeOutputs(corpus);
+
+        QJsonObject r = readReport(report);
+        QJsonObject files = r.value("files").toObject();
+        QJsonObject tsa = r.value("tsa").toObject();
+        double rate = files.value("succeeded").toDouble() * 1000.0 / qMax<qint64>(ms, 1);
+        rates.append(rate);
+        failed += files.value("failed").toInt();
+        std::cout << "Run " << run << ": " << files.value("succeeded").toInt() << " files in " << ms << " ms, "
+                  << int(rate) << " files/s (" << int(files.value("per_sec").toDouble()) << " without startup), "
+                  << int(r.value("hash").toObject().value("mb_per_sec").toDouble()) << " MB/s hashed, time server p50 "
+                  << tsa.value("p50_us").toInt() / 1000.0 << " ms, p99 " << tsa.value("p99_us").toInt() / 1000.0
+                  << " ms, exit code " << cli.exitCode() << std::endl;
+    }
+    mock.kill();
+    mock.waitForFinished();
+
+    std::sort(rates.begin(), rates.end());
+    std::cout << "Median " << int(rates[rates.size() / 2]) << " files/s, best " << int(rates.last()) << " files/s"
+              << (failed > 0 ? ", some files failed" : "") << std::endl;
+    return 0;
+}
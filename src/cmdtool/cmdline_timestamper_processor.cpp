@@ -23,10 +23,14 @@
 #include <string>
 #include <sstream>
 
+#include <QFileInfo>
 #include <QMutex>
 #include <QWaitCondition>
 
 #include "poc/config.h"
+#include "poc/openssl_utils.h"
+#include "poc/resume_journal.h"
+#include "poc/trace.h"
 #include "common/SslCertificate.h"
 #include "common/Configuration.h"
 
@@ -69,6 +73,9 @@ void SetStdinEcho(bool enable = true)
 
 namespace ria_tera {
 
+/// some files were left for the next run because of time server quota
+static int const EXIT_CODE_DEFERRED = 5;
+
 class CmdLinePinDialog : public PinDialogInterface {
 private:
     PinDialogInterface::PinFlags flags;
@@ -82,6 +89,8 @@ public:
     CmdLinePinDialog(PinDialogInterface::PinFlags f) : flags(f) {}
 
     virtual bool execDialog() {
+        // log lines queued so far go before the prompt
+        logger.flush();
         if (flags & PinpadFlag) {
             std::cout << "Enter PIN1 from pinpad for authentication in time-server...";
             QMutexLocker g(&mutex);
@@ -129,16 +138,27 @@ TeRaMonitor::TeRaMonitor() {
         this, &TeRaMonitor::stepStartProcess, Qt::QueuedConnection); // queued connection needed to ensure a.exec() catches exit
     QObject::connect(this, &TeRaMonitor::signal_stepSelectCard, this, &TeRaMonitor::stepSelectCard);
     QObject::connect(this, &TeRaMonitor::signal_stepAuthenticatePIN1, this, &TeRaMonitor::stepAuthenticatePIN1);
-    QObject::connect(this, &TeRaMonitor::signal_stepFindAndStamp, this, &TeRaMonitor::stepFindAndStamp);
+    QObject::connect(this, &TeRaMonitor::signal_stepFindAndStamp, this, &TeRaMonitor::stepCheckImprint);
 
     connect(&Configuration::instance(), SIGNAL(finished(bool, const QString&)), this, SLOT(globalConfFinished(bool, const QString&)), Qt::QueuedConnection);
     connect(&Configuration::instance(), SIGNAL(networkError(const QString&)), this, SLOT(globalConfNetworkError(const QString&)));
 }
 
-void TeRaMonitor::kickstart(QString const& ts_url, IOParameters const& iop) {
-    time_server_url_original = ts_url;
+void TeRaMonitor::kickstart(QStringList const& ts_urls, IOParameters const& iop) {
+    time_server_urls_original = ts_urls;
     io_params = iop;
 
+    if (io_params.offline()) {
+        // air-gapped host, nothing to download
+        confReady = true;
+        emit kickstart_signal();
+        return;
+    }
+    if (Configuration::instance().isCacheFresh()) {
+        // don't wait for the network, cached configuration is recent and validated
+        TERA_LOG(debug) << "Using cached configuration, refreshing in background";
+        startWithConfiguration(true);
+    }
     Configuration::instance().update();
 }
 
@@ -147,24 +167,56 @@ static QString const INI_GROUP("tera");
 static QString const INI_GROUP_ = INI_GROUP + "/";
 static QString const INI_TRUSTED_CERT = Config::INI_GROUP_ + "time_server.trusted_cert";
 
-void TeRaMonitor::globalConfFinished(bool changed, const QString &error) {
+void TeRaMonitor::startWithConfiguration(bool fromCache) {
+    confReady = true;
+    stats.startupDone(fromCache);
     idCardAuth.addTrustedCerts(config.getTrustedHttpsCerts());
     emit kickstart_signal();
 }
 
+void TeRaMonitor::globalConfFinished(bool changed, const QString &error) {
+    if (confReady) {
+        if (!error.isEmpty()) {
+            TERA_LOG(warn) << "Background configuration refresh failed: " << error;
+        } else if (changed) {
+            TERA_LOG(debug) << "Configuration refreshed in background";
+            idCardAuth.addTrustedCerts(config.getTrustedHttpsCerts());
+        }
+        return;
+    }
+    startWithConfiguration(false);
+}
+
 void TeRaMonitor::globalConfNetworkError(const QString &error) {
+    if (confReady) {
+        TERA_LOG(warn) << "Background configuration refresh failed: " << error;
+        return;
+    }
     TERA_LOG(error) << "Please check internet connection. Error when downloading configuration: " << error;
     QCoreApplication::exit(2);
 }
 
 void TeRaMonitor::stepStartProcess() {
-    time_server_url = time_server_url_original;
-    useIDCardAuthentication = idCardAuth.useIDAuth(time_server_url);
+    if (io_params.offline()) {
+        emit signal_stepFindAndStamp();
+        return;
+    }
+    time_server_urls.clear();
+    time_server_id_auth.clear();
+    useIDCardAuthentication = false;
+    for (QString url : time_server_urls_original) {
+        bool idAuth = idCardAuth.useIDAuth(url);
+        time_server_urls.append(url);
+        time_server_id_auth.append(idAuth);
+        // one login serves all endpoints that need it, trust is per endpoint
+        useIDCardAuthentication = useIDCardAuthentication || idAuth;
+    }
 
     if (useIDCardAuthentication) {
         smartCard.reset(QSmartCard::create(*this));
         connect(smartCard.data(), SIGNAL(dataChanged()), this, SLOT(cardDataChanged()), Qt::QueuedConnection);
         smartCard->start();
+        logger.flush();
         std::cout << "Looking for ID-card..." << std::endl;
         // wait for cardDataChanged to be triggered
     } else {
@@ -199,6 +251,7 @@ void TeRaMonitor::cardDataChanged() {
             idAuthState = ID_AUTH_STATE::WAIT_PIN;
             emit signal_stepAuthenticatePIN1();
         } else if (cards.size() > 1) {
+            logger.flush();
             std::cout << "Multiple ID-cards connected. Please select one" << std::endl;
             for (int i = 0; i < cards.size(); ++i) {
                 std::cout << " " << (i+1) << ") " << cards.at(i).toUtf8().constData() << std::endl;
@@ -247,6 +300,7 @@ void TeRaMonitor::stepAuthenticatePIN1() {
             message = "Error: " + QString::number(error); // TODO
             smartCard->logout();
         }
+        logger.flush();
         std::cout << "Error on authentication: " << message.toUtf8().constData() << std::endl;
         QCoreApplication::exit(4);
     } else {
@@ -256,37 +310,417 @@ void TeRaMonitor::stepAuthenticatePIN1() {
     }
 }
 
+void TeRaMonitor::stepCheckImprint() {
+    if (!io_params.hash_algorithm.isEmpty()) {
+        config.setHashAlgorithm(io_params.hash_algorithm);
+    }
+    if (!config.needsImprintCheck()) {
+        stepFindAndStamp();
+        return;
+    }
+    if (io_params.offline()) {
+        // requests are sent from another host, no time server to ask
+        config.confirmImprint(false);
+        stepFindAndStamp();
+        return;
+    }
+    imprintCheck.reset(new TimeStamper());
+    imprintCheck->setRequestTimeout(config.getTimeServerTimeout());
+    addTimeServers(*imprintCheck);
+    QObject::connect(imprintCheck.data(), &TimeStamper::timestampingTestFinished, this, &TeRaMonitor::imprintChecked);
+    QByteArray pseudoDigest(Imprint::digestSize(config.getImprintAlgorithm()), '\0');
+    imprintCheck->sendTestRequest(imprintCheck->getTimestampRequest4Sha256(pseudoDigest));
+}
+
+void TeRaMonitor::imprintChecked(bool success, QByteArray resp, QString errString) {
+    if (!success) {
+        TERA_LOG(warn) << "Test request with " << Imprint::name(config.getImprintAlgorithm()) << " failed: " << errString;
+    }
+    config.confirmImprint(success);
+    // called from the stamper's reply handler
+    imprintCheck.take()->deleteLater();
+    stepFindAndStamp();
+}
+
 void TeRaMonitor::stepFindAndStamp() {
     namegen.reset(new ria_tera::OutputNameGenerator(ria_tera::Config::IN_EXTENSIONS, io_params.out_extension));
+    if (!io_params.page_cache.isEmpty()) {
+        config.setPageCacheMode(io_params.page_cache);
+    }
+    PageCache::setMode(config.getPageCacheMode());
+    IoScheduler::setLimits(config.getIoLimits());
+    if (!io_params.io_order.isEmpty()) {
+        config.setPhysicalOrder(io_params.io_order);
+    }
+    if (!io_params.trace_file.isEmpty()) {
+        QString error;
+        if (!Trace::open(io_params.trace_file, error)) {
+            TERA_LOG(error) << error;
+            QCoreApplication::exit(1);
+            return;
+        }
+    }
+    if (!io_params.metrics_listen.isEmpty() && metrics.isNull()) {
+        QString error;
+        metrics.reset(new MetricsServer());
+        if (!metrics->listen(io_params.metrics_listen, error)) {
+            TERA_LOG(error) << error;
+            finishRun();
+            QCoreApplication::exit(1);
+            return;
+        }
+        TERA_LOG(info) << "Serving metrics on " << io_params.metrics_listen;
+    }
+    stats.ioStarted();
+
+    if (!io_params.import_responses.isEmpty()) {
+        importResponses();
+        return;
+    }
 
-    QStringList inFiles;
-    if (io_params.in_file.isEmpty()) {
+    QHash<QString, TimeStamper::Prepared> preparedRequests;
+    PathStore paths;
+    QVector<PathStore::FileId> inFiles;
+    if (!io_params.submit_requests.isEmpty()) {
+        QStringList bundleFiles;
+        if (!loadSubmitBundle(bundleFiles, preparedRequests)) {
+            finishRun();
+            QCoreApplication::exit(1);
+            return;
+        }
+        for (QString const& f : bundleFiles) {
+            inFiles.append(paths.add(f));
+        }
+    } else if (io_params.flush_spool) {
+        // input comes from spool below
+    } else if (io_params.resume) {
+        QList<ResumeJournal::Entry> entries;
+        QString error;
+        if (!ResumeJournal(io_params.journal).read(entries, error)) {
+            TERA_LOG(error) << "Can't read resume journal: " << error;
+            finishRun();
+            QCoreApplication::exit(1);
+            return;
+        }
+        TERA_COUT("Resuming " << entries.size() << " files from " << QSTR_TO_CCHAR(io_params.journal));
+        for (ResumeJournal::Entry const& e : entries) {
+            inFiles.append(paths.add(e.in));
+            if (!e.out.isEmpty()) {
+                namegen->setFixedOutFile(e.in, e.out);
+            }
+        }
+    } else if (io_params.in_file.isEmpty()) {
         TERA_COUT("Searching for extensions *.(" << QSTR_TO_CCHAR(io_params.in_extensions.join(", ")) << ").");
         ria_tera::DiskCrawler dc(*this, io_params.in_extensions);
         dc.addExcludeDirs(io_params.excl_dirs);
         dc.addInputDir(io_params.in_dir, io_params.in_dir_recursive);
-        inFiles = dc.crawl();
+        inFiles = dc.crawl(paths);
+        if (!paths.isEmpty()) {
+            stats.pathFiles = paths.size();
+            stats.pathBytes = paths.memoryBytes();
+        }
     }
     else {
         //any file is valid for timestamping process here by force
-        inFiles.append(io_params.in_file);
+        inFiles.append(paths.add(io_params.in_file));
         namegen->setFixedOutFile(io_params.in_file, io_params.file_out);
     }
+    // files are hashed in this order
+    PhysicalOrder::sort(paths, inFiles, config.getPhysicalOrder());
+
+    if (!io_params.export_requests.isEmpty()) {
+        exportRequests(paths.paths(inFiles));
+        return;
+    }
+
+    if (io_params.spool || io_params.flush_spool) {
+        spool.reset(new StampSpool(io_params.spool_dir));
+        QString error;
+        if (!spool->open(error)) {
+            TERA_LOG(error) << error;
+            finishRun();
+            QCoreApplication::exit(1);
+            return;
+        }
+        if (io_params.spool) {
+            TERA_COUT("Hashing " << inFiles.size() << " files into spool " << QSTR_TO_CCHAR(spool->dir()));
+            QMap<QString, QString> fixedOut;
+            if (!io_params.in_file.isEmpty()) fixedOut.insert(io_params.in_file, io_params.file_out);
+            QStringList errors;
+            if (!spool->spoolFiles(paths.paths(inFiles), fixedOut, config.getImprintAlgorithm(), errors)) {
+                for (QString const& e : errors) {
+                    TERA_LOG(error) << "   " << e;
+                }
+            }
+        }
+        QStringList errors;
+        if (!spool->refreshChanged(config.getImprintAlgorithm(), errors)) {
+            for (QString const& e : errors) {
+                TERA_LOG(warn) << "   " << e;
+            }
+        }
+        paths.clear();
+        inFiles.clear();
+        for (StampSpool::Entry const& e : spool->pending()) {
+            inFiles.append(paths.add(e.in));
+            preparedRequests.insert(e.in, TimeStamper::Prepared{e.digest, e.request});
+            if (!e.out.isEmpty()) {
+                namegen->setFixedOutFile(e.in, e.out);
+            }
+        }
+        TERA_COUT("Sending " << inFiles.size() << " time-stamp requests from spool");
+    }
 
     if (0 == inFiles.size()) {
         TERA_COUT("No *.(" << QSTR_TO_CCHAR(io_params.in_extensions.join(", ")) << ") files selected for timestamping.");
     }
+    foundCnt = inFiles.size();
     stamper.reset(new ria_tera::BatchStamper(*this, *namegen, false));
 
     QObject::connect(stamper.data(), &ria_tera::BatchStamper::timestampingFinished,
         this, &ria_tera::TeRaMonitor::exitOnFinished, Qt::QueuedConnection); // queued connection needed to ensure a.exec() catches exit
 
-    stamper->getTimestamper().setTimeserverUrl(time_server_url, (useIDCardAuthentication ? &idCardAuth : nullptr));
-    stamper->startTimestamping(time_server_url, inFiles); // TODO error to XXX when network is down for example
+    if (io_params.ts_max_requests > 0) {
+        config.setTimeServerMaxRequests(io_params.ts_max_requests);
+    }
+    stamper->getConcurrency().setParameters(config.getTsaConcurrencyParameters());
+    stamper->getBreaker().setParameters(config.getTsaBreakerParameters());
+    stamper->getTimestamper().setRequestTimeout(config.getTimeServerTimeout());
+    stamper->getTimestamper().setImprintAlgorithm(config.getImprintAlgorithm());
+    addTimeServers(stamper->getTimestamper());
+    for (QString const& url : time_server_urls) {
+        stamper->setQuotaLimits(url, config.getTsaQuotaLimits(url));
+    }
+    stamper->setPreparedRequests(preparedRequests);
+    if (!io_params.submit_requests.isEmpty()) {
+        stamper->setTokenOnly(true);
+        QObject::connect(stamper.data(), &ria_tera::BatchStamper::tokenReceived,
+            this, &ria_tera::TeRaMonitor::bundleTokenReceived);
+    }
+    stamper->startTimestamping(paths, inFiles); // TODO error to XXX when network is down for example
+}
+
+void TeRaMonitor::addTimeServers(TimeStamper& ts) {
+    for (int i = 0; i < time_server_urls.size(); ++i) {
+        TimeStamperRequestConfigurationFactory* auth = (time_server_id_auth.at(i) ? idCardAuth.forUrl(time_server_urls.at(i)) : nullptr);
+        if (0 == i) ts.setTimeserverUrl(time_server_urls.at(i), auth);
+        else ts.addTimeserverUrl(time_server_urls.at(i), auth);
+    }
+}
+
+void TeRaMonitor::writeJournal(QStringList const& deferred) {
+    QList<ResumeJournal::Entry> entries;
+    for (QString const& in : deferred) {
+        entries.append(ResumeJournal::Entry(in, namegen->getFixedOutFile(in)));
+    }
+    QString error;
+    if (!ResumeJournal(io_params.journal).write(entries, error)) {
+        TERA_LOG(error) << "Can't write resume journal: " << error;
+    }
+}
+
+void TeRaMonitor::exportRequests(QStringList const& inFiles) {
+    TERA_COUT("Hashing " << inFiles.size() << " files");
+    QVector<StampSpool::Entry> hashed;
+    hashed.reserve(inFiles.size());
+    for (QString const& f : inFiles) {
+        StampSpool::Entry e;
+        e.in = f;
+        hashed.append(e);
+    }
+    QStringList errors;
+    StampSpool::hashFiles(hashed, config.getImprintAlgorithm(), errors);
+    for (QString const& e : errors) {
+        TERA_LOG(error) << "   " << e;
+    }
+
+    QList<StampBundle::Entry> entries;
+    for (StampSpool::Entry const& h : hashed) {
+        if (h.digest.isEmpty()) continue;
+        StampBundle::Entry e;
+        e.in = h.in;
+        e.out = namegen->getFixedOutFile(h.in);
+        e.size = h.size;
+        // stat before hashing, so a file changed while hashed fails the check on import
+        e.mtime = h.mtime;
+        e.digest = h.digest;
+        e.request = h.request;
+        entries.append(e);
+    }
+
+    QString error;
+    foundCnt = inFiles.size();
+    succeededCnt = entries.size();
+    failedCnt = foundCnt - succeededCnt;
+    if (!StampBundle::write(io_params.export_requests, entries, error)) {
+        TERA_LOG(error) << error;
+        finishRun();
+        QCoreApplication::exit(1);
+        return;
+    }
+    TERA_COUT("Exported " << entries.size() << " time-stamp requests to " << QSTR_TO_CCHAR(io_params.export_requests));
+    finishRun();
+    QCoreApplication::exit(errors.isEmpty() ? 0 : 1);
+}
+
+bool TeRaMonitor::loadSubmitBundle(QStringList& inFiles, QHash<QString, TimeStamper::Prepared>& preparedRequests) {
+    StampBundle bundle;
+    QString error;
+    if (!bundle.open(io_params.submit_requests, error) || !bundle.readAll(bundleEntries, error)) {
+        TERA_LOG(error) << error;
+        return false;
+    }
+    TERA_COUT("Submitting " << bundleEntries.size() << " time-stamp requests from " << QSTR_TO_CCHAR(io_params.submit_requests));
+    for (int i = 0; i < bundleEntries.size(); ++i) {
+        StampBundle::Entry const& e = bundleEntries.at(i);
+        // paths are from the exporting host, used only as keys here
+        inFiles.append(e.in);
+        preparedRequests.insert(e.in, TimeStamper::Prepared{e.digest, e.request});
+        bundleIndex.insert(e.in, i);
+    }
+    return true;
+}
+
+void TeRaMonitor::bundleTokenReceived(QString in, QByteArray token) {
+    auto it = bundleIndex.find(in);
+    if (bundleIndex.end() == it) return;
+    StampBundle::Entry& e = bundleEntries[it.value()];
+    e.token = token;
+    QString mismatch;
+    if (timestamp_matches_request(token, e.request, mismatch)) {
+        bundleTokenOwner.insert(e.digest, it.value());
+    } else if (bundleTokenOwner.contains(e.digest)) {
+        // token was shared from an identical file, its nonce is the one in that file's request
+        e.request = bundleEntries.at(bundleTokenOwner.value(e.digest)).request;
+    }
+}
+
+void TeRaMonitor::importResponses() {
+    StampBundle bundle;
+    QString error;
+    QList<StampBundle::Entry> entries;
+    if (!bundle.open(io_params.import_responses, error) || !bundle.readAll(entries, error)) {
+        TERA_LOG(error) << error;
+        finishRun();
+        QCoreApplication::exit(1);
+        return;
+    }
+
+    importTotal = entries.size();
+    foundCnt = importTotal;
+    qint64 jobId = 0;
+    for (StampBundle::Entry const& e : entries) {
+        QString problem;
+        QFileInfo fi(e.in);
+        QString mismatch;
+        if (e.token.isEmpty()) {
+            problem = "no time-stamp in bundle";
+        } else if (!timestamp_matches_request(e.token, e.request, mismatch)) {
+            problem = mismatch;
+        } else if (!fi.exists() || fi.size() != e.size || fi.lastModified().toMSecsSinceEpoch() != e.mtime) {
+            // digest in bundle is only valid for unchanged file
+            problem = "file has changed since export";
+        }
+        if (!problem.isEmpty()) {
+            processingFileDone(e.in, e.out, succeededCnt + failedCnt, importTotal, false, problem);
+            continue;
+        }
+
+        QString out = (e.out.isEmpty() ? namegen->getOutFile(e.in) : e.out);
+        ++jobId;
+        importJobs.insert(jobId, qMakePair(e.in, out));
+        TeraCreateAsicsJob* job = new TeraCreateAsicsJob(jobId, out, e.in, e.token);
+        QObject::connect(job, &TeraCreateAsicsJob::finished, this, &TeRaMonitor::importJobFinished, Qt::QueuedConnection);
+        importIo.start(job, out);
+    }
+    TERA_COUT("Creating " << importJobs.size() << " containers from " << QSTR_TO_CCHAR(io_params.import_responses));
+    if (importJobs.isEmpty()) {
+        exitOnFinished(BatchStamper::FinishingDetails(true, ""));
+    }
+}
+
+void TeRaMonitor::importJobFinished(qint64 jobId, bool success, QString error) {
+    auto it = importJobs.find(jobId);
+    if (importJobs.end() == it) return;
+    processingFileDone(it.value().first, it.value().second, succeededCnt + failedCnt, importTotal, success, error);
+    if (success) {
+        TERA_COUT("   Created " << QSTR_TO_CCHAR(it.value().second));
+    }
+    importJobs.erase(it);
+    if (importJobs.isEmpty()) {
+        exitOnFinished(BatchStamper::FinishingDetails(true, ""));
+    }
+}
+
+void TeRaMonitor::finishRun() {
+    if (!stamper.isNull()) {
+        TimeStamper::DedupStats dedup = stamper->getTimestamper().dedupStats();
+        stats.dedupFiles = dedup.files;
+        stats.dedupUnique = dedup.unique;
+        TsaEndpointPool const& pool = stamper->getTimestamper().getEndpoints();
+        if (pool.isQuotaLimited()) {
+            stats.quotaUsedToday = pool.quotaUsedToday();
+            stats.quotaUsedThisMonth = pool.quotaUsedThisMonth();
+        }
+    }
+    stats.foundFiles = foundCnt;
+    stats.succeededFiles = succeededCnt;
+    stats.failedFiles = failedCnt;
+    stats.ioDone();
+    stats.log();
+    if (!io_params.report.isEmpty()) {
+        QString error;
+        if (!stats.writeReport(io_params.report, error)) {
+            TERA_LOG(error) << error;
+        }
+    }
+    QString traceError;
+    if (!Trace::close(traceError)) {
+        TERA_LOG(error) << traceError;
+    } else if (!io_params.trace_file.isEmpty()) {
+        TERA_LOG(info) << "Trace written to " << io_params.trace_file;
+    }
 }
 
 void TeRaMonitor::exitOnFinished(ria_tera::BatchStamper::FinishingDetails d) {
-    if (d.success && 0 == failedCnt && succeededCnt == foundCnt) {
+    finishRun();
+    if (!io_params.submit_requests.isEmpty()) {
+        QString error;
+        if (!StampBundle::write(io_params.responses_out, bundleEntries, error)) {
+            TERA_LOG(error) << error;
+            d.success = false;
+            d.errString = error;
+        } else {
+            TERA_COUT("Responses written to " << QSTR_TO_CCHAR(io_params.responses_out));
+        }
+    }
+    if (!stamper.isNull() && stamper->getTimestamper().getEndpoints().size() > 1) {
+        stamper->getTimestamper().getEndpoints().logStats();
+    }
+    if (!spool.isNull()) {
+        spool->sync();
+        spool->compact();
+        if (spool->pendingCount() > 0) {
+            TERA_LOG(warn) << spool->pendingCount() << " time-stamp requests are left in spool " << spool->dir() <<
+                    ", send them with --flush-spool";
+        }
+    }
+    if (io_params.resume && d.deferred.isEmpty() && !d.userCancelled) {
+        // everything from journal was tried, only failed files are left for the next run
+        if (failedFiles.isEmpty()) ResumeJournal(io_params.journal).remove();
+        else writeJournal(failedFiles);
+    }
+    if (!d.deferred.isEmpty()) {
+        writeJournal(d.deferred + failedFiles);
+        TERA_LOG(warn) << "Time server quota is used up, " << d.deferred.size() << " files were left unprocessed";
+        TERA_LOG(warn) << "   Successfully converted: " << succeededCnt;
+        TERA_LOG(warn) << "   Number of failed coversions: " << failedCnt;
+        if (d.deferredUntil.isValid()) {
+            TERA_LOG(warn) << "   Quota allows to process the rest approx. by " << d.deferredUntil.toString(Qt::ISODate);
+        }
+        TERA_LOG(warn) << "Run again with --resume to continue (journal " << io_params.journal << ")";
+        QCoreApplication::exit(EXIT_CODE_DEFERRED);
+    } else if (d.success && 0 == failedCnt && succeededCnt == foundCnt) {
         TERA_COUT("Timestamping finished successfully :)");
         QCoreApplication::exit(0);
     } else {
@@ -300,6 +734,9 @@ void TeRaMonitor::exitOnFinished(ria_tera::BatchStamper::FinishingDetails d) {
         if (!d.success) {
             TERA_LOG(error) << "Error: " << d.errString.toUtf8().constData();
         }
+        if (io_params.resume && !failedFiles.isEmpty() && !d.userCancelled) {
+            TERA_LOG(error) << "Run again with --resume to retry failed files (journal " << io_params.journal << ")";
+        }
         QCoreApplication::exit(1);
     }
     if (!smartCard.isNull()) {
@@ -24,6 +24,10 @@
 #include "poc/logging.h"
 #include "poc/config.h"
 #include "poc/disk_crawler.h"
+#include "poc/metrics_server.h"
+#include "poc/run_stats.h"
+#include "poc/stamp_bundle.h"
+#include "poc/stamp_spool.h"
 #include "poc/timestamper.h"
 
 #include "common/PinDialog.h"
@@ -44,15 +48,51 @@ public:
         bool in_dir_recursive = false;
         QStringList in_extensions;
         QString file_out;
+        /// 0 - use value from config file
+        int ts_max_requests = 0;
+        /// imprint hash algorithm or "auto", empty - use value from config file
+        QString hash_algorithm;
+        /// "cached", "dontneed" or "direct", empty - use value from config file
+        QString page_cache;
+        /// "none", "inode" or "extent", empty - use value from config file
+        QString io_order;
+        /// take input files from journal
+        bool resume = false;
+        QString journal;
+        /// hash into spool first, then send from spool
+        bool spool = false;
+        /// only send what is in spool
+        bool flush_spool = false;
+        QString spool_dir;
+        /// air gap exchange: hash into requests bundle / send requests bundle and
+        /// write responses bundle / create containers from responses bundle
+        QString export_requests;
+        QString submit_requests;
+        QString responses_out;
+        QString import_responses;
+        /// Chrome trace-event file, empty - no tracing
+        QString trace_file;
+        /// JSON run report, empty - none
+        QString report;
+        /// port, host:port or UNIX socket to serve Prometheus metrics on, empty - none
+        QString metrics_listen;
+        /// no time server, configuration or ID-card needed
+        bool offline() const { return !export_requests.isEmpty() || !import_responses.isEmpty(); };
     };
 private:
     enum ID_AUTH_STATE {WAIT_CARD_LIST, WAIT_PIN};
     Config config;
 
-    QString time_server_url_original;
-    QString time_server_url;
+    QStringList time_server_urls_original;
+    /// without ID-card prefix, first one is primary
+    QStringList time_server_urls;
+    QList<bool> time_server_id_auth;
     bool useIDCardAuthentication = false;
     IOParameters io_params;
+    /// stamping was started, later configuration updates are background refreshes
+    bool confReady = false;
+    RunStats stats;
+    QScopedPointer<MetricsServer> metrics;
 
     ID_AUTH_STATE idAuthState = ID_AUTH_STATE::WAIT_CARD_LIST;
     QSharedPointer<QSmartCard> smartCard;
@@ -62,10 +102,13 @@ private:
 
     QScopedPointer<ria_tera::OutputNameGenerator> namegen;
     QScopedPointer<ria_tera::BatchStamper> stamper;
+    QScopedPointer<ria_tera::StampSpool> spool;
+    /// sends the test request confirming the "auto" imprint algorithm
+    QScopedPointer<ria_tera::TimeStamper> imprintCheck;
 public:
     virtual PinDialogInterface* createPinDialog(PinDialogInterface::PinFlags flags, const QSslCertificate &cert);
 
-    void kickstart(QString const& ts_url, IOParameters const& iop);
+    void kickstart(QStringList const& ts_urls, IOParameters const& iop);
 signals:
     void kickstart_signal();
     void signal_stepSelectCard();
@@ -75,6 +118,8 @@ public slots:
     void stepStartProcess();
     void stepSelectCard();
     void stepAuthenticatePIN1();
+    void stepCheckImprint();
+    void imprintChecked(bool success, QByteArray resp, QString errString);
     void stepFindAndStamp();
 
     void globalConfFinished(bool changed, const QString &error);
@@ -83,6 +128,9 @@ public slots:
     void cardDataChanged();
 
     void exitOnFinished(ria_tera::BatchStamper::FinishingDetails d);
+
+    void bundleTokenReceived(QString in, QByteArray token);
+    void importJobFinished(qint64 jobId, bool success, QString error);
 public:
     TeRaMonitor();
     bool processingPath(QString const& path, double progress_percent) {
@@ -98,7 +146,8 @@ public:
         return true;
     };
     bool processingFile(QString const& pathIn, QString const& pathOut, int nr, int totalCnt) {
-        TERA_COUT("Timestamping (" << (nr+1) << "/" << totalCnt << ") " << pathIn.toUtf8().constData() <<
+        TERA_COUT("Timestamping (" << (nr+1) << "/" << totalCnt << ") [parallel requests " <<
+                stamper->inFlightCount() << "/" << stamper->currentWindow() << "] " << pathIn.toUtf8().constData() <<
                 " -> " << pathOut.toUtf8().constData());
         return true;
     };
@@ -106,16 +155,41 @@ public:
         foundCnt = totalCnt;
         if (success) {
             succeededCnt++;
+            if (!spool.isNull()) spool->markDone(pathIn);
         } else {
             failedCnt++;
+            failedFiles.append(pathIn);
             TERA_LOG(error) << "   Error converting " << pathIn.toUtf8().constData() << ": " << errString.toUtf8().constData();
         }
         return true;
     };
 private:
+    void startWithConfiguration(bool fromCache);
+    void addTimeServers(TimeStamper& ts);
+
+    /// logs run stats, writes --report and closes the trace, called once before exit
+    void finishRun();
+    void writeJournal(QStringList const& deferred);
+    void exportRequests(QStringList const& inFiles);
+    bool loadSubmitBundle(QStringList& inFiles, QHash<QString, TimeStamper::Prepared>& preparedRequests);
+    void importResponses();
+
+    /// submitted requests bundle, tokens are filled in as they arrive
+    QList<StampBundle::Entry> bundleEntries;
+    QHash<QString, int> bundleIndex;
+    /// digest -> entry whose own request got the token, identical files share it
+    QHash<QByteArray, int> bundleTokenOwner;
+    /// import job -> (in, out)
+    QHash<qint64, QPair<QString, QString>> importJobs;
+    int importTotal = 0;
+
     int foundCnt = 0;
     int succeededCnt = 0;
     int failedCnt = 0;
+    /// kept in resume journal for the next run
+    QStringList failedFiles;
+    /// container jobs of import, last so it waits for them first
+    IoScheduler importIo;
 };
 
 
@@ -20,9 +20,47 @@
 #include "HttpsIDCardAuthentication.h"
 
 #include <QSslKey>
+#include <QUrl>
+
+namespace {
+
+bool issuedFor(QSslCertificate const& cert, QString const& host) {
+    QStringList names = cert.subjectAlternativeNames().values(QSsl::DnsEntry);
+    if (names.isEmpty()) names = cert.subjectInfo(QSslCertificate::CommonName);
+    for (QString const& name : names) {
+        if (0 == name.compare(host, Qt::CaseInsensitive)) return true;
+        // wildcard covers one label
+        if (name.startsWith("*.") && 0 == name.mid(2).compare(host.section('.', 1), Qt::CaseInsensitive)) return true;
+    }
+    return false;
+}
+
+}
 
 namespace ria_tera {
 
+class HttpsIDCardAuthentication::Endpoint : public TimeStamperRequestConfigurationFactory {
+public:
+    Endpoint(HttpsIDCardAuthentication& login, QString const& host) : login(login), host(host) {}
+
+    void setTrusted(QList<QSslCertificate> const& certs) {
+        trusted.clear();
+        for (QSslCertificate const& c : certs) {
+            if (issuedFor(c, host)) trusted.append(c);
+        }
+    }
+    bool isTrusted(QSslCertificate const& request) {
+        return trusted.contains(request);
+    }
+    void configureRequest(QNetworkRequest& request) {
+        login.configureRequest(request);
+    }
+private:
+    HttpsIDCardAuthentication& login;
+    QString host;
+    QList<QSslCertificate> trusted;
+};
+
 HttpsIDCardAuthentication::HttpsIDCardAuthentication() = default;
 
 HttpsIDCardAuthentication::~HttpsIDCardAuthentication() = default;
@@ -49,6 +87,9 @@ void HttpsIDCardAuthentication::setAuthCert(QSslCertificate const& cert, QSslKey
 
 void HttpsIDCardAuthentication::addTrustedCerts(QList<QSslCertificate> const& certs) {
     trusted = certs;
+    for (QSharedPointer<Endpoint> const& ep : endpoints) {
+        ep->setTrusted(trusted);
+    }
 }
 
 bool HttpsIDCardAuthentication::isTrusted(QSslCertificate const& request) {
@@ -68,4 +109,13 @@ void HttpsIDCardAuthentication::configureRequest(QNetworkRequest& request) {
     request.setSslConfiguration(ssl);
 }
 
+TimeStamperRequestConfigurationFactory* HttpsIDCardAuthentication::forUrl(QString const& url) {
+    QSharedPointer<Endpoint>& ep = endpoints[url];
+    if (ep.isNull()) {
+        ep.reset(new Endpoint(*this, QUrl(url).host()));
+        ep->setTrusted(trusted);
+    }
+    return ep.data();
+}
+
 }
@@ -19,7 +19,9 @@
 
 #pragma once
 
+#include <QHash>
 #include <QObject>
+#include <QSharedPointer>
 #include <QSslKey>
 
 #include "../../poc/timestamper.h"
@@ -38,10 +40,17 @@ public:
 
     bool isTrusted(QSslCertificate const& request);
     void configureRequest(QNetworkRequest& request);
+
+    /// Configurator of one time server (url without ID-card prefix): uses this
+    /// ID-card login, trusts only the certificates issued for its host
+    TimeStamperRequestConfigurationFactory* forUrl(QString const& url);
 private:
+    class Endpoint;
+
     QSslCertificate m_authSert;
     QSslKey m_key;
     QList<QSslCertificate> trusted;
+    QHash<QString, QSharedPointer<Endpoint>> endpoints;
 };
 
 }